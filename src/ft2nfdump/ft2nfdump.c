@@ -99,6 +99,7 @@ void usage(char *name) {
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=<comp>:delta\tDelta encode flows before compression.\n"
         "Convert flow-tools format to nfdump format:\n"
         "ft2nfdump -r <flow-tools-data-file> -w <nfdump-file> [-z]\n",
         name);
@@ -44,6 +44,7 @@
 
 #include "filter.h"
 #include "ja3/ja3.h"
+#include "listlookup.h"
 #include "maxmind.h"
 #include "sgregex.h"
 #include "util.h"
@@ -54,7 +55,6 @@ static uint32_t memblocks;
 static uint32_t NumBlocks = 1; /* index 0 reserved */
 static int Extended = 0;
 uint32_t StartNode = 0;
-uint32_t HasGeoDB = 0;
 
 typedef uint64_t (*flow_proc_t)(void *, uint32_t, data_t, recordHandle_t *);
 
@@ -79,17 +79,68 @@ typedef struct filterElement {
     char *fname;              /* ascii function name */
     char *label;              /* label, if any */
     data_t data;              /* any additional data for this block */
+    void *lookup;             /* lookup table of a large IP or value list */
+    uint32_t evalCost;        /* cost to evaluate this element */
+    double cost;              /* expected cost to evaluate the superblock */
+    double pTrue;             /* estimated probability of the superblock to be true */
 } filterElement_t;
 
+/*
+ * the AND, OR and NOT operations of the parser are logged, in order to reconnect the
+ * filter elements in a different order after the selectivity of the elements is sampled
+ */
+typedef struct filterOp_s {
+    uint32_t op;
+#define FILTER_AND 1
+#define FILTER_OR 2
+#define FILTER_NOT 3
+    uint32_t block1;  // blocks as passed by the parser
+    uint32_t block2;
+    uint32_t result;  // resulting superblock
+} filterOp_t;
+
+/*
+ * compiled filter node
+ * each node evaluates a filter element with a function, specialised for the comparator and
+ * the value length of the element and links directly to the nodes of the OnTrue/OnFalse elements
+ */
+typedef struct filterNode_s filterNode_t;
+typedef int (*nodeEval_t)(const filterNode_t *, recordHandle_t *, const char *);
+
+struct filterNode_s {
+    nodeEval_t eval;
+    uint32_t extID;
+    uint32_t offset;
+    uint64_t value;
+    uint64_t mask;                   // net mask of CMP_NET
+    const void *lookup;              // lookup table of CMP_IPLIST, CMP_U64LIST
+    const filterNode_t *OnTrue;      // next node, NULL: end of filter
+    const filterNode_t *OnFalse;     // next node, NULL: end of filter
+    const filterElement_t *element;  // element for the generic evaluation
+    int invert;
+};
+
 typedef struct FilterEngine_s {
     filterElement_t *filter;
+    uint32_t numElements;  // number of filter elements incl. reserved index 0
     uint32_t StartNode;
     uint16_t Extended;
+    uint32_t numNodes;    // number of nodes reachable from StartNode
+    uint32_t *nodeOrder;  // reachable nodes in topological order for batch evaluation
+    filterNode_t *nodes;  // compiled nodes, indexed as the filter elements
+    filterOp_t *ops;      // operations of the parser
+    uint32_t numOps;
+    uint32_t numSampled;  // number of sampled records
+    uint32_t *numTrue;    // number of sampled records, each element is true
+    uint8_t *matchCache;  // result of each element in FilterBlock(), allocated with the first call
     char *label;
     int (*filterFunction)(const struct FilterEngine_s *, recordHandle_t *, const char *);
 } FilterEngine_t;
 
 static filterElement_t *FilterTree;
+static filterOp_t *FilterOps;
+static uint32_t NumOps = 0;
+static uint32_t MaxOps = 0;
 
 static void UpdateList(uint32_t a, uint32_t b);
 
@@ -114,19 +165,20 @@ static struct flow_procs_map_s {
     filterFunction_t filterNum;
     char *name;
     flow_proc_t function;
-} flow_procs_map[] = {{FUNC_NONE, "none", NULL},
-                      {FUNC_DURATION, "duration", duration_function},
-                      {FUNC_PPS, "pps", pps_function},
-                      {FUNC_BPS, "bps", bps_function},
-                      {FUNC_BPP, "bpp", bpp_function},
-                      {FUNC_MPLS_LABEL, "mpls label", mpls_label_function},
-                      {FUNC_MPLS_EOS, "mpls eos", mpls_eos_function},
-                      {FUNC_MPLS_EXP, "mpls exp", mpls_exp_function},
-                      {FUNC_MPLS_ANY, "mpls any", mpls_any_function},
-                      {FUNC_PBLOCK, "pblock", pblock_function},
-                      {FUNC_MMAS_LOOKUP, "AS Lockup", mmASLookup_function},
-                      {FUNC_JA3, "ja3", ja3_function},
-                      {0, NULL, NULL}};
+    uint32_t cost;  // cost of the function relative to a plain compare
+} flow_procs_map[] = {{FUNC_NONE, "none", NULL, 0},
+                      {FUNC_DURATION, "duration", duration_function, 1},
+                      {FUNC_PPS, "pps", pps_function, 2},
+                      {FUNC_BPS, "bps", bps_function, 2},
+                      {FUNC_BPP, "bpp", bpp_function, 2},
+                      {FUNC_MPLS_LABEL, "mpls label", mpls_label_function, 1},
+                      {FUNC_MPLS_EOS, "mpls eos", mpls_eos_function, 4},
+                      {FUNC_MPLS_EXP, "mpls exp", mpls_exp_function, 1},
+                      {FUNC_MPLS_ANY, "mpls any", mpls_any_function, 4},
+                      {FUNC_PBLOCK, "pblock", pblock_function, 1},
+                      {FUNC_MMAS_LOOKUP, "AS Lockup", mmASLookup_function, 40},
+                      {FUNC_JA3, "ja3", ja3_function, 50},
+                      {0, NULL, NULL, 0}};
 
 // 128bit compare for IPv6
 static int IPNodeCMP(struct IPListNode *e1, struct IPListNode *e2) {
@@ -269,7 +321,7 @@ static uint64_t mmASLookup_function(void *dataPtr, uint32_t length, data_t data,
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
     EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
     uint32_t as = *((uint32_t *)dataPtr);
-    if (HasGeoDB == 0 || as != 0) return as;
+    if (as != 0 || !Loaded_MaxMind()) return as;
 
     if (ipv4Flow) {
         as = LookupV4AS(ipv4Flow->srcAddr);
@@ -360,6 +412,29 @@ static int geoLookup(char *geoChar, uint64_t direction, recordHandle_t *recordHa
 
 }  // ENd of geoLookup
 
+/*
+ * cost to evaluate a comparator relative to a plain compare
+ */
+static uint32_t ComparatorCost(comparator_t comp) {
+    switch (comp) {
+        case CMP_IDENT:
+        case CMP_STRING:
+        case CMP_BINARY:
+            return 2;
+        case CMP_IPLIST:
+        case CMP_U64LIST:
+            return 3;
+        case CMP_PAYLOAD:
+            return 20;
+        case CMP_GEO:
+            return 40;
+        case CMP_REGEX:
+            return 50;
+        default:
+            return 1;
+    }
+}  // End of ComparatorCost
+
 /*
  * Returns next free slot in blocklist
  */
@@ -400,6 +475,9 @@ uint32_t NewElement(uint32_t extID, uint32_t offset, uint32_t length, uint64_t v
         .superblock = n,
     };
     FilterTree[n].blocklist[0] = n;
+    FilterTree[n].evalCost = ComparatorCost(comp) + flow_procs_map[function].cost;
+    FilterTree[n].cost = FilterTree[n].evalCost;
+    FilterTree[n].pTrue = 0.5;
 
     if (comp > 0 || function > 0) Extended = 1;
     NumBlocks++;
@@ -410,72 +488,53 @@ uint32_t NewElement(uint32_t extID, uint32_t offset, uint32_t length, uint64_t v
 /*
  * Inverts OnTrue and OnFalse
  */
-uint32_t Invert(uint32_t a) {
+static uint32_t InvertBlock(uint32_t a) {
     uint32_t i, j;
 
     for (i = 0; i < FilterTree[a].numblocks; i++) {
         j = FilterTree[a].blocklist[i];
         FilterTree[j].invert = FilterTree[j].invert ? 0 : 1;
     }
+    FilterTree[a].pTrue = 1.0 - FilterTree[a].pTrue;
     return a;
 
-} /* End of Invert */
+} /* End of InvertBlock */
 
 /*
- * Connects the two blocks b1 and b2 ( AND ) and returns index of superblock
+ * expected cost to evaluate the superblocks first and second, connected with op.
+ * second is evaluated, unless first already decides the result
  */
-uint32_t Connect_AND(uint32_t b1, uint32_t b2) {
-    uint32_t a, b, i, j;
-
-    // do not optimise blocks if block 'any' is appended
-    if ((FilterTree[b2].data.dataVal == -1) || (FilterTree[b1].numblocks <= FilterTree[b2].numblocks)) {
-        a = b1;
-        b = b2;
-    } else {
-        a = b2;
-        b = b1;
-    }
-    /* a points to block with less children and becomes the superblock
-     * connect b to a
-     */
-    for (i = 0; i < FilterTree[a].numblocks; i++) {
-        j = FilterTree[a].blocklist[i];
-        if (FilterTree[j].invert) {
-            if (FilterTree[j].OnFalse == 0) {
-                FilterTree[j].OnFalse = b;
-            }
-        } else {
-            if (FilterTree[j].OnTrue == 0) {
-                FilterTree[j].OnTrue = b;
-            }
-        }
-    }
-    UpdateList(a, b);
-    return a;
-
-} /* End of Connect_AND */
+static double ConnectCost(uint32_t first, uint32_t second, uint32_t op) {
+    double pNext = op == FILTER_AND ? FilterTree[first].pTrue : 1.0 - FilterTree[first].pTrue;
+    return FilterTree[first].cost + pNext * FilterTree[second].cost;
+}  // End of ConnectCost
 
 /*
- * Connects the two blocks b1 and b2 ( OR ) and returns index of superblock
+ * Connects the two blocks b1 and b2 ( AND or OR ) and returns index of superblock
+ * The block with the lower expected cost of the connection is evaluated first
  */
-uint32_t Connect_OR(uint32_t b1, uint32_t b2) {
+static uint32_t ConnectBlocks(uint32_t b1, uint32_t b2, uint32_t op) {
     uint32_t a, b, i, j;
 
-    // do not optimise block 'any' if appended as lastelement
+    double cost1 = ConnectCost(b1, b2, op);
+    double cost2 = ConnectCost(b2, b1, op);
+    // do not optimise blocks if block 'any' is appended
     // for all prepending blocks to be evaluated.
-    if ((FilterTree[b2].data.dataVal == -1) || (FilterTree[b1].numblocks <= FilterTree[b2].numblocks)) {
+    if ((FilterTree[b2].data.dataVal == -1) || (cost1 < cost2) ||
+        (cost1 == cost2 && FilterTree[b1].numblocks <= FilterTree[b2].numblocks)) {
         a = b1;
         b = b2;
     } else {
         a = b2;
         b = b1;
     }
-    /* a points to block with less children and becomes the superblock
+    /* a is evaluated first and becomes the superblock
      * connect b to a
      */
     for (i = 0; i < FilterTree[a].numblocks; i++) {
         j = FilterTree[a].blocklist[i];
-        if (FilterTree[j].invert) {
+        // AND continues on true, OR on false - swapped for inverted elements
+        if ((op == FILTER_AND) != (FilterTree[j].invert != 0)) {
             if (FilterTree[j].OnTrue == 0) {
                 FilterTree[j].OnTrue = b;
             }
@@ -485,10 +544,48 @@ uint32_t Connect_OR(uint32_t b1, uint32_t b2) {
             }
         }
     }
+
+    double pTrue;
+    if (op == FILTER_AND)
+        pTrue = FilterTree[a].pTrue * FilterTree[b].pTrue;
+    else
+        pTrue = 1.0 - (1.0 - FilterTree[a].pTrue) * (1.0 - FilterTree[b].pTrue);
+    FilterTree[a].cost = ConnectCost(a, b, op);
+    FilterTree[a].pTrue = pTrue;
+
     UpdateList(a, b);
     return a;
 
-} /* End of Connect_OR */
+} /* End of ConnectBlocks */
+
+static void LogFilterOp(uint32_t op, uint32_t block1, uint32_t block2, uint32_t result) {
+    if (NumOps == MaxOps) {
+        MaxOps += MAXBLOCKS;
+        FilterOps = realloc(FilterOps, MaxOps * sizeof(filterOp_t));
+        if (!FilterOps) {
+            LogError("Memory allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+    FilterOps[NumOps++] = (filterOp_t){.op = op, .block1 = block1, .block2 = block2, .result = result};
+}  // End of LogFilterOp
+
+uint32_t Invert(uint32_t a) {
+    LogFilterOp(FILTER_NOT, a, 0, a);
+    return InvertBlock(a);
+}  // End of Invert
+
+uint32_t Connect_AND(uint32_t b1, uint32_t b2) {
+    uint32_t a = ConnectBlocks(b1, b2, FILTER_AND);
+    LogFilterOp(FILTER_AND, b1, b2, a);
+    return a;
+}  // End of Connect_AND
+
+uint32_t Connect_OR(uint32_t b1, uint32_t b2) {
+    uint32_t a = ConnectBlocks(b1, b2, FILTER_OR);
+    LogFilterOp(FILTER_OR, b1, b2, a);
+    return a;
+}  // End of Connect_OR
 
 /*
  * Update supernode infos:
@@ -519,6 +616,7 @@ static void UpdateList(uint32_t a, uint32_t b) {
     /* cleanup old node 'b' */
     FilterTree[b].numblocks = 0;
     if (FilterTree[b].blocklist) free(FilterTree[b].blocklist);
+    FilterTree[b].blocklist = NULL;
 
 } /* End of UpdateList */
 
@@ -528,6 +626,7 @@ static void UpdateList(uint32_t a, uint32_t b) {
 static void ClearFilter(void) {
     NumBlocks = 1;
     Extended = 0;
+    NumOps = 0;
     memset((void *)FilterTree, 0, MAXBLOCKS * sizeof(filterElement_t));
 } /* End of ClearFilter */
 
@@ -592,144 +691,430 @@ static int RunFilterFast(const FilterEngine_t *engine, recordHandle_t *handle, c
 
 }  // End of RunFilter
 
-static int RunExtendedFilter(const FilterEngine_t *engine, recordHandle_t *handle, const char *ident) {
-    HasGeoDB = Loaded_MaxMind();
-    uint32_t index = engine->StartNode;
-    int evaluate = 0;
-    int invert = 0;
-    while (index) {
-        uint32_t extID = engine->filter[index].extID;
-        size_t offset = engine->filter[index].offset;
-        invert = engine->filter[index].invert;
+/*
+ * evaluate the fast filter node by node over a batch of records. Each record walks the same
+ * node graph as in RunFilterFast(), but each node is evaluated for all records of the batch,
+ * which currently wait at this node. The nodes are visited in topological order, therefore all
+ * records reaching a node have arrived, before the node is evaluated.
+ */
+static void RunFilterFastBatch(const FilterEngine_t *engine, recordHandle_t *handles, uint32_t numRecords, uint64_t *selection) {
+    uint32_t node[FILTERBATCH];
+    uint16_t index[FILTERBATCH];
+    uint64_t inVal[FILTERBATCH];
+
+    uint32_t numActive = 0;
+    for (uint32_t i = 0; i < numRecords; i++) {
+        if (selection[i >> 6] & (1ULL << (i & 0x3F))) {
+            node[i] = engine->StartNode;
+            numActive++;
+        } else {
+            node[i] = 0;
+        }
+    }
 
-        void *inPtr = handle->extensionList[extID];
-        if (inPtr == NULL) {
-            evaluate = 0;
-            index = engine->filter[index].OnFalse;
-            continue;
+    for (uint32_t n = 0; n < engine->numNodes && numActive; n++) {
+        uint32_t nodeIndex = engine->nodeOrder[n];
+        const filterElement_t *element = &engine->filter[nodeIndex];
+
+        // collect all records waiting at this node
+        uint32_t numWaiting = 0;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            index[numWaiting] = i;
+            numWaiting += node[i] == nodeIndex;
         }
-        inPtr += offset;
+        if (numWaiting == 0) continue;
 
-        data_t data = engine->filter[index].data;
-        uint32_t length = engine->filter[index].length;
-        uint64_t inVal = 0;
-        if (engine->filter[index].function != NULL) {
-            inVal = engine->filter[index].function(inPtr, length, data, handle);
-        } else {
-            switch (length) {
-                case 0:
-                    break;
-                case 1:
-                    inVal = *((uint8_t *)inPtr);
-                    break;
-                case 2:
-                    inVal = *((uint16_t *)inPtr);
-                    break;
-                case 4:
-                    inVal = *((uint32_t *)inPtr);
-                    break;
-                case 8:
-                    inVal = *((uint64_t *)inPtr);
-                case 3:
-                case 5:
-                case 7:
-                    memcpy((void *)&inVal, inPtr, length);
-                    break;
+        // load the values of all waiting records - records without the extension do not match
+        uint32_t extID = element->extID;
+        size_t offset = element->offset;
+        uint64_t missing = ~element->value;
+        switch (element->length) {
+            case 0:
+                for (uint32_t k = 0; k < numWaiting; k++) {
+                    inVal[k] = handles[index[k]].extensionList[extID] ? 0 : missing;
+                }
+                break;
+            case 1:
+                for (uint32_t k = 0; k < numWaiting; k++) {
+                    void *inPtr = handles[index[k]].extensionList[extID];
+                    inVal[k] = inPtr ? *((uint8_t *)(inPtr + offset)) : missing;
+                }
+                break;
+            case 2:
+                for (uint32_t k = 0; k < numWaiting; k++) {
+                    void *inPtr = handles[index[k]].extensionList[extID];
+                    inVal[k] = inPtr ? *((uint16_t *)(inPtr + offset)) : missing;
+                }
+                break;
+            case 4:
+                for (uint32_t k = 0; k < numWaiting; k++) {
+                    void *inPtr = handles[index[k]].extensionList[extID];
+                    inVal[k] = inPtr ? *((uint32_t *)(inPtr + offset)) : missing;
+                }
+                break;
+            case 8:
+                for (uint32_t k = 0; k < numWaiting; k++) {
+                    void *inPtr = handles[index[k]].extensionList[extID];
+                    inVal[k] = inPtr ? *((uint64_t *)(inPtr + offset)) : missing;
+                }
+                break;
+            default:
+                for (uint32_t k = 0; k < numWaiting; k++) {
+                    void *inPtr = handles[index[k]].extensionList[extID];
+                    inVal[k] = 0;
+                    if (inPtr)
+                        memcpy((void *)&inVal[k], inPtr + offset, element->length);
+                    else
+                        inVal[k] = missing;
+                }
+        }
+
+        // compare and move each record to the next node or set its result
+        uint64_t value = element->value;
+        for (uint32_t k = 0; k < numWaiting; k++) {
+            uint32_t i = index[k];
+            int evaluate = inVal[k] == value;
+            uint32_t next = evaluate ? element->OnTrue : element->OnFalse;
+            node[i] = next;
+            if (next == 0) {
+                numActive--;
+                if ((element->invert ? !evaluate : evaluate) == 0) selection[i >> 6] &= ~(1ULL << (i & 0x3F));
             }
         }
+    }
+
+}  // End of RunFilterFastBatch
+
+/*
+ * filter a batch of up to FILTERBATCH mapped records. selection is a bitmap with one bit
+ * per record - bit i set selects handles[i] for filtering. The bits of all records, which
+ * do not match the filter are cleared.
+ */
+void FilterRecordBatch(void *engine, recordHandle_t *handles, uint32_t numRecords, const char *ident, uint64_t *selection) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    dbg_assert(numRecords <= FILTERBATCH);
+
+    if (filterEngine->Extended || filterEngine->nodeOrder == NULL) {
+        for (uint32_t i = 0; i < numRecords; i++) {
+            uint64_t bit = 1ULL << (i & 0x3F);
+            if ((selection[i >> 6] & bit) && !filterEngine->filterFunction(filterEngine, &handles[i], ident)) selection[i >> 6] &= ~bit;
+        }
+    } else {
+        RunFilterFastBatch(filterEngine, handles, numRecords, selection);
+    }
 
-        switch (engine->filter[index].comp) {
-            case CMP_EQ:
-                evaluate = inVal == engine->filter[index].value;
+}  // End of FilterRecordBatch
+
+/*
+ * evaluate a single filter element for a record
+ * returns 0, if the record does not contain the extension of the element
+ */
+static inline int EvalElement(const filterElement_t *element, recordHandle_t *handle, const char *ident) {
+    int evaluate = 0;
+    uint32_t extID = element->extID;
+    size_t offset = element->offset;
+
+    void *inPtr = handle->extensionList[extID];
+    if (inPtr == NULL) return 0;
+    inPtr += offset;
+
+    data_t data = element->data;
+    uint32_t length = element->length;
+    uint64_t inVal = 0;
+    if (element->function != NULL) {
+        inVal = element->function(inPtr, length, data, handle);
+    } else {
+        switch (length) {
+            case 0:
                 break;
-            case CMP_GT:
-                evaluate = inVal > engine->filter[index].value;
+            case 1:
+                inVal = *((uint8_t *)inPtr);
                 break;
-            case CMP_LT:
-                evaluate = inVal < engine->filter[index].value;
+            case 2:
+                inVal = *((uint16_t *)inPtr);
                 break;
-            case CMP_GE:
-                evaluate = inVal >= engine->filter[index].value;
+            case 4:
+                inVal = *((uint32_t *)inPtr);
                 break;
-            case CMP_LE:
-                evaluate = inVal <= engine->filter[index].value;
+            case 8:
+                inVal = *((uint64_t *)inPtr);
+            case 3:
+            case 5:
+            case 7:
+                memcpy((void *)&inVal, inPtr, length);
                 break;
-            case CMP_FLAGS: {
-                evaluate = (inVal & engine->filter[index].value) == engine->filter[index].value;
-            } break;
-            case CMP_IDENT: {
-                char *str = (char *)data.dataPtr;
-                evaluate = str != NULL && (strcmp(ident, str) == 0 ? 1 : 0);
-            } break;
-            case CMP_STRING: {
-                char *str = (char *)data.dataPtr;
-                evaluate = str != NULL && (strcmp(inPtr, str) == 0 ? 1 : 0);
-            } break;
-            case CMP_BINARY: {
-                void *dataPtr = data.dataPtr;
-                evaluate = dataPtr != NULL && memcmp(inPtr, dataPtr, length) == 0;
-            } break;
-            case CMP_NET: {
-                uint64_t mask = data.dataVal;
-                evaluate = (inVal & mask) == engine->filter[index].value;
-            } break;
-            case CMP_IPLIST: {
+        }
+    }
+
+    switch (element->comp) {
+        case CMP_EQ:
+            evaluate = inVal == element->value;
+            break;
+        case CMP_GT:
+            evaluate = inVal > element->value;
+            break;
+        case CMP_LT:
+            evaluate = inVal < element->value;
+            break;
+        case CMP_GE:
+            evaluate = inVal >= element->value;
+            break;
+        case CMP_LE:
+            evaluate = inVal <= element->value;
+            break;
+        case CMP_FLAGS: {
+            evaluate = (inVal & element->value) == element->value;
+        } break;
+        case CMP_IDENT: {
+            char *str = (char *)data.dataPtr;
+            evaluate = str != NULL && (strcmp(ident, str) == 0 ? 1 : 0);
+        } break;
+        case CMP_STRING: {
+            char *str = (char *)data.dataPtr;
+            evaluate = str != NULL && (strcmp(inPtr, str) == 0 ? 1 : 0);
+        } break;
+        case CMP_BINARY: {
+            void *dataPtr = data.dataPtr;
+            evaluate = dataPtr != NULL && memcmp(inPtr, dataPtr, length) == 0;
+        } break;
+        case CMP_NET: {
+            uint64_t mask = data.dataVal;
+            evaluate = (inVal & mask) == element->value;
+        } break;
+        case CMP_IPLIST: {
+            if (element->lookup) {
                 if (length == 4) {
-                    struct IPListNode find = {.ip[0] = 0, .ip[1] = inVal, .mask[0] = 0xffffffffffffffffLL, .mask[1] = 0xffffffffffffffffLL};
-                    evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
+                    evaluate = IPLookup4(element->lookup, inVal);
                 } else if (length == 16) {
-                    struct IPListNode find = {.ip[0] = *((uint64_t *)inPtr),
-                                              .ip[1] = *((uint64_t *)(inPtr + 8)),
-                                              .mask[0] = 0xffffffffffffffffLL,
-                                              .mask[1] = 0xffffffffffffffffLL};
-                    evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
-                } else {
-                    evaluate = 0;
+                    uint64_t ip[2] = {*((uint64_t *)inPtr), *((uint64_t *)(inPtr + 8))};
+                    evaluate = IPLookup6(element->lookup, ip);
                 }
-            } break;
-            case CMP_U64LIST: {
+            } else if (length == 4) {
+                struct IPListNode find = {.ip[0] = 0, .ip[1] = inVal, .mask[0] = 0xffffffffffffffffLL, .mask[1] = 0xffffffffffffffffLL};
+                evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
+            } else if (length == 16) {
+                struct IPListNode find = {.ip[0] = *((uint64_t *)inPtr),
+                                          .ip[1] = *((uint64_t *)(inPtr + 8)),
+                                          .mask[0] = 0xffffffffffffffffLL,
+                                          .mask[1] = 0xffffffffffffffffLL};
+                evaluate = RB_FIND(IPtree, data.dataPtr, &find) != NULL;
+            } else {
+                evaluate = 0;
+            }
+        } break;
+        case CMP_U64LIST: {
+            if (element->lookup) {
+                evaluate = U64Lookup(element->lookup, inVal);
+            } else {
                 struct U64ListNode find = {.value = inVal};
                 evaluate = RB_FIND(U64tree, data.dataPtr, &find) != NULL;
-            } break;
-            case CMP_PAYLOAD: {
-                char *payload = (char *)(handle->extensionList[extID]);
-                char *string = (char *)engine->filter[index].data.dataPtr;
-                uint32_t len = ExtensionLength(payload);
-                evaluate = 0;
-                if (string != NULL) {
-                    // find any string str in payload data inPtr, even beyond '\0' bytes
-                    int m = 0;
-                    for (int i = 0; i < len; i++) {
-                        if (payload[i] == string[m]) {
-                            m++;
-                            if (string[m] == '\0') {
-                                evaluate = 1;
-                                break;
-                            }
-                        } else {
-                            m = 0;
+            }
+        } break;
+        case CMP_PAYLOAD: {
+            char *payload = (char *)(handle->extensionList[extID]);
+            char *string = (char *)element->data.dataPtr;
+            uint32_t len = ExtensionLength(payload);
+            evaluate = 0;
+            if (string != NULL) {
+                // find any string str in payload data inPtr, even beyond '\0' bytes
+                int m = 0;
+                for (int i = 0; i < len; i++) {
+                    if (payload[i] == string[m]) {
+                        m++;
+                        if (string[m] == '\0') {
+                            evaluate = 1;
+                            break;
                         }
+                    } else {
+                        m = 0;
                     }
                 }
-            } break;
-            case CMP_REGEX: {
-                srx_Context *program = (srx_Context *)data.dataPtr;
-                char *payload = (char *)(handle->extensionList[extID]);
-                uint32_t len = ExtensionLength(payload);
-
-                evaluate = program != NULL && srx_MatchExt(program, payload, len, 0);
-            } break;
-            case CMP_GEO: {
-                char *geoChar = (char *)inPtr;
-                if (HasGeoDB && geoChar[0] == '\0') inVal = geoLookup(geoChar, data.dataVal, handle);
-                evaluate = inVal == engine->filter[index].value;
-            } break;
-        }
-        index = evaluate ? engine->filter[index].OnTrue : engine->filter[index].OnFalse;
+            }
+        } break;
+        case CMP_REGEX: {
+            srx_Context *program = (srx_Context *)data.dataPtr;
+            char *payload = (char *)(handle->extensionList[extID]);
+            uint32_t len = ExtensionLength(payload);
+
+            evaluate = program != NULL && srx_MatchExt(program, payload, len, 0);
+        } break;
+        case CMP_GEO: {
+            char *geoChar = (char *)inPtr;
+            if (geoChar[0] == '\0' && Loaded_MaxMind()) inVal = geoLookup(geoChar, data.dataVal, handle);
+            evaluate = inVal == element->value;
+        } break;
+    }
+    return evaluate;
+
+}  // End of EvalElement
+
+static int RunExtendedFilter(const FilterEngine_t *engine, recordHandle_t *handle, const char *ident) {
+    uint32_t index = engine->StartNode;
+    int evaluate = 0;
+    int invert = 0;
+    while (index) {
+        const filterElement_t *element = &engine->filter[index];
+        invert = element->invert;
+        evaluate = EvalElement(element, handle, ident);
+        index = evaluate ? element->OnTrue : element->OnFalse;
     }
     return invert ? !evaluate : evaluate;
 }  // End of RunFilter
 
+/*
+ * get the block index zone map of a filter element
+ * returns 1 and sets min/max, if the block index has a zone map for this element, 0 otherwise
+ */
+static int ElementZoneMap(const filterElement_t *element, const blockIndex_t *blockIndex, uint64_t *min, uint64_t *max) {
+    if (element->function != NULL) return 0;
+
+    switch (element->extID) {
+        case EXnull:
+            if (element->offset == OFFexporterID && element->length == SIZEexporterID) {
+                *min = blockIndex->exporterIDMin;
+                *max = blockIndex->exporterIDMax;
+                return 1;
+            }
+            break;
+        case EXgenericFlowID:
+            if (element->offset == OFFsrcPort && element->length == SIZEsrcPort) {
+                *min = blockIndex->srcPortMin;
+                *max = blockIndex->srcPortMax;
+                return 1;
+            }
+            if (element->offset == OFFdstPort && element->length == SIZEdstPort) {
+                *min = blockIndex->dstPortMin;
+                *max = blockIndex->dstPortMax;
+                return 1;
+            }
+            if (element->offset == OFFproto && element->length == SIZEproto) {
+                *min = blockIndex->protoMin;
+                *max = blockIndex->protoMax;
+                return 1;
+            }
+            break;
+        case EXipv4FlowID:
+            if (element->offset == OFFsrc4Addr && element->length == SIZEsrc4Addr) {
+                *min = blockIndex->src4AddrMin;
+                *max = blockIndex->src4AddrMax;
+                return 1;
+            }
+            if (element->offset == OFFdst4Addr && element->length == SIZEdst4Addr) {
+                *min = blockIndex->dst4AddrMin;
+                *max = blockIndex->dst4AddrMax;
+                return 1;
+            }
+            break;
+    }
+    return 0;
+
+}  // End of ElementZoneMap
+
+/*
+ * returns 0, if the filter element evaluates false for all records of a block
+ * returns 1, if the filter element may evaluate true for any record
+ */
+static int ElementMayMatch(const filterElement_t *element, const blockIndex_t *blockIndex) {
+    uint64_t min, max;
+    if (!ElementZoneMap(element, blockIndex, &min, &max)) return 1;
+
+    // no record in this block contains the element
+    if (min > max) return 0;
+
+    uint64_t value = element->value;
+    switch (element->comp) {
+        case CMP_EQ:
+            return value >= min && value <= max;
+        case CMP_GT:
+            return max > value;
+        case CMP_LT:
+            return min < value;
+        case CMP_GE:
+            return max >= value;
+        case CMP_LE:
+            return min <= value;
+        case CMP_NET: {
+            uint64_t mask = element->data.dataVal;
+            return value >= (min & mask) && value <= (max & mask);
+        }
+        case CMP_U64LIST: {
+            // find the smallest list value >= min
+            struct U64ListNode find = {.value = min};
+            struct U64ListNode *node = RB_NFIND(U64tree, element->data.dataPtr, &find);
+            return node != NULL && node->value <= max;
+        }
+        default:
+            return 1;
+    }
+
+}  // End of ElementMayMatch
+
+/*
+ * walk all possible paths of the filter tree from index. An element, which may match
+ * follows OnTrue and OnFalse, any other element follows OnFalse only.
+ * matchCache caches the result for each visited index: 0 unknown, 1 no match, 2 may match
+ */
+static int PathMayMatch(const FilterEngine_t *engine, const blockIndex_t *blockIndex, uint32_t index, uint8_t *matchCache) {
+    if (matchCache[index]) return matchCache[index] == 2;
+
+    const filterElement_t *element = &engine->filter[index];
+    int mayMatch = 0;
+    for (int evaluate = 0; evaluate <= 1 && !mayMatch; evaluate++) {
+        if (evaluate && !ElementMayMatch(element, blockIndex)) break;
+        uint32_t next = evaluate ? element->OnTrue : element->OnFalse;
+        if (next == 0) {
+            // end of filter - same as RunFilter
+            mayMatch = element->invert ? !evaluate : evaluate;
+        } else {
+            mayMatch = PathMayMatch(engine, blockIndex, next, matchCache);
+        }
+    }
+    matchCache[index] = mayMatch ? 2 : 1;
+
+    return mayMatch;
+
+}  // End of PathMayMatch
+
+/*
+ * Check the filter against the zone maps of a data block
+ * returns 0, if no record of this block can match the filter, 1 otherwise
+ * The match cache is kept in the engine - the blocks of a file are checked by one thread only
+ */
+int FilterBlock(void *engine, const blockIndex_t *blockIndex) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    if (filterEngine->StartNode == 0) return 1;
+
+    if (filterEngine->matchCache == NULL) {
+        filterEngine->matchCache = malloc(filterEngine->numElements * sizeof(uint8_t));
+        if (!filterEngine->matchCache) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 1;
+        }
+    }
+    memset(filterEngine->matchCache, 0, filterEngine->numElements * sizeof(uint8_t));
+
+    return PathMayMatch(filterEngine, blockIndex, filterEngine->StartNode, filterEngine->matchCache);
+
+}  // End of FilterBlock
+
+// returns true, if the engine evaluates a batch of records node by node in FilterRecordBatch()
+// other engines filter each record of a batch by itself
+int FilterBatchable(void *engine) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    return filterEngine != NULL && !filterEngine->Extended && filterEngine->nodeOrder != NULL;
+}  // End of FilterBatchable
+
+// returns true, if the engine may filter records in multiple threads at the same time
+// regex elements keep their match state in the compiled program
+int FilterThreadSafe(void *engine) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    if (filterEngine == NULL) return 1;
+    for (uint32_t i = 1; i < filterEngine->numElements; i++) {
+        if (filterEngine->filter[i].comp == CMP_REGEX) return 0;
+    }
+    return 1;
+}  // End of FilterThreadSafe
+
 char *ReadFilter(char *filename) {
     struct stat stat_buff;
     if (stat(filename, &stat_buff)) {
@@ -759,6 +1144,238 @@ char *ReadFilter(char *filename) {
 
 }  // End of ReadFilter
 
+/*
+ * evaluation functions of compiled nodes for plain values of 1, 2, 4 and 8 bytes
+ */
+#define NodeEvalFunction(name, type, test)                                                 \
+    static int name(const filterNode_t *node, recordHandle_t *handle, const char *ident) { \
+        void *inPtr = handle->extensionList[node->extID];                                  \
+        if (inPtr == NULL) return 0;                                                       \
+        uint64_t inVal = *((type *)(inPtr + node->offset));                                \
+        return test;                                                                       \
+    }
+
+#define NodeEvalFunctions(bits)                                                             \
+    NodeEvalFunction(EvalEQ##bits, uint##bits##_t, inVal == node->value)                    \
+    NodeEvalFunction(EvalGT##bits, uint##bits##_t, inVal > node->value)                     \
+    NodeEvalFunction(EvalLT##bits, uint##bits##_t, inVal < node->value)                     \
+    NodeEvalFunction(EvalGE##bits, uint##bits##_t, inVal >= node->value)                    \
+    NodeEvalFunction(EvalLE##bits, uint##bits##_t, inVal <= node->value)                    \
+    NodeEvalFunction(EvalFLAGS##bits, uint##bits##_t, (inVal & node->value) == node->value) \
+    NodeEvalFunction(EvalNET##bits, uint##bits##_t, (inVal & node->mask) == node->value)    \
+    NodeEvalFunction(EvalU64LIST##bits, uint##bits##_t, U64Lookup(node->lookup, inVal))
+
+NodeEvalFunctions(8)
+NodeEvalFunctions(16)
+NodeEvalFunctions(32)
+NodeEvalFunctions(64)
+
+// specialised functions by comparator and value length 1, 2, 4, 8 bytes
+static const struct nodeEvalMap_s {
+    comparator_t comp;
+    nodeEval_t eval[4];
+} nodeEvalMap[] = {{CMP_EQ, {EvalEQ8, EvalEQ16, EvalEQ32, EvalEQ64}},
+                   {CMP_GT, {EvalGT8, EvalGT16, EvalGT32, EvalGT64}},
+                   {CMP_LT, {EvalLT8, EvalLT16, EvalLT32, EvalLT64}},
+                   {CMP_GE, {EvalGE8, EvalGE16, EvalGE32, EvalGE64}},
+                   {CMP_LE, {EvalLE8, EvalLE16, EvalLE32, EvalLE64}},
+                   {CMP_FLAGS, {EvalFLAGS8, EvalFLAGS16, EvalFLAGS32, EvalFLAGS64}},
+                   {CMP_NET, {EvalNET8, EvalNET16, EvalNET32, EvalNET64}},
+                   {CMP_U64LIST, {EvalU64LIST8, EvalU64LIST16, EvalU64LIST32, EvalU64LIST64}}};
+
+// IP lists with a lookup table
+NodeEvalFunction(EvalIPLIST4, uint32_t, IPLookup4(node->lookup, inVal))
+
+static int EvalIPLIST6(const filterNode_t *node, recordHandle_t *handle, const char *ident) {
+    void *inPtr = handle->extensionList[node->extID];
+    if (inPtr == NULL) return 0;
+    inPtr += node->offset;
+    uint64_t ip[2] = {*((uint64_t *)inPtr), *((uint64_t *)(inPtr + 8))};
+    return IPLookup6(node->lookup, ip);
+}  // End of EvalIPLIST6
+
+// elements of length 0 test the presence of an extension, such as 'any'
+static int EvalEQ0(const filterNode_t *node, recordHandle_t *handle, const char *ident) {
+    return handle->extensionList[node->extID] != NULL && node->value == 0;
+}  // End of EvalEQ0
+
+// any element, which has no specialised function, is evaluated by the interpreter
+static int EvalGeneric(const filterNode_t *node, recordHandle_t *handle, const char *ident) {
+    return EvalElement(node->element, handle, ident);
+}  // End of EvalGeneric
+
+// returns the specialised evaluation function for element or EvalGeneric
+static nodeEval_t SelectNodeEval(const filterElement_t *element) {
+    if (element->function != NULL) return EvalGeneric;
+
+    // small lists without lookup table search the RB tree of the element
+    if (element->comp == CMP_IPLIST || element->comp == CMP_U64LIST) {
+        if (element->lookup == NULL) return EvalGeneric;
+        if (element->comp == CMP_IPLIST) {
+            if (element->length == 4) return EvalIPLIST4;
+            if (element->length == 16) return EvalIPLIST6;
+            return EvalGeneric;
+        }
+    }
+
+    int lengthIndex;
+    switch (element->length) {
+        case 0:
+            return element->comp == CMP_EQ ? EvalEQ0 : EvalGeneric;
+        case 1:
+            lengthIndex = 0;
+            break;
+        case 2:
+            lengthIndex = 1;
+            break;
+        case 4:
+            lengthIndex = 2;
+            break;
+        case 8:
+            lengthIndex = 3;
+            break;
+        default:
+            return EvalGeneric;
+    }
+
+    for (int i = 0; i < (sizeof(nodeEvalMap) / sizeof(struct nodeEvalMap_s)); i++) {
+        if (nodeEvalMap[i].comp == element->comp) return nodeEvalMap[i].eval[lengthIndex];
+    }
+    return EvalGeneric;
+
+}  // End of SelectNodeEval
+
+static int RunCompiledFilter(const FilterEngine_t *engine, recordHandle_t *handle, const char *ident) {
+    const filterNode_t *node = &engine->nodes[engine->StartNode];
+    int evaluate = 0;
+    int invert = 0;
+    while (node) {
+        invert = node->invert;
+        evaluate = node->eval(node, handle, ident);
+        node = evaluate ? node->OnTrue : node->OnFalse;
+    }
+    return invert ? !evaluate : evaluate;
+}  // End of RunCompiledFilter
+
+/*
+ * compile the filter elements of the engine into filter nodes
+ */
+static void CompileNodes(FilterEngine_t *engine) {
+    engine->nodes = NULL;
+    if (engine->StartNode == 0) return;
+
+    filterNode_t *nodes = calloc(engine->numElements, sizeof(filterNode_t));
+    if (!nodes) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    for (uint32_t i = 1; i < engine->numElements; i++) {
+        const filterElement_t *element = &engine->filter[i];
+        nodes[i] = (filterNode_t){
+            .eval = SelectNodeEval(element),
+            .extID = element->extID,
+            .offset = element->offset,
+            .value = element->value,
+            .mask = element->comp == CMP_NET ? element->data.dataVal : 0,
+            .lookup = element->lookup,
+            .OnTrue = element->OnTrue ? &nodes[element->OnTrue] : NULL,
+            .OnFalse = element->OnFalse ? &nodes[element->OnFalse] : NULL,
+            .element = element,
+            .invert = element->invert,
+        };
+    }
+    engine->nodes = nodes;
+    engine->filterFunction = RunCompiledFilter;
+
+}  // End of CompileNodes
+
+// returns the element before index, which shares the list of element index or 0
+static uint32_t SharedList(const FilterEngine_t *engine, uint32_t index) {
+    const filterElement_t *element = &engine->filter[index];
+    for (uint32_t i = 1; i < index; i++) {
+        if (engine->filter[i].comp == element->comp && engine->filter[i].data.dataPtr == element->data.dataPtr) return i;
+    }
+    return 0;
+}  // End of SharedList
+
+/*
+ * compile large IP and value lists into lookup tables. Lists shared by several elements,
+ * such as the list of 'ip in [ .. ]' for the IPv4 and IPv6 element, are compiled once
+ */
+static void CompileLookups(FilterEngine_t *engine) {
+    for (uint32_t i = 1; i < engine->numElements; i++) {
+        filterElement_t *element = &engine->filter[i];
+        if (element->comp != CMP_IPLIST && element->comp != CMP_U64LIST) continue;
+        if (element->data.dataPtr == NULL) continue;
+
+        uint32_t shared = SharedList(engine, i);
+        if (shared) {
+            element->lookup = engine->filter[shared].lookup;
+        } else if (element->comp == CMP_IPLIST) {
+            element->lookup = NewIPLookup(element->data.dataPtr);
+        } else {
+            element->lookup = NewU64Lookup(element->data.dataPtr);
+        }
+    }
+
+}  // End of CompileLookups
+
+static void FreeLookups(FilterEngine_t *engine) {
+    for (uint32_t i = 1; i < engine->numElements; i++) {
+        filterElement_t *element = &engine->filter[i];
+        if (element->lookup == NULL || SharedList(engine, i)) continue;
+        if (element->comp == CMP_IPLIST)
+            FreeIPLookup(element->lookup);
+        else
+            FreeU64Lookup(element->lookup);
+    }
+}  // End of FreeLookups
+
+/*
+ * depth first walk of the filter nodes from index. Appends index to nodeOrder after
+ * all its successors, which results in the reverse topological order
+ */
+static void OrderFilterNodes(const filterElement_t *filter, uint32_t index, uint8_t *visited, uint32_t *nodeOrder, uint32_t *numNodes) {
+    if (index == 0 || visited[index]) return;
+    visited[index] = 1;
+
+    OrderFilterNodes(filter, filter[index].OnTrue, visited, nodeOrder, numNodes);
+    OrderFilterNodes(filter, filter[index].OnFalse, visited, nodeOrder, numNodes);
+    nodeOrder[(*numNodes)++] = index;
+
+}  // End of OrderFilterNodes
+
+/*
+ * set the topological order of all nodes reachable from the start node for batch evaluation
+ */
+static void SetNodeOrder(FilterEngine_t *engine) {
+    engine->numNodes = 0;
+    engine->nodeOrder = NULL;
+    if (engine->StartNode == 0) return;
+
+    uint8_t *visited = calloc(engine->numElements, sizeof(uint8_t));
+    uint32_t *nodeOrder = malloc(engine->numElements * sizeof(uint32_t));
+    if (!visited || !nodeOrder) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    uint32_t numNodes = 0;
+    OrderFilterNodes(engine->filter, engine->StartNode, visited, nodeOrder, &numNodes);
+    free(visited);
+
+    // reverse post order
+    for (uint32_t i = 0; i < numNodes / 2; i++) {
+        uint32_t tmp = nodeOrder[i];
+        nodeOrder[i] = nodeOrder[numNodes - 1 - i];
+        nodeOrder[numNodes - 1 - i] = tmp;
+    }
+    engine->nodeOrder = nodeOrder;
+    engine->numNodes = numNodes;
+
+}  // End of SetNodeOrder
+
 void *CompileFilter(char *FilterSyntax) {
     if (!FilterSyntax) return NULL;
 
@@ -776,12 +1393,20 @@ void *CompileFilter(char *FilterSyntax) {
     }
     *engine = (FilterEngine_t){
         .label = NULL,
+        .numElements = NumBlocks,
         .StartNode = StartNode,
         .Extended = Extended,
         .filter = FilterTree,
+        .ops = FilterOps,
+        .numOps = NumOps,
         .filterFunction = Extended ? RunExtendedFilter : RunFilterFast,
     };
     FilterTree = NULL;
+    FilterOps = NULL;
+    NumOps = MaxOps = 0;
+    CompileLookups(engine);
+    SetNodeOrder(engine);
+    CompileNodes(engine);
 
     dbg_printf("Engine: %s\n", engine->Extended ? "extended" : "fast");
 
@@ -789,8 +1414,293 @@ void *CompileFilter(char *FilterSyntax) {
 
 }  // End of CompileFilter
 
-void DisposeFilter(void *engine) { free(engine); }
+/*
+ * reconnect the filter elements by replaying the operations of the parser. The blocks of
+ * each AND/OR are ordered by the expected cost with the sampled probability of the elements
+ */
+static void ReorderFilter(FilterEngine_t *engine) {
+    filterElement_t *filter = engine->filter;
+    uint32_t *blockMap = malloc(engine->numElements * sizeof(uint32_t));
+    if (!blockMap) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    for (uint32_t i = 1; i < engine->numElements; i++) {
+        filterElement_t *element = &filter[i];
+        if (element->numblocks != 1) {
+            free(element->blocklist);
+            element->blocklist = (uint32_t *)malloc(sizeof(uint32_t));
+            if (!element->blocklist) {
+                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+        }
+        element->blocklist[0] = i;
+        element->numblocks = 1;
+        element->superblock = i;
+        element->OnTrue = 0;
+        element->OnFalse = 0;
+        element->invert = 0;
+        element->cost = element->evalCost;
+        if (element->evalCost >= FILTERSAMPLECOST) {
+            // not sampled - no information about this element
+            element->pTrue = 0.5;
+        } else {
+            // avoid a probability of 0 or 1 with only a few sampled records
+            element->pTrue = (engine->numTrue[i] + 1.0) / (engine->numSampled + 2.0);
+        }
+        blockMap[i] = i;
+    }
+
+    // blockMap maps the blocks of the parser to the reconnected blocks
+    FilterTree = filter;
+    for (uint32_t i = 0; i < engine->numOps; i++) {
+        filterOp_t *filterOp = &engine->ops[i];
+        if (filterOp->op == FILTER_NOT) {
+            InvertBlock(blockMap[filterOp->block1]);
+        } else {
+            blockMap[filterOp->result] = ConnectBlocks(blockMap[filterOp->block1], blockMap[filterOp->block2], filterOp->op);
+        }
+    }
+    FilterTree = NULL;
+
+    engine->StartNode = blockMap[engine->StartNode];
+    free(blockMap);
+
+    free(engine->nodeOrder);
+    free(engine->nodes);
+    SetNodeOrder(engine);
+    CompileNodes(engine);
+
+}  // End of ReorderFilter
+
+// returns true, if the filter has an AND or OR of multiple blocks, which may be reordered
+// by FilterSample(). Filters without any AND/OR are not worth sampling
+int FilterReorderable(void *engine) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    if (filterEngine == NULL) return 0;
+    for (uint32_t i = 0; i < filterEngine->numOps; i++) {
+        if (filterEngine->ops[i].op != FILTER_NOT) return 1;
+    }
+    return 0;
+}  // End of FilterReorderable
+
+/*
+ * sample the records for the probability of each filter element to be true. After FILTERSAMPLE
+ * records, the filter is reordered. Expensive elements such as geo, regex, AS or ja3 lookups
+ * are not sampled, but assumed to match half of the records. Returns 1, if sampling is complete,
+ * 0 if more records are needed. The engine must not be used by other threads, while records are
+ * sampled.
+ */
+int FilterSample(void *engine, recordHandle_t *handles, uint32_t numRecords, const char *ident) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    if (filterEngine == NULL || filterEngine->numOps == 0 || filterEngine->numSampled >= FILTERSAMPLE) return 1;
+
+    if (filterEngine->numTrue == NULL) {
+        filterEngine->numTrue = calloc(filterEngine->numElements, sizeof(uint32_t));
+        if (!filterEngine->numTrue) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+
+    for (uint32_t i = 0; i < numRecords && filterEngine->numSampled < FILTERSAMPLE; i++) {
+        for (uint32_t j = 1; j < filterEngine->numElements; j++) {
+            // do not spend expensive lookups on the sample
+            if (filterEngine->filter[j].evalCost >= FILTERSAMPLECOST) continue;
+            if (EvalElement(&filterEngine->filter[j], &handles[i], ident)) filterEngine->numTrue[j]++;
+        }
+        filterEngine->numSampled++;
+    }
+    if (filterEngine->numSampled < FILTERSAMPLE) return 0;
+
+    ReorderFilter(filterEngine);
+    return 1;
+
+}  // End of FilterSample
+
+void DisposeFilter(void *engine) {
+    FilterEngine_t *filterEngine = (FilterEngine_t *)engine;
+    if (filterEngine) {
+        FreeLookups(filterEngine);
+        free(filterEngine->ops);
+        free(filterEngine->numTrue);
+        free(filterEngine->matchCache);
+        free(filterEngine->nodeOrder);
+        free(filterEngine->nodes);
+    }
+    free(engine);
+}  // End of DisposeFilter
+
+/*
+ * filter set
+ * A filter set evaluates the filters of several engines, such as the channels of nfprofile,
+ * for the same record. Equal filter elements of all engines are mapped to the same predicate.
+ * Each predicate is evaluated at most once per record and its result is shared by all engines
+ * of the set, which test the predicate on their path through the filter.
+ */
+typedef struct filterSet_s {
+    FilterEngine_t **engines;
+    uint32_t numEngines;
+    uint32_t **predicate;    // predicate index of each filter element of each engine
+    uint32_t numPredicates;  // number of distinct filter elements of all engines
+    uint32_t generation;     // generation of the current record
+    uint32_t *memo;          // (generation << 1) | result of the last evaluation of each predicate
+    int Extended;
+} filterSet_t;
+
+// returns true, if both IP lists contain the same nodes
+static int SameIPList(IPlist_t *list1, IPlist_t *list2) {
+    struct IPListNode *node1 = RB_MIN(IPtree, list1);
+    struct IPListNode *node2 = RB_MIN(IPtree, list2);
+    while (node1 && node2) {
+        if (node1->ip[0] != node2->ip[0] || node1->ip[1] != node2->ip[1] || node1->mask[0] != node2->mask[0] ||
+            node1->mask[1] != node2->mask[1])
+            return 0;
+        node1 = RB_NEXT(IPtree, list1, node1);
+        node2 = RB_NEXT(IPtree, list2, node2);
+    }
+    return node1 == node2;
+}  // End of SameIPList
+
+// returns true, if both value lists contain the same values
+static int SameU64List(U64List_t *list1, U64List_t *list2) {
+    struct U64ListNode *node1 = RB_MIN(U64tree, list1);
+    struct U64ListNode *node2 = RB_MIN(U64tree, list2);
+    while (node1 && node2) {
+        if (node1->value != node2->value) return 0;
+        node1 = RB_NEXT(U64tree, list1, node1);
+        node2 = RB_NEXT(U64tree, list2, node2);
+    }
+    return node1 == node2;
+}  // End of SameU64List
+
+// returns true, if both filter elements test the same predicate of a record
+static int SameElement(const filterElement_t *e1, const filterElement_t *e2) {
+    if (e1->extID != e2->extID || e1->offset != e2->offset || e1->length != e2->length || e1->value != e2->value || e1->comp != e2->comp ||
+        e1->function != e2->function || e1->geoLookup != e2->geoLookup)
+        return 0;
+
+    if (e1->data.dataPtr == e2->data.dataPtr) return 1;
+    switch (e1->comp) {
+        case CMP_IDENT:
+        case CMP_STRING:
+        case CMP_PAYLOAD:
+            return e1->data.dataPtr != NULL && e2->data.dataPtr != NULL && strcmp(e1->data.dataPtr, e2->data.dataPtr) == 0;
+        case CMP_BINARY:
+            return e1->data.dataPtr != NULL && e2->data.dataPtr != NULL && memcmp(e1->data.dataPtr, e2->data.dataPtr, e1->length) == 0;
+        case CMP_IPLIST:
+            return e1->data.dataPtr != NULL && e2->data.dataPtr != NULL && SameIPList(e1->data.dataPtr, e2->data.dataPtr);
+        case CMP_U64LIST:
+            return e1->data.dataPtr != NULL && e2->data.dataPtr != NULL && SameU64List(e1->data.dataPtr, e2->data.dataPtr);
+        default:
+            // compiled regex programs are never shared, all other elements compare dataVal
+            return 0;
+    }
+}  // End of SameElement
+
+void *CompileFilterSet(void **engines, uint32_t numEngines) {
+    uint32_t numElements = 0;
+    for (uint32_t i = 0; i < numEngines; i++) numElements += ((FilterEngine_t *)engines[i])->numElements;
+
+    filterSet_t *filterSet = calloc(1, sizeof(filterSet_t));
+    // first element of each predicate
+    const filterElement_t **predicates = malloc((numElements + 1) * sizeof(filterElement_t *));
+    FilterEngine_t **setEngines = malloc((numEngines + 1) * sizeof(FilterEngine_t *));
+    uint32_t **setPredicate = calloc(numEngines + 1, sizeof(uint32_t *));
+    if (!filterSet || !predicates || !setEngines || !setPredicate) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    filterSet->engines = setEngines;
+    filterSet->predicate = setPredicate;
+
+    filterSet->numEngines = numEngines;
+    for (uint32_t i = 0; i < numEngines; i++) {
+        FilterEngine_t *engine = (FilterEngine_t *)engines[i];
+        filterSet->engines[i] = engine;
+        if (engine->Extended) filterSet->Extended = 1;
+
+        uint32_t *predicate = calloc(engine->numElements, sizeof(uint32_t));
+        if (!predicate) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        for (uint32_t j = 1; j < engine->numElements; j++) {
+            const filterElement_t *element = &engine->filter[j];
+            uint32_t p = 0;
+            while (p < filterSet->numPredicates && !SameElement(predicates[p], element)) p++;
+            if (p == filterSet->numPredicates) predicates[filterSet->numPredicates++] = element;
+            predicate[j] = p;
+        }
+        filterSet->predicate[i] = predicate;
+    }
+    free(predicates);
+
+    filterSet->memo = calloc(filterSet->numPredicates + 1, sizeof(uint32_t));
+    if (!filterSet->memo) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    filterSet->generation = 0;
+
+    dbg_printf("Filter set: %u engines, %u elements, %u predicates\n", numEngines, numElements, filterSet->numPredicates);
+    return (void *)filterSet;
+
+}  // End of CompileFilterSet
+
+/*
+ * filter the record with all engines of the filter set. Sets the bit of each engine in match,
+ * which matches the record. match must hold at least (numEngines + 63) / 64 words.
+ * The filter set must not be used by other threads at the same time.
+ */
+void FilterRecordSet(void *filterSet, recordHandle_t *handle, const char *ident, uint64_t *match) {
+    filterSet_t *set = (filterSet_t *)filterSet;
+    // a new generation invalidates all results of the previous record
+    set->generation++;
+    if (set->generation == (UINT32_MAX >> 1)) {
+        memset((void *)set->memo, 0, set->numPredicates * sizeof(uint32_t));
+        set->generation = 1;
+    }
+    uint32_t generation = set->generation;
+    uint32_t *memo = set->memo;
+
+    memset((void *)match, 0, ((set->numEngines + 63) >> 6) * sizeof(uint64_t));
+    for (uint32_t i = 0; i < set->numEngines; i++) {
+        const FilterEngine_t *engine = set->engines[i];
+        const uint32_t *predicate = set->predicate[i];
+        uint32_t index = engine->StartNode;
+        int evaluate = 0;
+        int invert = 0;
+        while (index) {
+            const filterElement_t *element = &engine->filter[index];
+            uint32_t p = predicate[index];
+            if ((memo[p] >> 1) == generation) {
+                evaluate = memo[p] & 1;
+            } else {
+                const filterNode_t *node = &engine->nodes[index];
+                evaluate = node->eval(node, handle, ident);
+                memo[p] = (generation << 1) | evaluate;
+            }
+            invert = element->invert;
+            index = evaluate ? element->OnTrue : element->OnFalse;
+        }
+        if (invert ? !evaluate : evaluate) match[i >> 6] |= 1ULL << (i & 63);
+    }
 
+}  // End of FilterRecordSet
+
+// dispose the filter set. The engines of the set are not disposed
+void DisposeFilterSet(void *filterSet) {
+    filterSet_t *set = (filterSet_t *)filterSet;
+    if (set == NULL) return;
+    for (uint32_t i = 0; i < set->numEngines; i++) free(set->predicate[i]);
+    free(set->predicate);
+    free(set->engines);
+    free(set->memo);
+    free(set);
+}  // End of DisposeFilterSet
 /*
  * Dump Filterlist
  */
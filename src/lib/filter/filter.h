@@ -35,6 +35,7 @@
 #include <stdio.h>
 
 #include "nfdump.h"
+#include "nffileV2.h"
 #include "nfxV3.h"
 #include "rbtree.h"
 
@@ -157,6 +158,33 @@ void DisposeFilter(void *engine);
 
 int FilterRecord(void *engine, recordHandle_t *handle, const char *ident);
 
+// max number of records filtered in one batch - multiple of 64
+#define FILTERBATCH 64
+
+void FilterRecordBatch(void *engine, recordHandle_t *handles, uint32_t numRecords, const char *ident, uint64_t *selection);
+
+// number of records sampled to estimate the selectivity of the filter elements
+#define FILTERSAMPLE 1024
+
+// filter elements with an evaluation cost of FILTERSAMPLECOST or more are not sampled
+#define FILTERSAMPLECOST 40
+
+int FilterReorderable(void *engine);
+
+int FilterSample(void *engine, recordHandle_t *handles, uint32_t numRecords, const char *ident);
+
+int FilterBlock(void *engine, const blockIndex_t *blockIndex);
+
+int FilterBatchable(void *engine);
+
+int FilterThreadSafe(void *engine);
+
+void *CompileFilterSet(void **engines, uint32_t numEngines);
+
+void FilterRecordSet(void *filterSet, recordHandle_t *handle, const char *ident, uint64_t *match);
+
+void DisposeFilterSet(void *filterSet);
+
 void DumpEngine(void *arg);
 
 void lex_init(char *buf);
@@ -1668,7 +1668,7 @@ static struct IPListNode *mkNode(ipStack_t ipStack, int64_t prefix) {
 				yyerror("Prefix %llu out of range for IPv4 address", prefix);
 				return NULL;
 			}
-			node->mask[0] = 0;
+			// IPv4 addresses are stored as ::a.b.c.d - keep mask[0], so IPv4 and IPv6 prefixes do not overlap
 			node->mask[1] = 0xffffffffffffffffLL << (32 - prefix);
 		} else {
 			// IPv6
@@ -1684,10 +1684,34 @@ static struct IPListNode *mkNode(ipStack_t ipStack, int64_t prefix) {
 				node->mask[1] = 0;
 			}
 		}
+		// a prefix such as 10.1.2.3/8 matches the network 10.0.0.0/8
+		node->ip[0] &= node->mask[0];
+		node->ip[1] &= node->mask[1];
 	}
 	return node;
 }
 
+/*
+ * insert node into the IP list. Overlapping entries compare equal in the RB tree, therefore
+ * only the wider prefix is kept, which covers the other one.
+ */
+static void InsertIPNode(IPlist_t *root, struct IPListNode *node) {
+	int nodeBits = __builtin_popcountll(node->mask[0]) + __builtin_popcountll(node->mask[1]);
+
+	struct IPListNode *exists;
+	while ((exists = RB_INSERT(IPtree, root, node)) != NULL) {
+		int existsBits = __builtin_popcountll(exists->mask[0]) + __builtin_popcountll(exists->mask[1]);
+		if (existsBits <= nodeBits) {
+			// node is covered by exists
+			free(node);
+			return;
+		}
+		// node covers exists
+		RB_REMOVE(IPtree, root, exists);
+		free(exists);
+	}
+} // End of InsertIPNode
+
 static void *NewIplist(char *IPstr, int prefix) {
 	IPlist_t *root = malloc(sizeof(IPlist_t));
 	if (root == NULL) {
@@ -1706,7 +1730,7 @@ static void *NewIplist(char *IPstr, int prefix) {
 	for (int i=0; i<numIP; i++ ) {
 	  struct IPListNode *node = mkNode(ipStack[i], prefix);
 		if ( node ) {
-			RB_INSERT(IPtree, root, node);
+			InsertIPNode(root, node);
 		} else {
 			free(root);
 			return NULL;
@@ -1727,7 +1751,7 @@ static int InsertIPlist(void *IPlist, char *IPstr, int64_t prefix) {
 	for (int i=0; i<numIP; i++ ) {
 		struct IPListNode *node = mkNode(ipStack[i], prefix);
 		if ( node ) {
-			RB_INSERT(IPtree, (IPlist_t *)IPlist, node);
+			InsertIPNode((IPlist_t *)IPlist, node);
 		} else {
 			return 0;
 		}
@@ -0,0 +1,442 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "listlookup.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define EMPTYKEY 0xFFFFFFFFFFFFFFFFULL
+#define HASHMUL1 0x9E3779B97F4A7C15ULL
+#define HASHMUL2 0xC2B2AE3D27D4EB4FULL
+
+/*
+ * hash set of 64bit values, IPv4 or IPv6 addresses with open addressing and linear probing.
+ * Empty slots hold all bits set, therefore this key itself is tracked by hasEmpty.
+ */
+typedef struct hashSet_s {
+    void *table;     // slots of uint64_t values, uint32_t IPv4 or 2 uint64_t IPv6 addresses
+    uint32_t mask;   // number of slots - 1
+    uint32_t shift;  // 64 - log2(number of slots)
+    int hasEmpty;    // the key with all bits set is a member of the set
+} hashSet_t;
+
+/*
+ * multibit trie of prefixes with a stride of 6 bits. Each node covers the 64 values of a
+ * 6 bit chunk of the address. leafBits marks the chunk values, covered by a prefix and
+ * childBits the chunk values with a child node. The children of a node are stored
+ * consecutively from childBase on. The index of a child is the number of childBits set
+ * below its chunk value.
+ */
+#define STRIDE 6
+
+typedef struct trieNode_s {
+    uint64_t leafBits;
+    uint64_t childBits;
+    uint32_t childBase;
+} trieNode_t;
+
+typedef struct prefixTrie_s {
+    trieNode_t *nodes;  // node 0 is the root node
+    uint32_t numNodes;
+    uint32_t maxNodes;
+} prefixTrie_t;
+
+typedef struct prefix_s {
+    uint64_t key[2];  // left aligned and masked prefix
+    uint32_t length;
+} prefix_t;
+
+struct ipLookup_s {
+    hashSet_t *host4;       // IPv4 addresses
+    hashSet_t *host6;       // IPv6 addresses
+    prefixTrie_t *prefix4;  // IPv4 prefixes
+    prefixTrie_t *prefix6;  // IPv6 prefixes
+};
+
+struct u64Lookup_s {
+    uint64_t *bitmap;  // 65536 bits, if all values are < 65536
+    hashSet_t *set;    // any other value list
+};
+
+// types of IP list entries
+#define HOST4 1
+#define HOST6 2
+#define PREFIX4 4
+#define PREFIX6 8
+
+static void *ListCalloc(size_t num, size_t size) {
+    void *p = calloc(num, size);
+    if (!p) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    return p;
+}  // End of ListCalloc
+
+static hashSet_t *NewHashSet(uint32_t numEntries, size_t slotSize) {
+    // at least 2 slots per entry
+    uint32_t bits = 4;
+    while ((1U << bits) < 2 * numEntries) bits++;
+
+    hashSet_t *set = ListCalloc(1, sizeof(hashSet_t));
+    set->table = ListCalloc((size_t)1 << bits, slotSize);
+    memset(set->table, 0xFF, ((size_t)1 << bits) * slotSize);
+    set->mask = (1U << bits) - 1;
+    set->shift = 64 - bits;
+    return set;
+}  // End of NewHashSet
+
+static void FreeHashSet(hashSet_t *set) {
+    if (set) free(set->table);
+    free(set);
+}  // End of FreeHashSet
+
+static inline uint32_t HashValue(const hashSet_t *set, uint64_t value) { return (value * HASHMUL1) >> set->shift; }
+
+static inline uint32_t HashIP6(const hashSet_t *set, const uint64_t ip[2]) { return ((ip[0] ^ (ip[1] * HASHMUL2)) * HASHMUL1) >> set->shift; }
+
+static void ValueSetInsert(hashSet_t *set, uint64_t value) {
+    if (value == EMPTYKEY) {
+        set->hasEmpty = 1;
+        return;
+    }
+    uint64_t *table = (uint64_t *)set->table;
+    uint32_t slot = HashValue(set, value);
+    while (table[slot] != EMPTYKEY) {
+        if (table[slot] == value) return;
+        slot = (slot + 1) & set->mask;
+    }
+    table[slot] = value;
+}  // End of ValueSetInsert
+
+static inline int ValueSetLookup(const hashSet_t *set, uint64_t value) {
+    if (value == EMPTYKEY) return set->hasEmpty;
+    const uint64_t *table = (const uint64_t *)set->table;
+    uint32_t slot = HashValue(set, value);
+    uint64_t key;
+    while ((key = table[slot]) != EMPTYKEY) {
+        if (key == value) return 1;
+        slot = (slot + 1) & set->mask;
+    }
+    return 0;
+}  // End of ValueSetLookup
+
+static void IP4SetInsert(hashSet_t *set, uint32_t ip) {
+    if (ip == 0xFFFFFFFF) {
+        set->hasEmpty = 1;
+        return;
+    }
+    uint32_t *table = (uint32_t *)set->table;
+    uint32_t slot = HashValue(set, ip);
+    while (table[slot] != 0xFFFFFFFF) {
+        if (table[slot] == ip) return;
+        slot = (slot + 1) & set->mask;
+    }
+    table[slot] = ip;
+}  // End of IP4SetInsert
+
+static inline int IP4SetLookup(const hashSet_t *set, uint32_t ip) {
+    if (ip == 0xFFFFFFFF) return set->hasEmpty;
+    const uint32_t *table = (const uint32_t *)set->table;
+    uint32_t slot = HashValue(set, ip);
+    uint32_t key;
+    while ((key = table[slot]) != 0xFFFFFFFF) {
+        if (key == ip) return 1;
+        slot = (slot + 1) & set->mask;
+    }
+    return 0;
+}  // End of IP4SetLookup
+
+static void IP6SetInsert(hashSet_t *set, const uint64_t ip[2]) {
+    if (ip[0] == EMPTYKEY && ip[1] == EMPTYKEY) {
+        set->hasEmpty = 1;
+        return;
+    }
+    uint32_t slot = HashIP6(set, ip);
+    uint64_t *table = (uint64_t *)set->table;
+    uint64_t *key = &table[2 * slot];
+    while (key[0] != EMPTYKEY || key[1] != EMPTYKEY) {
+        if (key[0] == ip[0] && key[1] == ip[1]) return;
+        slot = (slot + 1) & set->mask;
+        key = &table[2 * slot];
+    }
+    key[0] = ip[0];
+    key[1] = ip[1];
+}  // End of IP6SetInsert
+
+static inline int IP6SetLookup(const hashSet_t *set, const uint64_t ip[2]) {
+    if (ip[0] == EMPTYKEY && ip[1] == EMPTYKEY) return set->hasEmpty;
+    uint32_t slot = HashIP6(set, ip);
+    const uint64_t *table = (const uint64_t *)set->table;
+    const uint64_t *key = &table[2 * slot];
+    while (key[0] != EMPTYKEY || key[1] != EMPTYKEY) {
+        if (key[0] == ip[0] && key[1] == ip[1]) return 1;
+        slot = (slot + 1) & set->mask;
+        key = &table[2 * slot];
+    }
+    return 0;
+}  // End of IP6SetLookup
+
+// returns the STRIDE bits of the 128bit key at bit position pos, counted from the left
+static inline uint32_t KeyChunk(const uint64_t key[2], uint32_t pos) {
+    uint32_t word = pos >> 6;
+    uint32_t bit = pos & 0x3F;
+    uint64_t bits = key[word] << bit;
+    if (word == 0 && bit > 64 - STRIDE) bits |= key[1] >> (64 - bit);
+    return bits >> (64 - STRIDE);
+}  // End of KeyChunk
+
+static int PrefixCMP(const void *p1, const void *p2) {
+    const prefix_t *e1 = (const prefix_t *)p1;
+    const prefix_t *e2 = (const prefix_t *)p2;
+    if (e1->key[0] != e2->key[0]) return e1->key[0] < e2->key[0] ? -1 : 1;
+    if (e1->key[1] != e2->key[1]) return e1->key[1] < e2->key[1] ? -1 : 1;
+    if (e1->length != e2->length) return e1->length < e2->length ? -1 : 1;
+    return 0;
+}  // End of PrefixCMP
+
+static uint32_t AllocTrieNodes(prefixTrie_t *trie, uint32_t num) {
+    if (trie->numNodes + num > trie->maxNodes) {
+        while (trie->numNodes + num > trie->maxNodes) trie->maxNodes *= 2;
+        trie->nodes = realloc(trie->nodes, trie->maxNodes * sizeof(trieNode_t));
+        if (!trie->nodes) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+    }
+    uint32_t index = trie->numNodes;
+    memset(&trie->nodes[index], 0, num * sizeof(trieNode_t));
+    trie->numNodes += num;
+    return index;
+}  // End of AllocTrieNodes
+
+/*
+ * build the trie node at nodeIndex for the sorted prefixes first .. last - 1, which all share
+ * the leading pos bits. Prefixes not longer than pos are already covered by a parent node.
+ * Prefixes, ending in this node, are expanded to the range of chunk values they cover.
+ */
+static void BuildTrieNode(prefixTrie_t *trie, uint32_t nodeIndex, const prefix_t *prefix, uint32_t first, uint32_t last, uint32_t pos) {
+    uint64_t leafBits = 0;
+    for (uint32_t i = first; i < last; i++) {
+        if (prefix[i].length == 0) {
+            // ::/96 becomes the IPv4 prefix 0.0.0.0/0, which covers all chunk values of the root
+            leafBits = EMPTYKEY;
+            continue;
+        }
+        if (prefix[i].length <= pos || prefix[i].length > pos + STRIDE) continue;
+        uint32_t span = 1U << (pos + STRIDE - prefix[i].length);
+        leafBits |= ((1ULL << span) - 1) << KeyChunk(prefix[i].key, pos);
+    }
+
+    // longer prefixes, which are not covered by a leaf, continue in a child node
+    uint64_t childBits = 0;
+    for (uint32_t i = first; i < last; i++) {
+        if (prefix[i].length <= pos + STRIDE) continue;
+        uint64_t bit = 1ULL << KeyChunk(prefix[i].key, pos);
+        if ((leafBits & bit) == 0) childBits |= bit;
+    }
+
+    uint32_t childBase = childBits ? AllocTrieNodes(trie, __builtin_popcountll(childBits)) : 0;
+    trie->nodes[nodeIndex] = (trieNode_t){.leafBits = leafBits, .childBits = childBits, .childBase = childBase};
+    if (childBits == 0) return;
+
+    // the prefixes of each chunk value are consecutive in the sorted list
+    uint32_t i = first;
+    while (i < last) {
+        uint32_t chunk = KeyChunk(prefix[i].key, pos);
+        uint32_t end = i + 1;
+        while (end < last && KeyChunk(prefix[end].key, pos) == chunk) end++;
+        uint64_t bit = 1ULL << chunk;
+        if (childBits & bit)
+            BuildTrieNode(trie, childBase + __builtin_popcountll(childBits & (bit - 1)), prefix, i, end, pos + STRIDE);
+        i = end;
+    }
+}  // End of BuildTrieNode
+
+static prefixTrie_t *NewPrefixTrie(prefix_t *prefix, uint32_t numPrefix) {
+    qsort(prefix, numPrefix, sizeof(prefix_t), PrefixCMP);
+
+    prefixTrie_t *trie = ListCalloc(1, sizeof(prefixTrie_t));
+    trie->maxNodes = 64;
+    trie->nodes = ListCalloc(trie->maxNodes, sizeof(trieNode_t));
+    AllocTrieNodes(trie, 1);
+    BuildTrieNode(trie, 0, prefix, 0, numPrefix, 0);
+    return trie;
+}  // End of NewPrefixTrie
+
+static void FreePrefixTrie(prefixTrie_t *trie) {
+    if (trie) free(trie->nodes);
+    free(trie);
+}  // End of FreePrefixTrie
+
+// returns 1, if any prefix of the trie covers key
+static inline int TrieLookup(const prefixTrie_t *trie, const uint64_t key[2]) {
+    const trieNode_t *node = trie->nodes;
+    uint32_t pos = 0;
+    for (;;) {
+        uint64_t bit = 1ULL << KeyChunk(key, pos);
+        if (node->leafBits & bit) return 1;
+        if ((node->childBits & bit) == 0) return 0;
+        node = &trie->nodes[node->childBase + __builtin_popcountll(node->childBits & (bit - 1))];
+        pos += STRIDE;
+    }
+}  // End of TrieLookup
+
+/*
+ * IPv4 addresses and prefixes of the list are stored as ::a.b.c.d in ip[1]. As in the RB tree,
+ * such an entry also matches the IPv6 address ::a.b.c.d, which is looked up as IPv4 address.
+ */
+static int IPNodeType(const struct IPListNode *node) {
+    if (node->mask[0] == EMPTYKEY && node->mask[1] == EMPTYKEY) return (node->ip[0] == 0 && (node->ip[1] >> 32) == 0) ? HOST4 : HOST6;
+    if (node->mask[0] == EMPTYKEY && node->ip[0] == 0 && (node->ip[1] >> 32) == 0 && (node->mask[1] >> 32) == 0xFFFFFFFF) return PREFIX4;
+    return PREFIX6;
+}  // End of IPNodeType
+
+ipLookup_t *NewIPLookup(IPlist_t *IPlist) {
+    uint32_t numHost4 = 0, numHost6 = 0, numPrefix4 = 0, numPrefix6 = 0;
+    struct IPListNode *node;
+    RB_FOREACH(node, IPtree, IPlist) {
+        int type = IPNodeType(node);
+        if (type & HOST4) numHost4++;
+        if (type & HOST6) numHost6++;
+        if (type & PREFIX4) numPrefix4++;
+        if (type & PREFIX6) numPrefix6++;
+    }
+    if ((numHost4 + numHost6 + numPrefix4 + numPrefix6) < MINLOOKUPLIST) return NULL;
+
+    ipLookup_t *ipLookup = ListCalloc(1, sizeof(ipLookup_t));
+    if (numHost4) ipLookup->host4 = NewHashSet(numHost4, sizeof(uint32_t));
+    if (numHost6) ipLookup->host6 = NewHashSet(numHost6, 2 * sizeof(uint64_t));
+    prefix_t *prefix4 = numPrefix4 ? ListCalloc(numPrefix4, sizeof(prefix_t)) : NULL;
+    prefix_t *prefix6 = numPrefix6 ? ListCalloc(numPrefix6, sizeof(prefix_t)) : NULL;
+
+    numPrefix4 = numPrefix6 = 0;
+    RB_FOREACH(node, IPtree, IPlist) {
+        int type = IPNodeType(node);
+        if (type & HOST4) IP4SetInsert(ipLookup->host4, node->ip[1]);
+        if (type & HOST6) IP6SetInsert(ipLookup->host6, node->ip);
+        if (type & PREFIX4) {
+            uint64_t mask = node->mask[1] & 0xFFFFFFFF;
+            prefix4[numPrefix4++] = (prefix_t){
+                .key[0] = (node->ip[1] & mask) << 32,
+                .key[1] = 0,
+                .length = __builtin_popcountll(mask),
+            };
+        }
+        if (type & PREFIX6) {
+            prefix6[numPrefix6++] = (prefix_t){
+                .key[0] = node->ip[0] & node->mask[0],
+                .key[1] = node->ip[1] & node->mask[1],
+                .length = __builtin_popcountll(node->mask[0]) + __builtin_popcountll(node->mask[1]),
+            };
+        }
+    }
+
+    if (numPrefix4) ipLookup->prefix4 = NewPrefixTrie(prefix4, numPrefix4);
+    if (numPrefix6) ipLookup->prefix6 = NewPrefixTrie(prefix6, numPrefix6);
+    free(prefix4);
+    free(prefix6);
+
+    return ipLookup;
+}  // End of NewIPLookup
+
+int IPLookup4(const ipLookup_t *ipLookup, uint32_t ip) {
+    if (ipLookup->host4 && IP4SetLookup(ipLookup->host4, ip)) return 1;
+    if (ipLookup->prefix4) {
+        uint64_t key[2] = {(uint64_t)ip << 32, 0};
+        if (TrieLookup(ipLookup->prefix4, key)) return 1;
+    }
+    // as in the RB tree, IPv6 prefixes such as ::/64 cover the IPv4 address ::a.b.c.d
+    if (ipLookup->prefix6) {
+        uint64_t key[2] = {0, ip};
+        return TrieLookup(ipLookup->prefix6, key);
+    }
+    return 0;
+}  // End of IPLookup4
+
+int IPLookup6(const ipLookup_t *ipLookup, const uint64_t ip[2]) {
+    if (ip[0] == 0 && (ip[1] >> 32) == 0 && IPLookup4(ipLookup, ip[1])) return 1;
+    if (ipLookup->host6 && IP6SetLookup(ipLookup->host6, ip)) return 1;
+    if (ipLookup->prefix6) return TrieLookup(ipLookup->prefix6, ip);
+    return 0;
+}  // End of IPLookup6
+
+void FreeIPLookup(ipLookup_t *ipLookup) {
+    if (ipLookup == NULL) return;
+    FreeHashSet(ipLookup->host4);
+    FreeHashSet(ipLookup->host6);
+    FreePrefixTrie(ipLookup->prefix4);
+    FreePrefixTrie(ipLookup->prefix6);
+    free(ipLookup);
+}  // End of FreeIPLookup
+
+u64Lookup_t *NewU64Lookup(U64List_t *U64List) {
+    uint32_t numValues = 0;
+    uint64_t maxValue = 0;
+    struct U64ListNode *node;
+    RB_FOREACH(node, U64tree, U64List) {
+        numValues++;
+        if (node->value > maxValue) maxValue = node->value;
+    }
+    if (numValues < MINLOOKUPLIST) return NULL;
+
+    u64Lookup_t *u64Lookup = ListCalloc(1, sizeof(u64Lookup_t));
+    if (maxValue < 65536) {
+        u64Lookup->bitmap = ListCalloc(65536 / 64, sizeof(uint64_t));
+        RB_FOREACH(node, U64tree, U64List) {
+            u64Lookup->bitmap[node->value >> 6] |= 1ULL << (node->value & 0x3F);
+        }
+    } else {
+        u64Lookup->set = NewHashSet(numValues, sizeof(uint64_t));
+        RB_FOREACH(node, U64tree, U64List) {
+            ValueSetInsert(u64Lookup->set, node->value);
+        }
+    }
+
+    return u64Lookup;
+}  // End of NewU64Lookup
+
+int U64Lookup(const u64Lookup_t *u64Lookup, uint64_t value) {
+    if (u64Lookup->bitmap) return value < 65536 && ((u64Lookup->bitmap[value >> 6] >> (value & 0x3F)) & 1);
+    return ValueSetLookup(u64Lookup->set, value);
+}  // End of U64Lookup
+
+void FreeU64Lookup(u64Lookup_t *u64Lookup) {
+    if (u64Lookup == NULL) return;
+    free(u64Lookup->bitmap);
+    FreeHashSet(u64Lookup->set);
+    free(u64Lookup);
+}  // End of FreeU64Lookup
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _LISTLOOKUP_H
+#define _LISTLOOKUP_H 1
+
+#include <stdint.h>
+
+#include "filter.h"
+
+/*
+ * Large IP and value lists of filters are compiled into lookup tables, which replace
+ * the search in the RB trees. Exact IP addresses are stored in a hash set, prefixes in a
+ * multibit trie. Value lists with all values < 65536, such as ports, become a bitmap,
+ * other value lists a hash set.
+ */
+
+// min number of list entries to compile a list into a lookup table
+#define MINLOOKUPLIST 16
+
+typedef struct ipLookup_s ipLookup_t;
+
+typedef struct u64Lookup_s u64Lookup_t;
+
+ipLookup_t *NewIPLookup(IPlist_t *IPlist);
+
+int IPLookup4(const ipLookup_t *ipLookup, uint32_t ip);
+
+int IPLookup6(const ipLookup_t *ipLookup, const uint64_t ip[2]);
+
+void FreeIPLookup(ipLookup_t *ipLookup);
+
+u64Lookup_t *NewU64Lookup(U64List_t *U64List);
+
+int U64Lookup(const u64Lookup_t *u64Lookup, uint64_t value);
+
+void FreeU64Lookup(u64Lookup_t *u64Lookup);
+
+#endif
@@ -0,0 +1,492 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Lossless record encoding of data blocks, applied before block compression.
+ * Timestamps of consecutive flow records are close to each other and counters are
+ * small compared to their 64bit fields. The encoding replaces these fields by
+ * zigzag deltas and counters by varints. The record headers and element headers
+ * as well as all other fields are kept, which allows to decode the records without
+ * additional information:
+ *
+ * EXgenericFlow: msecFirst    - delta to msecFirst of the previous record in block
+ *                msecLast     - delta to msecFirst
+ *                msecReceived - delta to msecLast
+ *                inPackets, inBytes - varint
+ * EXcntFlow:     flows, outPackets, outBytes - varint
+ *
+ * Elements are only encoded, if their length matches the known element size.
+ *
+ * The column encoding is an alternative to the delta/varint encoding. The V3 records of
+ * a block are transposed into columns: The record headers, element headers and all non V3
+ * records form the header column, followed by one column per element type with the element
+ * data of all records in record order. Columns with elements of equal length are stored
+ * byte plane wise - byte 0 of all elements, followed by byte 1 of all elements etc. - which
+ * puts the mostly equal high bytes of timestamps, counters and addresses next to each other
+ * for the block compression. The size of the columns is derived from the header column:
+ *
+ *   +---------------+---------------+----------------+----------------+-----+
+ *   | header size   | header column | element type 1 | element type 2 | ... |
+ *   +---------------+---------------+----------------+----------------+-----+
+ *
+ * Readers decode the columns back into V3 records, so all consumers work on records.
+ */
+
+#include "nfencode.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "nfdump.h"
+#include "nfxV3.h"
+#include "util.h"
+
+// max number of additional bytes of an encoded element. A varint of a 64bit value
+// uses up to 10 bytes and max 5 fields per element are encoded
+#define MAXEXPAND 10
+
+// zigzag maps signed deltas to unsigned values: 0, -1, 1, -2, 2 ..
+#define ZIGZAG(n) (((uint64_t)(n) << 1) ^ (uint64_t)((int64_t)(n) >> 63))
+#define UNZIGZAG(n) (((n) >> 1) ^ (~((n)&1) + 1))
+
+static inline uint8_t *PutVarint(uint8_t *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}  // End of PutVarint
+
+static inline const uint8_t *GetVarint(const uint8_t *in, const uint8_t *end, uint64_t *value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7) {
+        uint8_t b = *in++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *value = v;
+            return in;
+        }
+    }
+    return NULL;
+}  // End of GetVarint
+
+// encode V3 record into out. Returns the end of the encoded record or NULL, if the record is malformed
+static uint8_t *EncodeRecord(recordHeaderV3_t *record, uint8_t *out, uint8_t *outEnd, uint64_t *msecFirst) {
+    if ((out + record->size) > outEnd) return NULL;
+    memcpy(out, (void *)record, sizeof(recordHeaderV3_t));
+    out += sizeof(recordHeaderV3_t);
+
+    uint32_t offset = sizeof(recordHeaderV3_t);
+    for (int i = 0; i < record->numElements; i++) {
+        elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + offset);
+        if ((offset + sizeof(elementHeader_t)) > record->size || elementHeader->length < sizeof(elementHeader_t) ||
+            (offset + elementHeader->length) > record->size)
+            return NULL;
+        if ((out + elementHeader->length + MAXEXPAND) > outEnd) return NULL;
+        memcpy(out, (void *)elementHeader, sizeof(elementHeader_t));
+        out += sizeof(elementHeader_t);
+
+        void *data = (void *)elementHeader + sizeof(elementHeader_t);
+        if (elementHeader->type == EXgenericFlowID && elementHeader->length == EXgenericFlowSize) {
+            EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)data;
+            out = PutVarint(out, ZIGZAG(genericFlow->msecFirst - *msecFirst));
+            out = PutVarint(out, ZIGZAG(genericFlow->msecLast - genericFlow->msecFirst));
+            out = PutVarint(out, ZIGZAG(genericFlow->msecReceived - genericFlow->msecLast));
+            out = PutVarint(out, genericFlow->inPackets);
+            out = PutVarint(out, genericFlow->inBytes);
+            memcpy(out, data + OFFsrcPort, sizeof(EXgenericFlow_t) - OFFsrcPort);
+            out += sizeof(EXgenericFlow_t) - OFFsrcPort;
+            *msecFirst = genericFlow->msecFirst;
+        } else if (elementHeader->type == EXcntFlowID && elementHeader->length == EXcntFlowSize) {
+            EXcntFlow_t *cntFlow = (EXcntFlow_t *)data;
+            out = PutVarint(out, cntFlow->flows);
+            out = PutVarint(out, cntFlow->outPackets);
+            out = PutVarint(out, cntFlow->outBytes);
+        } else {
+            memcpy(out, data, elementHeader->length - sizeof(elementHeader_t));
+            out += elementHeader->length - sizeof(elementHeader_t);
+        }
+        offset += elementHeader->length;
+    }
+
+    // bytes after the last element
+    if (offset < record->size) {
+        if ((out + record->size - offset) > outEnd) return NULL;
+        memcpy(out, (void *)record + offset, record->size - offset);
+        out += record->size - offset;
+    }
+
+    return out;
+
+}  // End of EncodeRecord
+
+// decode V3 record from in into out. Returns the end of the encoded record or NULL, if corrupt
+static const uint8_t *DecodeRecord(const uint8_t *in, const uint8_t *end, recordHeaderV3_t *record, uint8_t *outEnd, uint64_t *msecFirst) {
+    memcpy((void *)record, in, sizeof(recordHeaderV3_t));
+    in += sizeof(recordHeaderV3_t);
+    if (record->size < sizeof(recordHeaderV3_t) || ((uint8_t *)record + record->size) > outEnd) return NULL;
+
+    uint32_t offset = sizeof(recordHeaderV3_t);
+    for (int i = 0; i < record->numElements; i++) {
+        elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + offset);
+        if ((offset + sizeof(elementHeader_t)) > record->size || (in + sizeof(elementHeader_t)) > end) return NULL;
+        memcpy((void *)elementHeader, in, sizeof(elementHeader_t));
+        in += sizeof(elementHeader_t);
+        if (elementHeader->length < sizeof(elementHeader_t) || (offset + elementHeader->length) > record->size) return NULL;
+
+        void *data = (void *)elementHeader + sizeof(elementHeader_t);
+        if (elementHeader->type == EXgenericFlowID && elementHeader->length == EXgenericFlowSize) {
+            EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)data;
+            uint64_t v[5];
+            for (int j = 0; j < 5; j++) {
+                in = GetVarint(in, end, &v[j]);
+                if (in == NULL) return NULL;
+            }
+            genericFlow->msecFirst = *msecFirst + UNZIGZAG(v[0]);
+            genericFlow->msecLast = genericFlow->msecFirst + UNZIGZAG(v[1]);
+            genericFlow->msecReceived = genericFlow->msecLast + UNZIGZAG(v[2]);
+            genericFlow->inPackets = v[3];
+            genericFlow->inBytes = v[4];
+            if ((in + sizeof(EXgenericFlow_t) - OFFsrcPort) > end) return NULL;
+            memcpy(data + OFFsrcPort, in, sizeof(EXgenericFlow_t) - OFFsrcPort);
+            in += sizeof(EXgenericFlow_t) - OFFsrcPort;
+            *msecFirst = genericFlow->msecFirst;
+        } else if (elementHeader->type == EXcntFlowID && elementHeader->length == EXcntFlowSize) {
+            EXcntFlow_t *cntFlow = (EXcntFlow_t *)data;
+            if ((in = GetVarint(in, end, &cntFlow->flows)) == NULL) return NULL;
+            if ((in = GetVarint(in, end, &cntFlow->outPackets)) == NULL) return NULL;
+            if ((in = GetVarint(in, end, &cntFlow->outBytes)) == NULL) return NULL;
+        } else {
+            uint32_t length = elementHeader->length - sizeof(elementHeader_t);
+            if ((in + length) > end) return NULL;
+            memcpy(data, in, length);
+            in += length;
+        }
+        offset += elementHeader->length;
+    }
+
+    // bytes after the last element
+    if (offset < record->size) {
+        uint32_t length = record->size - offset;
+        if ((in + length) > end) return NULL;
+        memcpy((void *)record + offset, in, length);
+        in += length;
+    }
+
+    return in;
+
+}  // End of DecodeRecord
+
+// encode the records of data block in_block into out_block. Returns 0, if the block contains
+// malformed records or the encoded block is not smaller. Otherwise out_block is flagged FLAG_BLOCK_ENCODED
+int EncodeBlock(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+    void *in = (void *)in_block + sizeof(dataBlock_t);
+    uint8_t *out = (uint8_t *)out_block + sizeof(dataBlock_t);
+    uint8_t *outEnd = (uint8_t *)out_block + block_size;
+
+    uint64_t msecFirst = 0;
+    uint32_t processed = 0;
+    for (int i = 0; i < in_block->NumRecords; i++) {
+        recordHeader_t *recordHeader = (recordHeader_t *)(in + processed);
+        if ((processed + sizeof(recordHeader_t)) > in_block->size || recordHeader->size < sizeof(recordHeader_t) ||
+            (processed + recordHeader->size) > in_block->size)
+            return 0;
+
+        if (recordHeader->type == V3Record && recordHeader->size >= sizeof(recordHeaderV3_t)) {
+            out = EncodeRecord((recordHeaderV3_t *)recordHeader, out, outEnd, &msecFirst);
+            if (out == NULL) return 0;
+        } else {
+            if ((out + recordHeader->size) > outEnd) return 0;
+            memcpy(out, (void *)recordHeader, recordHeader->size);
+            out += recordHeader->size;
+        }
+        processed += recordHeader->size;
+    }
+
+    uint32_t size = out - ((uint8_t *)out_block + sizeof(dataBlock_t));
+    if (size >= in_block->size) return 0;
+
+    *out_block = *in_block;
+    out_block->size = size;
+    SetFlag(out_block->flags, FLAG_BLOCK_ENCODED);
+
+    return 1;
+
+}  // End of EncodeBlock
+
+// decode the records of the encoded data block in_block into out_block. Returns 0, if the block is corrupt
+int DecodeBlock(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+    const uint8_t *in = (const uint8_t *)in_block + sizeof(dataBlock_t);
+    const uint8_t *end = in + in_block->size;
+    uint8_t *out = (uint8_t *)out_block + sizeof(dataBlock_t);
+    uint8_t *outEnd = (uint8_t *)out_block + block_size;
+
+    uint64_t msecFirst = 0;
+    for (int i = 0; i < in_block->NumRecords; i++) {
+        if ((in + sizeof(recordHeader_t)) > end) return 0;
+        recordHeader_t recordHeader;
+        memcpy((void *)&recordHeader, in, sizeof(recordHeader_t));
+
+        if (recordHeader.type == V3Record && recordHeader.size >= sizeof(recordHeaderV3_t)) {
+            if ((in + sizeof(recordHeaderV3_t)) > end) return 0;
+            in = DecodeRecord(in, end, (recordHeaderV3_t *)out, outEnd, &msecFirst);
+            if (in == NULL) return 0;
+        } else {
+            if (recordHeader.size < sizeof(recordHeader_t) || (in + recordHeader.size) > end || (out + recordHeader.size) > outEnd) return 0;
+            memcpy(out, in, recordHeader.size);
+            in += recordHeader.size;
+        }
+        out += recordHeader.size;
+    }
+    if (in != end) return 0;
+
+    *out_block = *in_block;
+    out_block->size = out - ((uint8_t *)out_block + sizeof(dataBlock_t));
+    ClearFlag(out_block->flags, FLAG_BLOCK_ENCODED);
+
+    return 1;
+
+}  // End of DecodeBlock
+
+// column of all elements of one element type in a column encoded block
+typedef struct column_s {
+    uint8_t *data;         // start of column in encoded block
+    uint32_t numElements;  // number of elements in column
+    uint32_t size;         // sum of element data lengths
+    uint32_t fill;         // elements - byte plane column, or bytes processed
+    uint16_t length;       // element data length of the first element
+    uint16_t planes;       // all elements of equal length - byte plane column
+} column_t;
+
+static inline void AddColumnElement(column_t *column, uint16_t length) {
+    if (column->numElements == 0) {
+        column->length = length;
+        column->planes = 1;
+    } else if (length != column->length) {
+        column->planes = 0;
+    }
+    column->numElements++;
+    column->size += length;
+}  // End of AddColumnElement
+
+// set the start of each column after data. Returns the end of the last column or NULL, if beyond end
+static uint8_t *SetColumns(column_t *columns, uint8_t *data, uint8_t *end) {
+    for (int i = 0; i < MAXEXTENSIONS; i++) {
+        columns[i].data = data;
+        columns[i].fill = 0;
+        if ((size_t)(end - data) < columns[i].size) return NULL;
+        data += columns[i].size;
+    }
+    return data;
+}  // End of SetColumns
+
+static inline void PutColumn(column_t *column, const uint8_t *data, uint16_t length) {
+    if (column->planes) {
+        for (int i = 0; i < length; i++) column->data[i * column->numElements + column->fill] = data[i];
+        column->fill++;
+    } else {
+        memcpy(column->data + column->fill, data, length);
+        column->fill += length;
+    }
+}  // End of PutColumn
+
+static inline void GetColumn(column_t *column, uint8_t *data, uint16_t length) {
+    if (column->planes) {
+        for (int i = 0; i < length; i++) data[i] = column->data[i * column->numElements + column->fill];
+        column->fill++;
+    } else {
+        memcpy(data, column->data + column->fill, length);
+        column->fill += length;
+    }
+}  // End of GetColumn
+
+// column encode the records of data block in_block into out_block. Returns 0, if the block contains
+// malformed records or does not fit into out_block. Otherwise out_block is flagged FLAG_BLOCK_COLUMN
+int EncodeColumnBlock(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+    void *in = (void *)in_block + sizeof(dataBlock_t);
+    uint8_t *out = (uint8_t *)out_block + sizeof(dataBlock_t);
+    uint8_t *outEnd = (uint8_t *)out_block + block_size;
+
+    // first pass - check the records and size the columns
+    column_t columns[MAXEXTENSIONS] = {0};
+    uint32_t headerSize = 0;
+    uint32_t processed = 0;
+    for (int i = 0; i < in_block->NumRecords; i++) {
+        recordHeader_t *recordHeader = (recordHeader_t *)(in + processed);
+        if ((processed + sizeof(recordHeader_t)) > in_block->size || recordHeader->size < sizeof(recordHeader_t) ||
+            (processed + recordHeader->size) > in_block->size)
+            return 0;
+
+        if (recordHeader->type == V3Record && recordHeader->size >= sizeof(recordHeaderV3_t)) {
+            recordHeaderV3_t *record = (recordHeaderV3_t *)recordHeader;
+            uint32_t offset = sizeof(recordHeaderV3_t);
+            for (int j = 0; j < record->numElements; j++) {
+                elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + offset);
+                if ((offset + sizeof(elementHeader_t)) > record->size || elementHeader->length < sizeof(elementHeader_t) ||
+                    (offset + elementHeader->length) > record->size || elementHeader->type >= MAXEXTENSIONS)
+                    return 0;
+                AddColumnElement(&columns[elementHeader->type], elementHeader->length - sizeof(elementHeader_t));
+                headerSize += sizeof(elementHeader_t);
+                offset += elementHeader->length;
+            }
+            // record header and bytes after the last element
+            headerSize += sizeof(recordHeaderV3_t) + record->size - offset;
+        } else {
+            headerSize += recordHeader->size;
+        }
+        processed += recordHeader->size;
+    }
+
+    if ((size_t)(outEnd - out) < (sizeof(uint32_t) + headerSize)) return 0;
+    memcpy(out, (void *)&headerSize, sizeof(uint32_t));
+    uint8_t *header = out + sizeof(uint32_t);
+    uint8_t *end = SetColumns(columns, header + headerSize, outEnd);
+    if (end == NULL) return 0;
+
+    // second pass - transpose the records into the columns
+    processed = 0;
+    for (int i = 0; i < in_block->NumRecords; i++) {
+        recordHeader_t *recordHeader = (recordHeader_t *)(in + processed);
+        if (recordHeader->type == V3Record && recordHeader->size >= sizeof(recordHeaderV3_t)) {
+            recordHeaderV3_t *record = (recordHeaderV3_t *)recordHeader;
+            memcpy(header, (void *)record, sizeof(recordHeaderV3_t));
+            header += sizeof(recordHeaderV3_t);
+            uint32_t offset = sizeof(recordHeaderV3_t);
+            for (int j = 0; j < record->numElements; j++) {
+                elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + offset);
+                memcpy(header, (void *)elementHeader, sizeof(elementHeader_t));
+                header += sizeof(elementHeader_t);
+                PutColumn(&columns[elementHeader->type], (uint8_t *)elementHeader + sizeof(elementHeader_t),
+                          elementHeader->length - sizeof(elementHeader_t));
+                offset += elementHeader->length;
+            }
+            memcpy(header, (void *)record + offset, record->size - offset);
+            header += record->size - offset;
+        } else {
+            memcpy(header, (void *)recordHeader, recordHeader->size);
+            header += recordHeader->size;
+        }
+        processed += recordHeader->size;
+    }
+
+    *out_block = *in_block;
+    out_block->size = end - out;
+    SetFlag(out_block->flags, FLAG_BLOCK_COLUMN);
+
+    return 1;
+
+}  // End of EncodeColumnBlock
+
+// decode the columns of the column encoded data block in_block into out_block. Returns 0, if the block is corrupt
+int DecodeColumnBlock(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+    uint8_t *in = (uint8_t *)in_block + sizeof(dataBlock_t);
+    uint8_t *end = in + in_block->size;
+    uint8_t *out = (uint8_t *)out_block + sizeof(dataBlock_t);
+    uint8_t *outEnd = (uint8_t *)out_block + block_size;
+
+    uint32_t headerSize;
+    if (in_block->size < sizeof(uint32_t)) return 0;
+    memcpy((void *)&headerSize, in, sizeof(uint32_t));
+    if (headerSize > (in_block->size - sizeof(uint32_t))) return 0;
+    uint8_t *header = in + sizeof(uint32_t);
+    uint8_t *headerEnd = header + headerSize;
+
+    // first pass - check the header column and size the columns
+    column_t columns[MAXEXTENSIONS] = {0};
+    uint8_t *p = header;
+    for (int i = 0; i < in_block->NumRecords; i++) {
+        recordHeaderV3_t record;
+        if ((p + sizeof(recordHeader_t)) > headerEnd) return 0;
+        memcpy((void *)&record, p, sizeof(recordHeader_t));
+
+        if (record.type == V3Record && record.size >= sizeof(recordHeaderV3_t)) {
+            if ((p + sizeof(recordHeaderV3_t)) > headerEnd) return 0;
+            memcpy((void *)&record, p, sizeof(recordHeaderV3_t));
+            p += sizeof(recordHeaderV3_t);
+            uint32_t offset = sizeof(recordHeaderV3_t);
+            for (int j = 0; j < record.numElements; j++) {
+                elementHeader_t elementHeader;
+                if ((p + sizeof(elementHeader_t)) > headerEnd) return 0;
+                memcpy((void *)&elementHeader, p, sizeof(elementHeader_t));
+                p += sizeof(elementHeader_t);
+                if (elementHeader.length < sizeof(elementHeader_t) || (offset + elementHeader.length) > record.size ||
+                    elementHeader.type >= MAXEXTENSIONS)
+                    return 0;
+                AddColumnElement(&columns[elementHeader.type], elementHeader.length - sizeof(elementHeader_t));
+                offset += elementHeader.length;
+            }
+            if ((p + record.size - offset) > headerEnd) return 0;
+            p += record.size - offset;
+        } else {
+            if (record.size < sizeof(recordHeader_t) || (p + record.size) > headerEnd) return 0;
+            p += record.size;
+        }
+    }
+    if (p != headerEnd || SetColumns(columns, headerEnd, end) != end) return 0;
+
+    // second pass - rebuild the records from the columns
+    p = header;
+    for (int i = 0; i < in_block->NumRecords; i++) {
+        recordHeader_t recordHeader;
+        memcpy((void *)&recordHeader, p, sizeof(recordHeader_t));
+        if ((out + recordHeader.size) > outEnd) return 0;
+
+        if (recordHeader.type == V3Record && recordHeader.size >= sizeof(recordHeaderV3_t)) {
+            recordHeaderV3_t *record = (recordHeaderV3_t *)out;
+            memcpy((void *)record, p, sizeof(recordHeaderV3_t));
+            p += sizeof(recordHeaderV3_t);
+            uint32_t offset = sizeof(recordHeaderV3_t);
+            for (int j = 0; j < record->numElements; j++) {
+                elementHeader_t *elementHeader = (elementHeader_t *)((void *)record + offset);
+                memcpy((void *)elementHeader, p, sizeof(elementHeader_t));
+                p += sizeof(elementHeader_t);
+                GetColumn(&columns[elementHeader->type], (uint8_t *)elementHeader + sizeof(elementHeader_t),
+                          elementHeader->length - sizeof(elementHeader_t));
+                offset += elementHeader->length;
+            }
+            memcpy((void *)record + offset, p, record->size - offset);
+            p += record->size - offset;
+        } else {
+            memcpy(out, p, recordHeader.size);
+            p += recordHeader.size;
+        }
+        out += recordHeader.size;
+    }
+
+    *out_block = *in_block;
+    out_block->size = out - ((uint8_t *)out_block + sizeof(dataBlock_t));
+    ClearFlag(out_block->flags, FLAG_BLOCK_COLUMN);
+
+    return 1;
+
+}  // End of DecodeColumnBlock
@@ -61,6 +61,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -69,6 +71,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "filter/filter.h"
 #include "flist.h"
 #ifndef HAVE_LZ4
 #include "lz4.h"
@@ -77,6 +80,7 @@
 #include "minilzo.h"
 #include "nfconf.h"
 #include "nfdump.h"
+#include "nfencode.h"
 #include "nffileV2.h"
 #include "util.h"
 
@@ -89,6 +93,8 @@
     (a)->flags = 0;      \
     (a)->type = DATA_BLOCK_TYPE_3;
 
+static const char *compressionName[ZSTD_COMPRESSED + 1] = {"none", "lzo", "bz2", "lz4", "zstd"};
+
 static const char *nf_creator[MAX_CREATOR] = {"unknown", "nfcapd", "nfpcapd", "sfcapd", "nfdump", "nfanon", "nfprofile", "geolookup", "ft2nfdump"};
 
 static unsigned NumWorkers = DEFAULTWORKERS;
@@ -112,9 +118,15 @@ static int Uncompress_Block_LZ4(dataBlock_t *in_block, dataBlock_t *out_block, s
 
 static int Compress_Block_BZ2(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
 
-static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level);
+static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level, const void *cdict);
+
+static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, const void *ddict);
+
+static int InitCompressDictionary(nffile_t *nffile);
 
-static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
+static int InitDecompressDictionary(nffile_t *nffile);
+
+static void FreeFileDictionary(nffile_t *nffile);
 
 static int Uncompress_Block_BZ2(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size);
 
@@ -132,8 +144,44 @@ static int ReadAppendix(nffile_t *nffile);
 
 static int WriteAppendix(nffile_t *nffile);
 
+static int ReadAutoBlock(nffile_t *nffile, dataBlock_t *block_header);
+
+static int ReadDictBlocks(nffile_t *nffile);
+
+static int WriteDictBlocks(nffile_t *nffile);
+
+static void ScanBlock(dataBlock_t *block_header, blockIndex_t *blockIndex);
+
+static int AddBlockIndex(nffile_t *nffile, blockIndex_t *blockIndex);
+
+static void MapFile(nffile_t *nffile);
+
+static void UnmapFile(nffile_t *nffile);
+
+static int AddMapping(void *addr, size_t size);
+
+static void RetainMapping(void *ptr);
+
+static int ReleaseMapping(void *ptr);
+
+static void ReadAhead(nffile_t *nffile, off_t offset, size_t length);
+
+static void ReleaseBlock(nffile_t *nffile, dataBlock_t *dataBlock);
+
+static dataBlock_t *DetachBlock(nffile_t *nffile, dataBlock_t *dataBlock);
+
 static int SignalTerminate(nffile_t *nffile);
 
+// raw data block read by nfreader to be uncompressed by an uncompress worker
+typedef struct readJob_s {
+    dataBlock_t *buff;  // raw block
+    uint32_t sequence;  // sequence number in file
+} readJob_t;
+
+static dataBlock_t *nfreadRaw(nffile_t *nffile);
+
+static void *nfuncompressor(void *arg);
+
 static void FlushFile(nffile_t *nffile);
 
 static int QueryFileV1(int fd, fileHeaderV2_t *fileHeaderV2);
@@ -142,13 +190,77 @@ static void UpdateStat(stat_record_t *s, stat_recordV1_t *sv1);
 
 static queue_t *fileQueue = NULL;
 
+// files of fileQueue, opened ahead by the prefetcher thread
+static queue_t *prefetchQueue = NULL;
+static pthread_t prefetchTid;
+// set by DisposePrefetcher() - skip the remaining files of fileQueue
+static _Atomic int prefetchStop = 0;
+#define PrefetchSize 4
+// marker for a file, which failed to open
+#define PREFETCH_FAILED ((nffile_t *)-2)
+
+static void *nfprefetcher(void *arg);
+
+static nffile_t *StartReader(nffile_t *nffile);
+
 /* function definitions */
 
 #define QueueSize 4
+// adaptive compression: processQueue backlog for fast LZ4 compression
+#define PressureBacklog (QueueSize / 2)
+#define BlockQueueSize 16
+
+// nfreader keeps this number of blocks or bytes in flight by read ahead
+#define READAHEAD_BLOCKS 8
+#define READAHEAD_SIZE (READAHEAD_BLOCKS * WRITE_BUFFSIZE)
+static long pageSize = 4096;
 
 static _Atomic unsigned blocksInUse;
+static _Atomic unsigned blocksSkipped;
+
+// pool of free data blocks. Released blocks are kept for reuse up to BLOCKPOOLSIZE blocks,
+// which saves the malloc()/free() and page faults of a new BUFFSIZE block for each block
+#define BLOCKPOOLSIZE 16
+#define HUGEPAGESIZE (2 * ONEMB)
+static struct blockPool_s {
+    pthread_mutex_t lock;
+    unsigned numFree;
+    int hugePages;  // allocate blocks aligned to huge pages
+    dataBlock_t *freeList[BLOCKPOOLSIZE];
+} blockPool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// file mappings. A mapping is referenced by its file and by each data block taken from the
+// mapping with TakeBlock(). The mapping is unmapped, when the last reference is released,
+// so blocks handed to other threads stay valid after the file is closed
+typedef struct fileMap_s {
+    struct fileMap_s *next;
+    void *addr;
+    size_t size;
+    uint32_t refCount;
+} fileMap_t;
+
+static struct fileMaps_s {
+    pthread_mutex_t lock;
+    fileMap_t *list;
+    _Atomic unsigned numTaken;  // number of taken blocks of all mappings
+} fileMaps = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// time window in msec for skipping data blocks with the block index
+// 0 if not set
+static uint64_t indexMsecFirst = 0;
+static uint64_t indexMsecLast = 0;
+
+// filter engine for skipping data blocks with the block index zone maps
+// NULL if not set
+static void *indexFilter = NULL;
+
+// ZSTD dictionary for new zstd compressed files, NULL if not set
+static void *zstdDict = NULL;
+static uint32_t zstdDictSize = 0;
 
 int Init_nffile(int workers, queue_t *fileList) {
+    // stop the prefetcher of a previous file list
+    DisposePrefetcher();
     fileQueue = fileList;
     if (!LZO_initialize()) {
         LogError("Failed to initialize LZO");
@@ -167,7 +279,23 @@ int Init_nffile(int workers, queue_t *fileList) {
         return 0;
     }
 
+    // optional ZSTD dictionary for new files
+    char *dictFile = ConfGetString("zstddict");
+    if (dictFile) {
+        if (zstdDict == NULL && !LoadZstdDictionary(dictFile)) {
+            LogError("Failed to load ZSTD dictionary '%s' - compress without dictionary", dictFile);
+        }
+        free(dictFile);
+    }
+
     atomic_init(&blocksInUse, 0);
+    atomic_init(&blocksSkipped, 0);
+
+    // optional huge pages for data blocks
+    blockPool.hugePages = ConfGetValue("hugepages") != 0;
+
+    long size = sysconf(_SC_PAGESIZE);
+    if (size > 0) pageSize = size;
 
     // get conf value for maxworkers
     int confMaxWorkers = ConfGetValue("maxworkers");
@@ -206,36 +334,64 @@ int ParseCompression(char *arg) {
 
     if (arg[0] == '=') arg++;
 
-    if (strlen(arg) > 16) {
+    if (strlen(arg) > 32) {
         return -1;
     }
 
+    // options: [:level][:delta|:column][:adapt]
     int level = 0;
+    int levelSet = 0;
+    int options = 0;
     char *s = strchr(arg, ':');
-    if (s) {
-        *s++ = '\0';
-        while (*s && isdigit(*s)) {
-            level = 10 * level + (*s++ - 0x30);
-        }
-        if (*s) {
-            LogError("Invalid compression level: %s", s);
-            return -1;
-        }
-        if (level > 100) {
-            LogError("Invalid compression level: %u", level);
-            return -1;
+    if (s) *s++ = '\0';
+    while (s) {
+        char *next = strchr(s, ':');
+        if (next) *next++ = '\0';
+        if (strcasecmp(s, "delta") == 0) {
+            options |= COMPRESSION_DELTA;
+        } else if (strcasecmp(s, "column") == 0) {
+            options |= COMPRESSION_COLUMN;
+        } else if (strcasecmp(s, "adapt") == 0) {
+            options |= COMPRESSION_ADAPTIVE;
+        } else {
+            // exactly one non empty numeric level
+            if (*s == '\0' || levelSet) {
+                LogError("Invalid compression level: '%s'", s);
+                return -1;
+            }
+            int tokenLevel = 0;
+            while (*s && isdigit(*s)) {
+                tokenLevel = 10 * tokenLevel + (*s++ - 0x30);
+                if (tokenLevel > 100) {
+                    LogError("Invalid compression level: %u", tokenLevel);
+                    return -1;
+                }
+            }
+            if (*s) {
+                LogError("Invalid compression level: %s", s);
+                return -1;
+            }
+            level = tokenLevel;
+            levelSet = 1;
         }
+        s = next;
+    }
+
+    // a block is either delta or column encoded
+    if ((options & COMPRESSION_DELTA) && (options & COMPRESSION_COLUMN)) {
+        LogError("Compression options delta and column can not be combined");
+        return -1;
     }
 
     for (int i = 0; arg[i]; i++) {
         arg[i] = tolower(arg[i]);
     }
 
-    if (strcmp(arg, "0") == 0) return NOT_COMPRESSED;
-    if (strcmp(arg, "lzo") == 0 || strcmp(arg, "1") == 0) return LZO_COMPRESSED;
+    if (strcmp(arg, "0") == 0) return options | NOT_COMPRESSED;
+    if (strcmp(arg, "lzo") == 0 || strcmp(arg, "1") == 0) return options | LZO_COMPRESSED;
     if (strcmp(arg, "lz4") == 0 || strcmp(arg, "3") == 0) {
         if (level <= LZ4HC_CLEVEL_MAX) {
-            return (level << 16) | LZ4_COMPRESSED;
+            return (level << 16) | options | LZ4_COMPRESSED;
         } else {
             LogError("LZ4 max compression level is %d", LZ4HC_CLEVEL_MAX);
             return -1;
@@ -244,7 +400,7 @@ int ParseCompression(char *arg) {
 
     if (strcmp(arg, "bz2") == 0 || strcmp(arg, "bzip2") == 0 || strcmp(arg, "2") == 0) {
 #ifdef HAVE_BZIP2
-        return BZ2_COMPRESSED;
+        return options | BZ2_COMPRESSED;
     }
 #else
         LogError("BZIP2 compression not compiled in");
@@ -255,7 +411,7 @@ int ParseCompression(char *arg) {
     if (strcmp(arg, "zstd") == 0 || strcmp(arg, "4") == 0) {
 #ifdef HAVE_ZSTD
         if (level <= ZSTD_maxCLevel()) {
-            return (level << 16) | ZSTD_COMPRESSED;
+            return (level << 16) | options | ZSTD_COMPRESSED;
         } else {
             LogError("ZSTD max compression level is %d", ZSTD_maxCLevel());
             return -1;
@@ -277,6 +433,75 @@ unsigned ReportBlocks(void) {
     return inUse;
 }
 
+unsigned ReportSkippedBlocks(void) {
+    unsigned skipped = atomic_load(&blocksSkipped);
+    return skipped;
+}
+
+// set the time window of a query. Data blocks, which can not contain
+// any record within this time window are skipped by nfreader, if the file has a block index
+void SetIndexTimeWindow(uint64_t msecFirst, uint64_t msecLast) {
+    indexMsecFirst = msecFirst;
+    indexMsecLast = msecLast;
+}  // End of SetIndexTimeWindow
+
+// set the filter engine of a query. Data blocks, which can not contain
+// any record matching the filter are skipped by nfreader, if the file has a block index
+void SetIndexFilter(void *engine) { indexFilter = engine; }  // End of SetIndexFilter
+
+// load the ZSTD dictionary dictFile. New zstd compressed files are compressed with this
+// dictionary, which is stored in front of the data blocks of each file
+int LoadZstdDictionary(char *dictFile) {
+#ifdef HAVE_ZSTD
+    struct stat stat_buf;
+    if (stat(dictFile, &stat_buf)) {
+        LogError("Can't stat '%s': %s", dictFile, strerror(errno));
+        return 0;
+    }
+    if (stat_buf.st_size == 0 || stat_buf.st_size > MAXDICTSIZE) {
+        LogError("ZSTD dictionary size %lld out of range (1..%u)", (long long)stat_buf.st_size, MAXDICTSIZE);
+        return 0;
+    }
+
+    int fd = open(dictFile, O_RDONLY);
+    if (fd < 0) {
+        LogError("Failed to open file %s: '%s'", dictFile, strerror(errno));
+        return 0;
+    }
+
+    void *dict = malloc(stat_buf.st_size);
+    if (!dict) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    ssize_t ret = read(fd, dict, stat_buf.st_size);
+    close(fd);
+    if (ret != stat_buf.st_size) {
+        LogError("Short read: Expected %lld bytes, read: %zd", (long long)stat_buf.st_size, ret);
+        free(dict);
+        return 0;
+    }
+
+    // blocks compressed with a raw content dictionary can not be told apart by the dict ID
+    if (ZSTD_getDictID_fromDict(dict, stat_buf.st_size) == 0) {
+        LogError("File '%s' is not a trained ZSTD dictionary", dictFile);
+        free(dict);
+        return 0;
+    }
+
+    if (zstdDict) free(zstdDict);
+    zstdDict = dict;
+    zstdDictSize = stat_buf.st_size;
+    return 1;
+#else
+    LogError("ZSTD compression not compiled in");
+    return 0;
+#endif
+
+}  // End of LoadZstdDictionary
+
 static int LZO_initialize(void) {
     if (lzo_init() != LZO_E_OK) {
         // this usually indicates a compiler bug - try recompiling
@@ -301,6 +526,41 @@ static int LZ4_initialize(void) {
 
 static int BZ2_initialize(void) { return 1; }  // End of BZ2_initialize
 
+#ifdef HAVE_ZSTD
+// ZSTD compression and decompression contexts are created once per thread and reused
+// for all blocks, the thread compresses or uncompresses. Freed at thread exit
+static pthread_key_t zstdCCtxKey;
+static pthread_key_t zstdDCtxKey;
+static pthread_once_t zstdKeyOnce = PTHREAD_ONCE_INIT;
+
+static void FreeZstdCCtx(void *cctx) { ZSTD_freeCCtx((ZSTD_CCtx *)cctx); }  // End of FreeZstdCCtx
+
+static void FreeZstdDCtx(void *dctx) { ZSTD_freeDCtx((ZSTD_DCtx *)dctx); }  // End of FreeZstdDCtx
+
+static void CreateZstdKeys(void) {
+    pthread_key_create(&zstdCCtxKey, FreeZstdCCtx);
+    pthread_key_create(&zstdDCtxKey, FreeZstdDCtx);
+}  // End of CreateZstdKeys
+
+static ZSTD_CCtx *GetZstdCCtx(void) {
+    ZSTD_CCtx *cctx = (ZSTD_CCtx *)pthread_getspecific(zstdCCtxKey);
+    if (!cctx) {
+        cctx = ZSTD_createCCtx();
+        if (cctx) pthread_setspecific(zstdCCtxKey, cctx);
+    }
+    return cctx;
+}  // End of GetZstdCCtx
+
+static ZSTD_DCtx *GetZstdDCtx(void) {
+    ZSTD_DCtx *dctx = (ZSTD_DCtx *)pthread_getspecific(zstdDCtxKey);
+    if (!dctx) {
+        dctx = ZSTD_createDCtx();
+        if (dctx) pthread_setspecific(zstdDCtxKey, dctx);
+    }
+    return dctx;
+}  // End of GetZstdDCtx
+#endif
+
 static int ZSTD_initialize(void) {
 #ifdef HAVE_ZSTD
     size_t const cBuffSize = ZSTD_compressBound(WRITE_BUFFSIZE);
@@ -308,6 +568,7 @@ static int ZSTD_initialize(void) {
         LogError("LZSTD_compressBound() error in %s line %d: Buffer too small", __FILE__, __LINE__);
         return 0;
     }
+    pthread_once(&zstdKeyOnce, CreateZstdKeys);
     return 1;
 #else
     return 1;
@@ -490,14 +751,26 @@ static int Uncompress_Block_BZ2(dataBlock_t *in_block, dataBlock_t *out_block, s
 
 }  // End of Uncompress_Block_BZ2
 
-static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level) {
+static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, int level, const void *cdict) {
 #ifdef HAVE_ZSTD
     const char *in = (const char *)((void *)in_block + sizeof(dataBlock_t));
     char *out = (char *)((void *)out_block + sizeof(dataBlock_t));
     int in_len = in_block->size;
 
-    if (level == 0) level = ZSTD_CLEVEL_DEFAULT;
-    int out_len = ZSTD_compress(out, block_size, in, in_len, level);
+    ZSTD_CCtx *cctx = GetZstdCCtx();
+    if (!cctx) {
+        LogError("ZSTD_createCCtx() error in %s line %d", __FILE__, __LINE__);
+        return -1;
+    }
+
+    size_t out_len;
+    if (cdict) {
+        // the compression level is part of the digested dictionary
+        out_len = ZSTD_compress_usingCDict(cctx, out, block_size, in, in_len, (const ZSTD_CDict *)cdict);
+    } else {
+        if (level == 0) level = ZSTD_CLEVEL_DEFAULT;
+        out_len = ZSTD_compressCCtx(cctx, out, block_size, in, in_len, level);
+    }
 
     if (ZSTD_isError(out_len)) {
         LogError("Compress_Block_ZSTD() error compression aborted in %s line %d: LZ4 : buffer too small", __FILE__, __LINE__);
@@ -515,13 +788,30 @@ static int Compress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, si
 
 }  // End of Compress_Block_ZSTD
 
-static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size) {
+static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block, size_t block_size, const void *ddict) {
 #ifdef HAVE_ZSTD
     const char *in = (const char *)((void *)in_block + sizeof(dataBlock_t));
     char *out = (char *)((void *)out_block + sizeof(dataBlock_t));
     int in_len = in_block->size;
 
-    size_t out_len = ZSTD_decompress(out, block_size, in, in_len);
+    ZSTD_DCtx *dctx = GetZstdDCtx();
+    if (!dctx) {
+        LogError("ZSTD_createDCtx() error in %s line %d", __FILE__, __LINE__);
+        return -1;
+    }
+
+    size_t out_len;
+    unsigned dictID = ZSTD_getDictID_fromFrame(in, in_len);
+    if (dictID) {
+        // block compressed with the dictionary of the file
+        if (!ddict || ZSTD_getDictID_fromDDict((const ZSTD_DDict *)ddict) != dictID) {
+            LogError("Uncompress_Block_ZSTD() missing ZSTD dictionary ID %u", dictID);
+            return -1;
+        }
+        out_len = ZSTD_decompress_usingDDict(dctx, out, block_size, in, in_len, (const ZSTD_DDict *)ddict);
+    } else {
+        out_len = ZSTD_decompressDCtx(dctx, out, block_size, in, in_len);
+    }
     if (ZSTD_isError(out_len)) {
         LogError("LZ4_decompress_safe() error compression aborted in %s line %d: LZ4 : buffer too small", __FILE__, __LINE__);
         return -1;
@@ -537,11 +827,82 @@ static int Uncompress_Block_ZSTD(dataBlock_t *in_block, dataBlock_t *out_block,
 #endif
 }  // End of Uncompress_Block_ZSTD
 
+// digest the dictionary of nffile for compressing data blocks with the file compression level
+static int InitCompressDictionary(nffile_t *nffile) {
+#ifdef HAVE_ZSTD
+    int level = nffile->compression_level ? nffile->compression_level : ZSTD_CLEVEL_DEFAULT;
+    nffile->zstdCDict = ZSTD_createCDict(nffile->zstdDict, nffile->zstdDictSize, level);
+    if (!nffile->zstdCDict) {
+        LogError("ZSTD_createCDict() error in %s line %d", __FILE__, __LINE__);
+        return 0;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}  // End of InitCompressDictionary
+
+// digest the dictionary of nffile for uncompressing data blocks
+static int InitDecompressDictionary(nffile_t *nffile) {
+#ifdef HAVE_ZSTD
+    nffile->zstdDDict = ZSTD_createDDict(nffile->zstdDict, nffile->zstdDictSize);
+    if (!nffile->zstdDDict) {
+        LogError("ZSTD_createDDict() error in %s line %d", __FILE__, __LINE__);
+        return 0;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}  // End of InitDecompressDictionary
+
+static void FreeFileDictionary(nffile_t *nffile) {
+#ifdef HAVE_ZSTD
+    if (nffile->zstdCDict) ZSTD_freeCDict((ZSTD_CDict *)nffile->zstdCDict);
+    if (nffile->zstdDDict) ZSTD_freeDDict((ZSTD_DDict *)nffile->zstdDDict);
+#endif
+    if (nffile->zstdDict) free(nffile->zstdDict);
+    nffile->zstdDict = NULL;
+    nffile->zstdDictSize = 0;
+    nffile->zstdCDict = NULL;
+    nffile->zstdDDict = NULL;
+}  // End of FreeFileDictionary
+
+// allocate the memory of a new data block. With hugepages enabled, the block is aligned
+// to a huge page for transparent huge pages
+static dataBlock_t *AllocDataBlock(void) {
+    void *dataBlock = NULL;
+    if (blockPool.hugePages) {
+        int err = posix_memalign(&dataBlock, HUGEPAGESIZE, BUFFSIZE);
+        if (err) {
+            LogError("posix_memalign() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(dataBlock, BUFFSIZE, MADV_HUGEPAGE);
+#endif
+    } else {
+        dataBlock = malloc(BUFFSIZE);
+        if (!dataBlock) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+    }
+    return (dataBlock_t *)dataBlock;
+
+}  // End of AllocDataBlock
+
 static dataBlock_t *NewDataBlock(void) {
-    dataBlock_t *dataBlock = malloc(BUFFSIZE);
+    dataBlock_t *dataBlock = NULL;
+
+    // reuse a free block of the pool
+    pthread_mutex_lock(&blockPool.lock);
+    if (blockPool.numFree) dataBlock = blockPool.freeList[--blockPool.numFree];
+    pthread_mutex_unlock(&blockPool.lock);
+
     if (!dataBlock) {
-        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-        return NULL;
+        dataBlock = AllocDataBlock();
+        if (!dataBlock) return NULL;
     }
     InitDataBlock(dataBlock);
     atomic_fetch_add(&blocksInUse, 1);
@@ -552,11 +913,218 @@ static dataBlock_t *NewDataBlock(void) {
 static void FreeDataBlock(dataBlock_t *dataBlock) {
     // Release block
     if (dataBlock) {
-        free((void *)dataBlock);
+        // keep the block in the pool for reuse, if there is space
+        pthread_mutex_lock(&blockPool.lock);
+        if (blockPool.numFree < BLOCKPOOLSIZE) {
+            blockPool.freeList[blockPool.numFree++] = dataBlock;
+            dataBlock = NULL;
+        }
+        pthread_mutex_unlock(&blockPool.lock);
+
+        if (dataBlock) free((void *)dataBlock);
         atomic_fetch_sub(&blocksInUse, 1);
     }
 }  // End of FreeDataBlock
 
+// map the data blocks of a file opened for reading into memory. nfread() then reads data
+// blocks from the mapping instead of calling read(). Accessing a mapping beyond the end of
+// a truncated file raises SIGBUS, therefore only closed files are mapped - files without
+// appendix may still be written - and the mapping ends at the appendix, which is truncated,
+// if data is appended to the file. The appendix and files not mapped are read by read()
+static void MapFile(nffile_t *nffile) {
+    nffile->mapAddr = NULL;
+
+    off_t mapSize = nffile->file_header->offAppendix;
+    if (nffile->file_header->appendixBlocks == 0 || mapSize == 0) return;
+
+    struct stat stat_buf;
+    if (fstat(nffile->fd, &stat_buf) < 0 || !S_ISREG(stat_buf.st_mode) || stat_buf.st_size < mapSize) return;
+
+    off_t offset = lseek(nffile->fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= mapSize) return;
+
+    // private writable mapping - consumers may modify records in place
+    void *mapAddr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, nffile->fd, 0);
+    if (mapAddr == MAP_FAILED) {
+        dbg_printf("mmap() failed: %s - use read()\n", strerror(errno));
+        return;
+    }
+    // read() continues with the appendix after the mapped data blocks
+    if (lseek(nffile->fd, mapSize, SEEK_SET) < 0) {
+        munmap(mapAddr, mapSize);
+        return;
+    }
+    madvise(mapAddr, mapSize, MADV_SEQUENTIAL);
+
+    if (!AddMapping(mapAddr, mapSize)) {
+        munmap(mapAddr, mapSize);
+        lseek(nffile->fd, offset, SEEK_SET);
+        return;
+    }
+
+    nffile->mapAddr = mapAddr;
+    nffile->mapSize = mapSize;
+    nffile->mapOffset = offset;
+
+}  // End of MapFile
+
+// register a new mapping with the reference of its file
+static int AddMapping(void *addr, size_t size) {
+    fileMap_t *fileMap = malloc(sizeof(fileMap_t));
+    if (!fileMap) return 0;
+    *fileMap = (fileMap_t){.addr = addr, .size = size, .refCount = 1};
+
+    pthread_mutex_lock(&fileMaps.lock);
+    fileMap->next = fileMaps.list;
+    fileMaps.list = fileMap;
+    pthread_mutex_unlock(&fileMaps.lock);
+    return 1;
+
+}  // End of AddMapping
+
+// add a reference to the mapping, which contains ptr
+static void RetainMapping(void *ptr) {
+    pthread_mutex_lock(&fileMaps.lock);
+    for (fileMap_t *fileMap = fileMaps.list; fileMap; fileMap = fileMap->next) {
+        if (ptr >= fileMap->addr && ptr < (fileMap->addr + fileMap->size)) {
+            fileMap->refCount++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fileMaps.lock);
+
+}  // End of RetainMapping
+
+// release a reference to the mapping, which contains ptr. The last reference unmaps the file
+// returns 0, if ptr is not in any mapping
+static int ReleaseMapping(void *ptr) {
+    fileMap_t *fileMap = NULL;
+    pthread_mutex_lock(&fileMaps.lock);
+    for (fileMap_t **prev = &fileMaps.list; *prev; prev = &(*prev)->next) {
+        if (ptr >= (*prev)->addr && ptr < ((*prev)->addr + (*prev)->size)) {
+            fileMap = *prev;
+            if (--fileMap->refCount == 0) {
+                *prev = fileMap->next;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fileMaps.lock);
+
+    if (fileMap == NULL) return 0;
+    if (fileMap->refCount == 0) {
+        munmap(fileMap->addr, fileMap->size);
+        free(fileMap);
+    }
+    return 1;
+
+}  // End of ReleaseMapping
+
+static void UnmapFile(nffile_t *nffile) {
+    if (nffile->mapAddr) {
+        ReleaseMapping(nffile->mapAddr);
+        nffile->mapAddr = NULL;
+        nffile->mapSize = 0;
+        nffile->mapOffset = 0;
+    }
+}  // End of UnmapFile
+
+// returns true, if dataBlock points into the file mapping
+#define IsMappedBlock(nffile, dataBlock) \
+    ((nffile)->mapAddr && (void *)(dataBlock) >= (nffile)->mapAddr && (void *)(dataBlock) < ((nffile)->mapAddr + (nffile)->mapSize))
+
+// release a data block of a file. Blocks in the file mapping are not freed
+static void ReleaseBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
+    if (!IsMappedBlock(nffile, dataBlock)) FreeDataBlock(dataBlock);
+}  // End of ReleaseBlock
+
+// return a data block, which is independant of the file mapping. Required, if a data block
+// is handed over to another nffile
+static dataBlock_t *DetachBlock(nffile_t *nffile, dataBlock_t *dataBlock) {
+    if (!IsMappedBlock(nffile, dataBlock)) return dataBlock;
+
+    dataBlock_t *block_header = NewDataBlock();
+    if (block_header) memcpy((void *)block_header, (void *)dataBlock, sizeof(dataBlock_t) + dataBlock->size);
+    return block_header;
+}  // End of DetachBlock
+
+// process the internal records of an autoread block - appendix and dictionary blocks
+static int ReadAutoBlock(nffile_t *nffile, dataBlock_t *block_header) {
+    size_t processed = 0;
+    void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+
+    for (int j = 0; j < block_header->NumRecords; j++) {
+        record_header_t *record_header = (record_header_t *)buff_ptr;
+        void *data = (void *)record_header + sizeof(record_header_t);
+        uint16_t dataSize = record_header->size - sizeof(record_header_t);
+        dbg_printf("appendix record: %u - type: %u, size: %u\n", j, record_header->type, record_header->size);
+        switch (record_header->type) {
+            case TYPE_IDENT:
+                dbg_printf("Read ident from appendix block\n");
+                if (nffile->ident) free(nffile->ident);
+                if (record_header->size < IDENTLEN) {
+                    nffile->ident = strdup(data);
+                } else {
+                    nffile->ident = NULL;
+                    LogError("Error processing appendix ident record");
+                }
+                break;
+            case TYPE_STAT:
+                dbg_printf("Read stat record from appendix block\n");
+                if (dataSize == sizeof(stat_record_t)) {
+                    memcpy(nffile->stat_record, data, sizeof(stat_record_t));
+                } else {
+                    LogError("Error processing appendix stat record");
+                }
+                break;
+            case TYPE_BLOCKINDEX: {
+                arrayRecordHeader_t *arrayHeader = (arrayRecordHeader_t *)record_header;
+                dbg_printf("Read block index from appendix block: %u entries\n", arrayHeader->numElements);
+                if (arrayHeader->elementSize != sizeof(blockIndex_t) ||
+                    (sizeof(arrayRecordHeader_t) + arrayHeader->numElements * sizeof(blockIndex_t)) > record_header->size) {
+                    LogError("Error processing appendix block index record");
+                    break;
+                }
+                void *entry = (void *)arrayHeader + sizeof(arrayRecordHeader_t);
+                for (int k = 0; k < arrayHeader->numElements; k++) {
+                    blockIndex_t blockIndex;
+                    memcpy((void *)&blockIndex, entry + k * sizeof(blockIndex_t), sizeof(blockIndex_t));
+                    if (!AddBlockIndex(nffile, &blockIndex)) break;
+                }
+            } break;
+            case TYPE_ZSTDDICT: {
+                arrayRecordHeader_t *arrayHeader = (arrayRecordHeader_t *)record_header;
+                dbg_printf("Read ZSTD dictionary chunk from dictionary block: %u bytes\n", arrayHeader->numElements);
+                uint32_t dictSize = nffile->zstdDictSize + arrayHeader->numElements;
+                if (arrayHeader->elementSize != 1 || (sizeof(arrayRecordHeader_t) + arrayHeader->numElements) > record_header->size ||
+                    dictSize > MAXDICTSIZE) {
+                    LogError("Error processing ZSTD dictionary record");
+                    break;
+                }
+                void *dict = realloc(nffile->zstdDict, dictSize);
+                if (!dict) {
+                    LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                    break;
+                }
+                memcpy(dict + nffile->zstdDictSize, (void *)arrayHeader + sizeof(arrayRecordHeader_t), arrayHeader->numElements);
+                nffile->zstdDict = dict;
+                nffile->zstdDictSize = dictSize;
+            } break;
+            default:
+                LogError("Error process appendix record type: %u", record_header->type);
+        }
+        processed += record_header->size;
+        buff_ptr += record_header->size;
+        if (processed > block_header->size) {
+            LogError("Error processing appendix records: processed %u > block size %u", processed, block_header->size);
+            return 0;
+        }
+    }
+
+    return 1;
+
+}  // End of ReadAutoBlock
+
 static int ReadAppendix(nffile_t *nffile) {
     dbg_printf("Process appendix ..\n");
     off_t currentPos = lseek(nffile->fd, 0, SEEK_CUR);
@@ -573,51 +1141,21 @@ static int ReadAppendix(nffile_t *nffile) {
 
     dbg_printf("Num of appendix records: %u\n", nffile->file_header->appendixBlocks);
     for (int i = 0; i < nffile->file_header->appendixBlocks; i++) {
-        size_t processed = 0;
         dataBlock_t *block_header = nfread(nffile);
         if (!block_header) {
             LogError("Unable to read appendix block of file: %s", nffile->fileName);
             lseek(nffile->fd, currentPos, SEEK_SET);
             return 0;
         }
-        void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
-
-        for (int j = 0; j < block_header->NumRecords; j++) {
-            record_header_t *record_header = (record_header_t *)buff_ptr;
-            void *data = (void *)record_header + sizeof(record_header_t);
-            uint16_t dataSize = record_header->size - sizeof(record_header_t);
-            dbg_printf("appendix record: %u - type: %u, size: %u\n", j, record_header->type, record_header->size);
-            switch (record_header->type) {
-                case TYPE_IDENT:
-                    dbg_printf("Read ident from appendix block\n");
-                    if (nffile->ident) free(nffile->ident);
-                    if (record_header->size < IDENTLEN) {
-                        nffile->ident = strdup(data);
-                    } else {
-                        nffile->ident = NULL;
-                        LogError("Error processing appendix ident record");
-                    }
-                    break;
-                case TYPE_STAT:
-                    dbg_printf("Read stat record from appendix block\n");
-                    if (dataSize == sizeof(stat_record_t)) {
-                        memcpy(nffile->stat_record, data, sizeof(stat_record_t));
-                    } else {
-                        LogError("Error processing appendix stat record");
-                    }
-                    break;
-                default:
-                    LogError("Error process appendix record type: %u", record_header->type);
-            }
-            processed += record_header->size;
-            buff_ptr += record_header->size;
-            if (processed > block_header->size) {
-                LogError("Error processing appendix records: processed %u > block size %u", processed, block_header->size);
-                FreeDataBlock(block_header);
-                return 0;
-            }
-        }
+        int ok = ReadAutoBlock(nffile, block_header);
         FreeDataBlock(block_header);
+        if (!ok) return 0;
+    }
+
+    // an index is only valid, if it covers all data blocks
+    if (nffile->numIndex && nffile->numIndex != nffile->file_header->NumBlocks) {
+        LogError("Block index size %u does not match number of data blocks %u - ignore index", nffile->numIndex, nffile->file_header->NumBlocks);
+        nffile->numIndex = 0;
     }
 
     // seek back to currentPos
@@ -631,6 +1169,9 @@ static int ReadAppendix(nffile_t *nffile) {
 
 }  // End of ReadAppendix
 
+_Static_assert(sizeof(arrayRecordHeader_t) + MAXINDEXENTRIES * sizeof(blockIndex_t) <= UINT16_MAX,
+               "block index record exceeds max record size");
+
 // Write appendix - assume current file pos is end of data blocks
 static int WriteAppendix(nffile_t *nffile) {
     dbg_printf("Write Appendix\n");
@@ -649,6 +1190,7 @@ static int WriteAppendix(nffile_t *nffile) {
     if (nffile->ident == NULL) nffile->ident = strdup("none");
 
     dataBlock_t *block_header = NewDataBlock();
+    block_header->flags = FLAG_BLOCK_AUTOREAD;
     void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
 
     // write ident
@@ -675,6 +1217,34 @@ static int WriteAppendix(nffile_t *nffile) {
     block_header->size += recordHeader->size;
     buff_ptr += recordHeader->size;
 
+    // write block index, if it covers all data blocks
+    if (nffile->numIndex && nffile->numIndex == nffile->file_header->NumBlocks) {
+        dbg_printf("Write block index: %u entries\n", nffile->numIndex);
+        for (uint32_t i = 0; i < nffile->numIndex; i += MAXINDEXENTRIES) {
+            uint32_t numEntries = nffile->numIndex - i;
+            if (numEntries > MAXINDEXENTRIES) numEntries = MAXINDEXENTRIES;
+            size_t recordSize = sizeof(arrayRecordHeader_t) + numEntries * sizeof(blockIndex_t);
+
+            // flush appendix block, if full
+            if ((block_header->size + recordSize) > WRITE_BUFFSIZE) {
+                nfwrite(nffile, block_header);
+                InitDataBlock(block_header);
+                block_header->flags = FLAG_BLOCK_AUTOREAD;
+                buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+                nffile->file_header->appendixBlocks++;
+            }
+
+            AddArrayHeader(buff_ptr, arrayHeader, TYPE_BLOCKINDEX, sizeof(blockIndex_t));
+            arrayHeader->numElements = numEntries;
+            arrayHeader->size = recordSize;
+            memcpy(buff_ptr + sizeof(arrayRecordHeader_t), &nffile->blockIndex[i], numEntries * sizeof(blockIndex_t));
+
+            block_header->NumRecords++;
+            block_header->size += arrayHeader->size;
+            buff_ptr += arrayHeader->size;
+        }
+    }
+
     nfwrite(nffile, block_header);
     FreeDataBlock(block_header);
 
@@ -682,6 +1252,217 @@ static int WriteAppendix(nffile_t *nffile) {
 
 }  // End of WriteAppendix
 
+// read the dictionary blocks in front of the data blocks - assume current file pos is end of
+// file header. The file pos is left at the first data block
+static int ReadDictBlocks(nffile_t *nffile) {
+    off_t offset = lseek(nffile->fd, 0, SEEK_CUR);
+    if (offset < 0) {
+        LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    // data blocks are never autoread blocks
+    dataBlock_t blockHeader;
+    while (pread(nffile->fd, (void *)&blockHeader, sizeof(dataBlock_t), offset) == sizeof(dataBlock_t) &&
+           TestFlag(blockHeader.flags, FLAG_BLOCK_AUTOREAD)) {
+        dataBlock_t *block_header = nfread(nffile);
+        if (!block_header) {
+            LogError("Unable to read dictionary block of file: %s", nffile->fileName);
+            return 0;
+        }
+        int ok = ReadAutoBlock(nffile, block_header);
+        FreeDataBlock(block_header);
+        if (!ok) return 0;
+
+        offset = lseek(nffile->fd, 0, SEEK_CUR);
+        if (offset < 0) {
+            LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+    }
+
+    // data blocks compressed with the dictionary fail to uncompress without
+    if (nffile->zstdDict && nffile->file_header->compression == ZSTD_COMPRESSED) {
+        return InitDecompressDictionary(nffile);
+    }
+    return 1;
+
+}  // End of ReadDictBlocks
+
+// write the ZSTD dictionary of the file in front of the data blocks - assume current file pos
+// is end of file header. The blocks are written uncompressed, before the nfwriter threads start
+static int WriteDictBlocks(nffile_t *nffile) {
+    dbg_printf("Write ZSTD dictionary: %u bytes\n", nffile->zstdDictSize);
+    dataBlock_t *block_header = NewDataBlock();
+    if (!block_header) return 0;
+    block_header->flags = FLAG_BLOCK_AUTOREAD | FLAG_BLOCK_UNCOMPRESSED;
+    void *buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+
+    for (uint32_t i = 0; i < nffile->zstdDictSize; i += MAXDICTCHUNK) {
+        uint32_t chunkSize = nffile->zstdDictSize - i;
+        if (chunkSize > MAXDICTCHUNK) chunkSize = MAXDICTCHUNK;
+        size_t recordSize = sizeof(arrayRecordHeader_t) + chunkSize;
+
+        AddArrayHeader(buff_ptr, arrayHeader, TYPE_ZSTDDICT, 1);
+        arrayHeader->numElements = chunkSize;
+        arrayHeader->size = recordSize;
+        memcpy(buff_ptr + sizeof(arrayRecordHeader_t), nffile->zstdDict + i, chunkSize);
+
+        block_header->NumRecords++;
+        block_header->size += arrayHeader->size;
+        buff_ptr += arrayHeader->size;
+
+        // flush dictionary block, if full or done
+        uint32_t next = i + MAXDICTCHUNK;
+        if (next >= nffile->zstdDictSize || (block_header->size + sizeof(arrayRecordHeader_t) + MAXDICTCHUNK) > WRITE_BUFFSIZE) {
+            if (write(nffile->fd, (void *)block_header, sizeof(dataBlock_t) + block_header->size) < 0) {
+                LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                FreeDataBlock(block_header);
+                return 0;
+            }
+            InitDataBlock(block_header);
+            block_header->flags = FLAG_BLOCK_AUTOREAD | FLAG_BLOCK_UNCOMPRESSED;
+            buff_ptr = (void *)((void *)block_header + sizeof(dataBlock_t));
+        }
+    }
+    FreeDataBlock(block_header);
+
+    return 1;
+
+}  // End of WriteDictBlocks
+
+// update min/max zone map of an element
+#define UpdateRange(min, max, val)    \
+    if ((val) < (min)) (min) = (val); \
+    if ((val) > (max)) (max) = (val);
+
+// summarise a data block for the block index
+static void ScanBlock(dataBlock_t *block_header, blockIndex_t *blockIndex) {
+    *blockIndex = (blockIndex_t){
+        .msecFirstMin = UINT64_MAX,
+        .msecLastMin = UINT64_MAX,
+        .NumRecords = block_header->NumRecords,
+        .src4AddrMin = UINT32_MAX,
+        .dst4AddrMin = UINT32_MAX,
+        .srcPortMin = UINT16_MAX,
+        .dstPortMin = UINT16_MAX,
+        .exporterIDMin = UINT16_MAX,
+        .protoMin = UINT8_MAX,
+    };
+
+    // only blocks with V3 records are indexed
+    if (block_header->type != DATA_BLOCK_TYPE_3) {
+        blockIndex->flags = INDEX_NOSKIP;
+        return;
+    }
+
+    recordHeader_t *recordHeader = (recordHeader_t *)((void *)block_header + sizeof(dataBlock_t));
+    uint32_t sumSize = 0;
+    for (int i = 0; i < block_header->NumRecords; i++) {
+        if ((sumSize + recordHeader->size) > block_header->size || recordHeader->size < sizeof(recordHeader_t)) {
+            // inconsistent block - never skip
+            blockIndex->flags = INDEX_NOSKIP;
+            return;
+        }
+        sumSize += recordHeader->size;
+
+        if (recordHeader->type != V3Record) {
+            // exporter, sampler and other info records must always be processed
+            blockIndex->flags |= INDEX_NOSKIP;
+            recordHeader = (recordHeader_t *)((void *)recordHeader + recordHeader->size);
+            continue;
+        }
+
+        recordHeaderV3_t *recordHeaderV3 = (recordHeaderV3_t *)recordHeader;
+        void *recordEnd = (void *)recordHeader + recordHeader->size;
+        UpdateRange(blockIndex->exporterIDMin, blockIndex->exporterIDMax, recordHeaderV3->exporterID);
+        EXgenericFlow_t *genericFlow = NULL;
+        uint64_t nselEvent = 0;
+        uint64_t nelEvent = 0;
+        elementHeader_t *elementHeader = (elementHeader_t *)((void *)recordHeaderV3 + sizeof(recordHeaderV3_t));
+        for (int j = 0; j < recordHeaderV3->numElements; j++) {
+            if (elementHeader->length == 0 || ((void *)elementHeader + elementHeader->length) > recordEnd) break;
+            void *element = (void *)elementHeader + sizeof(elementHeader_t);
+            switch (elementHeader->type) {
+                case EXgenericFlowID:
+                    genericFlow = (EXgenericFlow_t *)element;
+                    UpdateRange(blockIndex->srcPortMin, blockIndex->srcPortMax, genericFlow->srcPort);
+                    UpdateRange(blockIndex->dstPortMin, blockIndex->dstPortMax, genericFlow->dstPort);
+                    UpdateRange(blockIndex->protoMin, blockIndex->protoMax, genericFlow->proto);
+                    break;
+                case EXipv4FlowID: {
+                    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)element;
+                    UpdateRange(blockIndex->src4AddrMin, blockIndex->src4AddrMax, ipv4Flow->srcAddr);
+                    UpdateRange(blockIndex->dst4AddrMin, blockIndex->dst4AddrMax, ipv4Flow->dstAddr);
+                } break;
+                case EXnselCommonID:
+                    nselEvent = ((EXnselCommon_t *)element)->msecEvent;
+                    break;
+                case EXnelCommonID:
+                    nelEvent = ((EXnelCommon_t *)element)->msecEvent;
+                    break;
+            }
+            elementHeader = (elementHeader_t *)((void *)elementHeader + elementHeader->length);
+        }
+        recordHeader = (recordHeader_t *)recordEnd;
+
+        // records without generic flow never match a time window
+        if (genericFlow == NULL) continue;
+
+        // same as MapRecordHandle(): events without msecFirst use event time
+        uint64_t msecFirst = genericFlow->msecFirst;
+        if (msecFirst == 0) msecFirst = nselEvent ? nselEvent : nelEvent;
+        uint64_t msecLast = genericFlow->msecLast;
+
+        if (msecFirst < blockIndex->msecFirstMin) blockIndex->msecFirstMin = msecFirst;
+        if (msecFirst > blockIndex->msecFirstMax) blockIndex->msecFirstMax = msecFirst;
+        if (msecLast < blockIndex->msecLastMin) blockIndex->msecLastMin = msecLast;
+        if (msecLast > blockIndex->msecLastMax) blockIndex->msecLastMax = msecLast;
+
+        switch (genericFlow->proto) {
+            case IPPROTO_TCP:
+                blockIndex->numTCP++;
+                break;
+            case IPPROTO_UDP:
+                blockIndex->numUDP++;
+                break;
+            case IPPROTO_ICMP:
+            case IPPROTO_ICMPV6:
+                blockIndex->numICMP++;
+                break;
+            default:
+                blockIndex->numOther++;
+        }
+    }
+
+}  // End of ScanBlock
+
+// append an entry to the block index of nffile
+static int AddBlockIndex(nffile_t *nffile, blockIndex_t *blockIndex) {
+    if (nffile->numIndex == nffile->indexSize) {
+        uint32_t indexSize = nffile->indexSize ? 2 * nffile->indexSize : 256;
+        blockIndex_t *p = realloc(nffile->blockIndex, indexSize * sizeof(blockIndex_t));
+        if (!p) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        nffile->blockIndex = p;
+        nffile->indexSize = indexSize;
+    }
+    nffile->blockIndex[nffile->numIndex++] = *blockIndex;
+    return 1;
+
+}  // End of AddBlockIndex
+
+// returns 1, if the block can not contain any record within the query time window
+// or any record matching the query filter
+static inline int SkipBlock(blockIndex_t *blockIndex) {
+    if (blockIndex->flags & INDEX_NOSKIP) return 0;
+    if (indexMsecLast && (blockIndex->msecFirstMax <= indexMsecFirst || blockIndex->msecLastMin >= indexMsecLast)) return 1;
+    if (indexFilter && !FilterBlock(indexFilter, blockIndex)) return 1;
+    return 0;
+}  // End of SkipBlock
+
 static nffile_t *NewFile(nffile_t *nffile) {
     // Create struct
     if (!nffile) {
@@ -712,6 +1493,13 @@ static nffile_t *NewFile(nffile_t *nffile) {
         if (!nffile->processQueue) {
             return NULL;
         }
+
+        nffile->blockQueue = queue_init(BlockQueueSize);
+        if (!nffile->blockQueue) {
+            return NULL;
+        }
+        pthread_mutex_init(&nffile->sequenceLock, NULL);
+        pthread_cond_init(&nffile->sequenceCond, NULL);
     }
 
     memset((void *)nffile->file_header, 0, sizeof(fileHeaderV2_t));
@@ -721,6 +1509,9 @@ static nffile_t *NewFile(nffile_t *nffile) {
     nffile->buff_ptr = NULL;
     nffile->fd = 0;
     nffile->compat16 = 0;
+    nffile->encode = 0;
+    nffile->column = 0;
+    nffile->adaptive = 0;
 
     if (nffile->fileName) {
         free(nffile->fileName);
@@ -730,11 +1521,13 @@ static nffile_t *NewFile(nffile_t *nffile) {
         free(nffile->ident);
         nffile->ident = NULL;
     }
+    FreeFileDictionary(nffile);
     memset((void *)nffile->stat_record, 0, sizeof(stat_record_t));
     nffile->stat_record->firstseen = 0x7fffffffffffffff;
 
     nffile->block_header = NULL;
     nffile->buff_ptr = NULL;
+    nffile->numIndex = 0;
 
     for (int i = 0; i < MAXWORKERS; i++) nffile->worker[i] = 0;
     atomic_store(&nffile->terminate, 0);
@@ -797,7 +1590,7 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
         return NULL;
     }
 
-    if (nffile->file_header->version != LAYOUT_VERSION_2) {
+    if (nffile->file_header->version != LAYOUT_VERSION_2 && nffile->file_header->version != LAYOUT_VERSION_3) {
         if (nffile->file_header->version == LAYOUT_VERSION_1) {
             dbg_printf("Found layout type 1 => convert\n");
             // transparent read old v1 layout
@@ -886,6 +1679,13 @@ static nffile_t *OpenFileStatic(char *filename, nffile_t *nffile) {
     }
 #endif
 
+    // layout 3 files may have a dictionary in front of the data blocks
+    if (nffile->file_header->version == LAYOUT_VERSION_3 && !ReadDictBlocks(nffile)) {
+        LogError("Open file %s: dictionary error", filename);
+        CloseFile(nffile);
+        return NULL;
+    }
+
     if (nffile->file_header->appendixBlocks) {
         if (nffile->file_header->offAppendix < stat_buf.st_size) {
             ReadAppendix(nffile);
@@ -906,11 +1706,27 @@ nffile_t *OpenFile(char *filename, nffile_t *nffile) {
         return NULL;
     }
 
+    // nfreader reads from the file mapping, if available
+    MapFile(nffile);
+
+    return StartReader(nffile);
+
+}  // End of OpenFile
+
+// start nfreader and the uncompress workers of a file opened by OpenFileStatic()
+static nffile_t *StartReader(nffile_t *nffile) {
     // kick off nfreader
     // there is only 1 reader thread -> slot 0
     pthread_t tid;
     atomic_store(&nffile->terminate, 0);
     queue_open(nffile->processQueue);
+
+    // compressed files are uncompressed by the remaining workers in parallel
+    nffile->numUncompress = nffile->file_header->compression != NOT_COMPRESSED ? NumWorkers - 1 : 0;
+    nffile->nextSequence = 0;
+    atomic_store(&nffile->activeUncompress, nffile->numUncompress);
+    queue_open(nffile->blockQueue);
+
     int err = pthread_create(&tid, NULL, nfreader, (void *)nffile);
     if (err) {
         nffile->worker[0] = 0;
@@ -918,9 +1734,19 @@ nffile_t *OpenFile(char *filename, nffile_t *nffile) {
         return NULL;
     }
     nffile->worker[0] = tid;
+
+    for (unsigned i = 1; i <= nffile->numUncompress; i++) {
+        err = pthread_create(&tid, NULL, nfuncompressor, (void *)nffile);
+        if (err) {
+            nffile->worker[i] = 0;
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return NULL;
+        }
+        nffile->worker[i] = tid;
+    }
     return nffile;
 
-}  // End of OpenFile
+}  // End of StartReader
 
 // Create a new nffile
 //  filename   : full path of file to create
@@ -937,7 +1763,7 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
     }
 
 #ifndef HAVE_ZSTD
-    if ((compress & 0xFFFF) == ZSTD_COMPRESSED) {
+    if ((compress & 0xFF) == ZSTD_COMPRESSED) {
         LogError("Open file %s: ZSTD compression not compiled in");
         CloseFile(nffile);
         return NULL;
@@ -945,7 +1771,7 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
 #endif
 
 #ifndef HAVE_BZIP2
-    if ((compress & 0xFFFF) == BZ2_COMPRESSED) {
+    if ((compress & 0xFF) == BZ2_COMPRESSED) {
         LogError("Open file %s: BZIP2 compression not compiled in");
         CloseFile(nffile);
         return NULL;
@@ -971,11 +1797,36 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
     nffile->file_header->version = LAYOUT_VERSION_2;
     nffile->file_header->nfdversion = NFDVERSION;
     nffile->file_header->created = time(NULL);
-    nffile->file_header->compression = compress & 0xFFFF;
+    nffile->file_header->compression = compress & 0xFF;
     nffile->compression_level = (compress >> 16) & 0xFFFF;
+    nffile->encode = (compress & COMPRESSION_DELTA) != 0;
+    nffile->column = (compress & COMPRESSION_COLUMN) != 0;
+    nffile->adaptive = (compress & COMPRESSION_ADAPTIVE) != 0;
+    // older nfdump versions must not read encoded blocks as plain records
+    // nor uncompress adaptive blocks with the compression of the file
+    if (nffile->encode || nffile->column || nffile->adaptive) nffile->file_header->version = LAYOUT_VERSION_3;
     nffile->file_header->encryption = encryption;
     nffile->file_header->creator = creator;
 
+    if (nffile->file_header->compression == ZSTD_COMPRESSED && zstdDict) {
+        nffile->zstdDict = malloc(zstdDictSize);
+        if (!nffile->zstdDict) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            close(nffile->fd);
+            nffile->fd = 0;
+            return NULL;
+        }
+        memcpy(nffile->zstdDict, zstdDict, zstdDictSize);
+        nffile->zstdDictSize = zstdDictSize;
+        if (!InitCompressDictionary(nffile)) {
+            close(nffile->fd);
+            nffile->fd = 0;
+            return NULL;
+        }
+        // older nfdump versions can not uncompress blocks compressed with a dictionary
+        nffile->file_header->version = LAYOUT_VERSION_3;
+    }
+
     if (write(nffile->fd, (void *)nffile->file_header, sizeof(fileHeaderV2_t)) < sizeof(fileHeaderV2_t)) {
         LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         close(nffile->fd);
@@ -983,6 +1834,14 @@ nffile_t *OpenNewFile(char *filename, nffile_t *nffile, int creator, int compres
         return NULL;
     }
 
+    // the dictionary is written in front of the data blocks, so the blocks are readable
+    // while the file is still written or if it is never closed properly
+    if (nffile->zstdDict && !WriteDictBlocks(nffile)) {
+        close(nffile->fd);
+        nffile->fd = 0;
+        return NULL;
+    }
+
     // prepare buffer to write to
     nffile->block_header = NewDataBlock();
     nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(dataBlock_t));
@@ -1049,6 +1908,12 @@ nffile_t *AppendFile(char *filename) {
     // appending needs no block header
     nffile->block_header = NULL;
 
+    // new blocks are compressed with the dictionary of the file
+    if (nffile->zstdDict && nffile->file_header->compression == ZSTD_COMPRESSED && !InitCompressDictionary(nffile)) {
+        DisposeFile(nffile);
+        return NULL;
+    }
+
     // kick off NumWorkers nfwriter threads
     atomic_store(&nffile->terminate, 0);
     queue_open(nffile->processQueue);
@@ -1087,7 +1952,8 @@ int RenameAppend(char *oldName, char *newName) {
                 dataBlock_t *block_header = queue_pop(nffile_r->processQueue);
                 if (block_header == QUEUE_CLOSED)  // EOF
                     break;
-                queue_push(nffile_w->processQueue, block_header);
+                block_header = DetachBlock(nffile_r, block_header);
+                if (block_header) queue_push(nffile_w->processQueue, block_header);
             }
             CloseFile(nffile_r);
 
@@ -1162,15 +2028,31 @@ void CloseFile(nffile_t *nffile) {
         free(nffile->ident);
         nffile->ident = NULL;
     }
+    FreeFileDictionary(nffile);
 
     // clean queue
     queue_close(nffile->processQueue);
     while (queue_length(nffile->processQueue)) {
         dataBlock_t *block_header = queue_pop(nffile->processQueue);
-        FreeDataBlock(block_header);
+        ReleaseBlock(nffile, block_header);
+    }
+    queue_close(nffile->blockQueue);
+    while (queue_length(nffile->blockQueue)) {
+        readJob_t *job = queue_pop(nffile->blockQueue);
+        ReleaseBlock(nffile, job->buff);
+        free(job);
+    }
+    nffile->numUncompress = 0;
+
+    // the current block may still point into the mapping
+    if (IsMappedBlock(nffile, nffile->block_header)) {
+        nffile->block_header = NULL;
+        nffile->buff_ptr = NULL;
     }
+    UnmapFile(nffile);
 
     nffile->file_header->NumBlocks = 0;
+    nffile->numIndex = 0;
 }  // End of CloseFile
 
 int CloseUpdateFile(nffile_t *nffile) {
@@ -1218,6 +2100,8 @@ void DisposeFile(nffile_t *nffile) {
     if (nffile->stat_record) free(nffile->stat_record);
     if (nffile->ident) free(nffile->ident);
     if (nffile->fileName) free(nffile->fileName);
+    if (nffile->blockIndex) free(nffile->blockIndex);
+    FreeFileDictionary(nffile);
 
     for (size_t queueLen = queue_length(nffile->processQueue); queueLen > 0; queueLen--) {
         void *p = queue_pop(nffile->processQueue);
@@ -1225,10 +2109,109 @@ void DisposeFile(nffile_t *nffile) {
     }
 
     queue_free(nffile->processQueue);
+    queue_close(nffile->blockQueue);
+    queue_free(nffile->blockQueue);
+    pthread_mutex_destroy(&nffile->sequenceLock);
+    pthread_cond_destroy(&nffile->sequenceCond);
     free(nffile);
 
 }  // End of DisposeFile
 
+// open the files of fileQueue in order ahead of processing. The next PrefetchSize
+// files are opened, their header and appendix are read and reading of the first
+// data blocks is started, while the current file is being processed
+__attribute__((noreturn)) static void *nfprefetcher(void *arg) {
+    queue_t *prefetch = (queue_t *)arg;
+
+    /* disable signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    while (1) {
+        char *nextFile = queue_pop(fileQueue);
+        if (nextFile == QUEUE_CLOSED) break;
+        if (atomic_load(&prefetchStop)) {
+            free(nextFile);
+            continue;
+        }
+
+        dbg_printf("Prefetch: '%s'\n", nextFile);
+        nffile_t *nffile = NewFile(NULL);
+        if (nffile && OpenFileStatic(nextFile, nffile)) {
+            MapFile(nffile);
+            off_t offset = nffile->mapAddr ? (off_t)nffile->mapOffset : lseek(nffile->fd, 0, SEEK_CUR);
+            if (offset >= 0) ReadAhead(nffile, offset, READAHEAD_SIZE);
+        } else {
+            if (nffile) {
+                queue_close(nffile->processQueue);
+                DisposeFile(nffile);
+            }
+            nffile = PREFETCH_FAILED;
+        }
+        free(nextFile);
+
+        if (queue_push(prefetch, (void *)nffile) == QUEUE_CLOSED) {
+            if (nffile != PREFETCH_FAILED) {
+                CloseFile(nffile);
+                DisposeFile(nffile);
+            }
+            break;
+        }
+    }
+    queue_close(prefetch);
+
+    dbg_printf("nfprefetcher exit\n");
+    pthread_exit(NULL);
+
+}  // End of nfprefetcher
+
+// move an opened file from a prefetched handle into nffile
+static void MoveFile(nffile_t *nffile, nffile_t *prefetched) {
+    nffile->fd = prefetched->fd;
+    prefetched->fd = 0;
+    nffile->compat16 = prefetched->compat16;
+    nffile->compression_level = prefetched->compression_level;
+    memcpy((void *)nffile->file_header, (void *)prefetched->file_header, sizeof(fileHeaderV2_t));
+    memcpy((void *)nffile->stat_record, (void *)prefetched->stat_record, sizeof(stat_record_t));
+
+    if (nffile->fileName) free(nffile->fileName);
+    nffile->fileName = prefetched->fileName;
+    prefetched->fileName = NULL;
+
+    if (nffile->ident) free(nffile->ident);
+    nffile->ident = prefetched->ident;
+    prefetched->ident = NULL;
+
+    // swap block index buffers
+    blockIndex_t *blockIndex = nffile->blockIndex;
+    uint32_t indexSize = nffile->indexSize;
+    nffile->blockIndex = prefetched->blockIndex;
+    nffile->indexSize = prefetched->indexSize;
+    nffile->numIndex = prefetched->numIndex;
+    prefetched->blockIndex = blockIndex;
+    prefetched->indexSize = indexSize;
+    prefetched->numIndex = 0;
+
+    nffile->mapAddr = prefetched->mapAddr;
+    nffile->mapSize = prefetched->mapSize;
+    nffile->mapOffset = prefetched->mapOffset;
+    prefetched->mapAddr = NULL;
+
+    FreeFileDictionary(nffile);
+    nffile->zstdDict = prefetched->zstdDict;
+    nffile->zstdDictSize = prefetched->zstdDictSize;
+    nffile->zstdCDict = prefetched->zstdCDict;
+    nffile->zstdDDict = prefetched->zstdDDict;
+    prefetched->zstdDict = NULL;
+    prefetched->zstdCDict = NULL;
+    prefetched->zstdDDict = NULL;
+
+    queue_close(prefetched->processQueue);
+    DisposeFile(prefetched);
+
+}  // End of MoveFile
+
 nffile_t *GetNextFile(nffile_t *nffile) {
     // close current file before open the next one
     // stdin ( current = 0 ) is not closed
@@ -1243,26 +2226,61 @@ nffile_t *GetNextFile(nffile_t *nffile) {
         return NULL;
     }
 
-    while (1) {
-        char *nextFile = queue_pop(fileQueue);
-        if (nextFile == QUEUE_CLOSED) {
-            // no or no more files available
-            return EMPTY_LIST;
+    // start prefetching files on first call
+    if (!prefetchQueue) {
+        prefetchQueue = queue_init(PrefetchSize);
+        if (!prefetchQueue) return NULL;
+        atomic_store(&prefetchStop, 0);
+        int err = pthread_create(&prefetchTid, NULL, nfprefetcher, (void *)prefetchQueue);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            queue_free(prefetchQueue);
+            prefetchQueue = NULL;
+            return NULL;
         }
+    }
 
-        dbg_printf("Process: '%s'\n", nextFile);
-        nffile = OpenFile(nextFile, nffile);  // Open the file
-        free(nextFile);
-        return nffile;
+    nffile_t *prefetched = queue_pop(prefetchQueue);
+    if (prefetched == QUEUE_CLOSED) {
+        // no or no more files available - the prefetcher has terminated
+        DisposePrefetcher();
+        return EMPTY_LIST;
+    }
+    if (prefetched == PREFETCH_FAILED) {
+        return NULL;
     }
 
-    /* NOTREACHED */
+    dbg_printf("Process: '%s'\n", prefetched->fileName);
+    MoveFile(nffile, prefetched);
+    return StartReader(nffile);
 
 }  // End of GetNextFile
 
+// stop the prefetcher thread, if running, and dispose the files opened ahead, which
+// are not processed. Called, when no more files are read from the file list
+void DisposePrefetcher(void) {
+    if (!prefetchQueue) return;
+
+    // the remaining files of the file list are skipped
+    atomic_store(&prefetchStop, 1);
+    queue_close(fileQueue);
+    queue_close(prefetchQueue);
+    pthread_join(prefetchTid, NULL);
+
+    nffile_t *nffile;
+    while ((nffile = queue_pop(prefetchQueue)) != QUEUE_CLOSED) {
+        if (nffile == PREFETCH_FAILED) continue;
+        CloseFile(nffile);
+        DisposeFile(nffile);
+    }
+    queue_free(prefetchQueue);
+    prefetchQueue = NULL;
+
+}  // End of DisposePrefetcher
+
 int ReadBlock(nffile_t *nffile) {
     if (nffile->block_header) {
-        FreeDataBlock(nffile->block_header);
+        ReleaseBlock(nffile, nffile->block_header);
         nffile->block_header = NULL;
     }
 
@@ -1280,8 +2298,126 @@ int ReadBlock(nffile_t *nffile) {
 
 }  // End of ReadBlock
 
-// generic read und uncompress a data block from current position
-static dataBlock_t *nfread(nffile_t *nffile) {
+// take over the data block of the last ReadBlock(). The caller owns the block and releases
+// it with ReleaseDataBlock(). Blocks of the file mapping are not copied, but hold a reference
+// to the mapping, which keeps the block valid, after the file is closed
+dataBlock_t *TakeBlock(nffile_t *nffile) {
+    dataBlock_t *dataBlock = nffile->block_header;
+    if (dataBlock && IsMappedBlock(nffile, dataBlock)) {
+        RetainMapping(dataBlock);
+        atomic_fetch_add(&fileMaps.numTaken, 1);
+    }
+    nffile->block_header = NULL;
+    nffile->buff_ptr = NULL;
+    return dataBlock;
+
+}  // End of TakeBlock
+
+// release a data block of TakeBlock()
+void ReleaseDataBlock(dataBlock_t *dataBlock) {
+    if (dataBlock == NULL) return;
+    if (atomic_load(&fileMaps.numTaken) && ReleaseMapping(dataBlock)) {
+        atomic_fetch_sub(&fileMaps.numTaken, 1);
+        return;
+    }
+    FreeDataBlock(dataBlock);
+}  // End of ReleaseDataBlock
+
+// advise the kernel to read a file range asynchronously into the page cache
+static void ReadAhead(nffile_t *nffile, off_t offset, size_t length) {
+    if (nffile->mapAddr) {
+        if (offset >= nffile->mapSize) return;
+        if ((offset + length) > nffile->mapSize) length = nffile->mapSize - offset;
+        // madvise() requires a page aligned address
+        size_t align = offset % pageSize;
+        madvise(nffile->mapAddr + offset - align, length + align, MADV_WILLNEED);
+    } else {
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(nffile->fd, offset, length, POSIX_FADV_WILLNEED);
+#endif
+    }
+}  // End of ReadAhead
+
+// return the compression of a data block - the file compression, unless the block
+// records its own compression
+static int BlockCompression(nffile_t *nffile, dataBlock_t *buff) {
+    if (TestFlag(buff->flags, FLAG_BLOCK_UNCOMPRESSED)) return NOT_COMPRESSED;
+    if (TestFlag(buff->flags, FLAG_BLOCK_COMPRESSION)) return BLOCK_COMPRESSION(buff);
+    return nffile->file_header->compression;
+}  // End of BlockCompression
+
+// uncompress a data block into a new data block according to the block compression
+static dataBlock_t *UncompressBlock(nffile_t *nffile, dataBlock_t *buff) {
+    dataBlock_t *block_header = NewDataBlock();
+    if (!block_header) return NULL;
+
+    int failed = 0;
+    int compression = BlockCompression(nffile, buff);
+    switch (compression) {
+        case LZO_COMPRESSED:
+            if (Uncompress_Block_LZO(buff, block_header, nffile->buff_size) < 0) failed = 1;
+            break;
+        case LZ4_COMPRESSED:
+            if (Uncompress_Block_LZ4(buff, block_header, nffile->buff_size) < 0) failed = 1;
+            break;
+        case BZ2_COMPRESSED:
+            if (Uncompress_Block_BZ2(buff, block_header, nffile->buff_size) < 0) failed = 1;
+            break;
+        case ZSTD_COMPRESSED:
+            if (Uncompress_Block_ZSTD(buff, block_header, nffile->buff_size, nffile->zstdDDict) < 0) failed = 1;
+            break;
+        default:
+            LogError("Unknown compression %u", compression);
+            failed = 1;
+    }
+
+    if (failed) {
+        FreeDataBlock(block_header);
+        return NULL;
+    }
+    block_header->flags &= ~(FLAG_BLOCK_COMPRESSION | BLOCK_COMPRESSION_MASK);
+    return block_header;
+
+}  // End of UncompressBlock
+
+// read a raw data block from the file mapping at the current map offset
+// the block is returned as view into the mapping without copying
+static dataBlock_t *nfreadMapped(nffile_t *nffile) {
+    if (nffile->mapOffset >= nffile->mapSize) {  // EOF
+        return NULL;
+    }
+    size_t available = nffile->mapSize - nffile->mapOffset;
+
+    // Check for sane buffer size
+    if (available < sizeof(dataBlock_t)) {
+        // this is most likely a corrupt file
+        LogError("Corrupt data file: Read %zu bytes, requested %u", available, sizeof(dataBlock_t));
+        return NULL;
+    }
+
+    dataBlock_t *buff = (dataBlock_t *)(nffile->mapAddr + nffile->mapOffset);
+    dbg_printf("ReadBlock - type: %u, size: %u, numRecords: %u, flags: %u\n", buff->type, buff->size, buff->NumRecords, buff->flags);
+
+    if (buff->size > (BUFFSIZE - sizeof(dataBlock_t)) || buff->size == 0 || buff->NumRecords == 0) {
+        // this is most likely a corrupt file
+        LogError("Corrupt data file: Error buffer size %u", buff->size);
+        return NULL;
+    }
+
+    if ((sizeof(dataBlock_t) + buff->size) > available) {
+        LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block");
+        return NULL;
+    }
+    nffile->mapOffset += sizeof(dataBlock_t) + buff->size;
+
+    return buff;
+
+}  // End of nfreadMapped
+
+// read a raw data block from current position, as stored in the file
+static dataBlock_t *nfreadRaw(nffile_t *nffile) {
+    if (nffile->mapAddr && nffile->mapOffset < nffile->mapSize) return nfreadMapped(nffile);
+
     dataBlock_t *buff = NewDataBlock();
     ssize_t ret = read(nffile->fd, buff, sizeof(dataBlock_t));
     if (ret == 0) {  // EOF
@@ -1312,48 +2448,12 @@ static dataBlock_t *nfread(nffile_t *nffile) {
         return NULL;
     }
 
-    int compression = nffile->file_header->compression;
-
     void *p = (void *)((void *)buff + sizeof(dataBlock_t));
     dbg_printf("ReadBlock - read: %u\n", buff->size);
     ret = read(nffile->fd, p, buff->size);
     if (ret == buff->size) {
-        dataBlock_t *block_header = NULL;
-        int failed = 0;
         // we have the whole record and are done for now
-        switch (compression) {
-            case NOT_COMPRESSED:
-                block_header = buff;
-                break;
-            case LZO_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_LZO(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-            case LZ4_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_LZ4(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-            case BZ2_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_BZ2(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-            case ZSTD_COMPRESSED:
-                block_header = NewDataBlock();
-                if (Uncompress_Block_ZSTD(buff, block_header, nffile->buff_size) < 0) failed = 1;
-                FreeDataBlock(buff);
-                break;
-        }
-
-        if (failed) {
-            FreeDataBlock(block_header);
-            return NULL;
-        }
-        // success - done
-        return block_header;
-
+        return buff;
     } else if (ret == 0) {
         LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block");
     } else if (ret == -1) {  // ERROR
@@ -1365,8 +2465,98 @@ static dataBlock_t *nfread(nffile_t *nffile) {
     FreeDataBlock(buff);
     return NULL;
 
+}  // End of nfreadRaw
+
+// uncompress a raw data block. Returns the block ready to be processed
+// compressed blocks of the file mapping are uncompressed directly from the mapping
+static dataBlock_t *nfuncompress(nffile_t *nffile, dataBlock_t *buff) {
+    dataBlock_t *block_header = buff;
+    if (BlockCompression(nffile, buff) != NOT_COMPRESSED) {
+        block_header = UncompressBlock(nffile, buff);
+        ReleaseBlock(nffile, buff);
+    } else if (IsMappedBlock(nffile, buff) && ((pointer_addr_t)buff & 0x3) != 0) {
+        // records require 32bit alignment - copy misaligned blocks of the mapping
+        block_header = NewDataBlock();
+        if (block_header) memcpy((void *)block_header, (void *)buff, sizeof(dataBlock_t) + buff->size);
+    }
+
+    if (block_header && TestFlag(block_header->flags, FLAG_BLOCK_ENCODED)) {
+        dataBlock_t *decoded = NewDataBlock();
+        if (decoded && !DecodeBlock(block_header, decoded, nffile->buff_size)) {
+            LogError("Corrupt encoded data block in file %s", nffile->fileName);
+            FreeDataBlock(decoded);
+            decoded = NULL;
+        }
+        ReleaseBlock(nffile, block_header);
+        block_header = decoded;
+    } else if (block_header && TestFlag(block_header->flags, FLAG_BLOCK_COLUMN)) {
+        dataBlock_t *decoded = NewDataBlock();
+        if (decoded && !DecodeColumnBlock(block_header, decoded, nffile->buff_size)) {
+            LogError("Corrupt column encoded data block in file %s", nffile->fileName);
+            FreeDataBlock(decoded);
+            decoded = NULL;
+        }
+        ReleaseBlock(nffile, block_header);
+        block_header = decoded;
+    }
+
+    return block_header;
+
+}  // End of nfuncompress
+
+// generic read und uncompress a data block from current position
+static dataBlock_t *nfread(nffile_t *nffile) {
+    dataBlock_t *buff = nfreadRaw(nffile);
+    if (!buff) return NULL;
+
+    return nfuncompress(nffile, buff);
+
 }  // End of nfread
 
+// uncompress worker. Uncompresses the raw blocks read by nfreader in parallel
+// and pushes them in file order into the processQueue
+__attribute__((noreturn)) static void *nfuncompressor(void *arg) {
+    nffile_t *nffile = (nffile_t *)arg;
+
+    /* disable signal handling */
+    sigset_t set = {0};
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+
+    while (1) {
+        readJob_t *job = queue_pop(nffile->blockQueue);
+        if (job == QUEUE_CLOSED) break;
+
+        dataBlock_t *block_header = nfuncompress(nffile, job->buff);
+
+        // wait for our turn to keep the block order
+        pthread_mutex_lock(&nffile->sequenceLock);
+        while (job->sequence != nffile->nextSequence && atomic_load(&nffile->terminate) != 1)
+            pthread_cond_wait(&nffile->sequenceCond, &nffile->sequenceLock);
+        pthread_mutex_unlock(&nffile->sequenceLock);
+
+        if (block_header == NULL) {
+            // uncompress error ends processing of this file
+            queue_close(nffile->processQueue);
+        } else if (queue_push(nffile->processQueue, (void *)block_header) == QUEUE_CLOSED) {
+            ReleaseBlock(nffile, block_header);
+        }
+
+        pthread_mutex_lock(&nffile->sequenceLock);
+        nffile->nextSequence++;
+        pthread_cond_broadcast(&nffile->sequenceCond);
+        pthread_mutex_unlock(&nffile->sequenceLock);
+        free(job);
+    }
+
+    // last worker signals EOF
+    if (atomic_fetch_sub(&nffile->activeUncompress, 1) == 1) queue_close(nffile->processQueue);
+
+    dbg_printf("nfuncompressor exit\n");
+    pthread_exit(NULL);
+
+}  // End of nfuncompressor
+
 __attribute__((noreturn)) void *nfreader(void *arg) {
     nffile_t *nffile = (nffile_t *)arg;
 
@@ -1375,10 +2565,95 @@ __attribute__((noreturn)) void *nfreader(void *arg) {
     sigfillset(&set);
     pthread_sigmask(SIG_SETMASK, &set, NULL);
 
+    uint32_t numBlocks = nffile->file_header->NumBlocks;
+
+    // with a block index, blocks outside the query time window or filter are skipped
+    // and read ahead is done block wise for the blocks to read only
+    blockIndex_t *blockIndex = NULL;
+    uint8_t *readBlock = NULL;
+    if (numBlocks && nffile->numIndex == numBlocks) {
+        readBlock = malloc(numBlocks);
+        if (readBlock) {
+            blockIndex = nffile->blockIndex;
+            int skipBlocks = indexMsecLast || indexFilter;
+            for (uint32_t i = 0; i < numBlocks; i++) readBlock[i] = !(skipBlocks && SkipBlock(&blockIndex[i]));
+        }
+    }
+
     int terminate = atomic_load(&nffile->terminate);
     int blockCount = 0;
+    int seek = 0;
+    uint32_t aheadBlock = 0;  // next block to read ahead
+    uint32_t numAhead = 0;    // blocks read ahead, but not yet read
+    off_t aheadOffset = 0;    // file offset read ahead without block index
+    uint32_t sequence = 0;    // sequence number of raw blocks for the uncompress workers
     dataBlock_t *block_header = NULL;
-    while (!terminate && blockCount < nffile->file_header->NumBlocks) {
+    while (!terminate && blockCount < numBlocks) {
+        if (blockIndex) {
+            if (!readBlock[blockCount]) {
+                dbg_printf("nfreader - skip block %u\n", blockCount);
+                atomic_fetch_add(&blocksSkipped, 1);
+                blockCount++;
+                seek = 1;
+                continue;
+            }
+            if (seek) {
+                if (nffile->mapAddr) {
+                    nffile->mapOffset = blockIndex[blockCount].offset;
+                } else if (lseek(nffile->fd, blockIndex[blockCount].offset, SEEK_SET) < 0) {
+                    LogError("lseek() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                    break;
+                }
+                seek = 0;
+            }
+
+            // keep READAHEAD_BLOCKS blocks in flight
+            if (aheadBlock < blockCount) aheadBlock = blockCount;
+            while (numAhead < READAHEAD_BLOCKS && aheadBlock < numBlocks) {
+                if (readBlock[aheadBlock]) {
+                    off_t offset = blockIndex[aheadBlock].offset;
+                    off_t end = (aheadBlock + 1) < numBlocks ? blockIndex[aheadBlock + 1].offset : nffile->file_header->offAppendix;
+                    ReadAhead(nffile, offset, end > offset ? end - offset : WRITE_BUFFSIZE);
+                    numAhead++;
+                }
+                aheadBlock++;
+            }
+            if (numAhead) numAhead--;
+        } else {
+            // keep a window of READAHEAD_SIZE bytes in flight
+            off_t offset = nffile->mapAddr ? (off_t)nffile->mapOffset : lseek(nffile->fd, 0, SEEK_CUR);
+            if (offset >= 0 && (offset + READAHEAD_SIZE / 2) > aheadOffset) {
+                if (aheadOffset < offset) aheadOffset = offset;
+                ReadAhead(nffile, aheadOffset, offset + READAHEAD_SIZE - aheadOffset);
+                aheadOffset = offset + READAHEAD_SIZE;
+            }
+        }
+
+        if (nffile->numUncompress) {
+            // hand over raw block to the uncompress workers
+            dataBlock_t *buff = nfreadRaw(nffile);
+            if (!buff) {
+                dbg_printf("buff == NULL\n");
+                break;
+            }
+            readJob_t *job = malloc(sizeof(readJob_t));
+            if (!job) {
+                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                ReleaseBlock(nffile, buff);
+                break;
+            }
+            *job = (readJob_t){.buff = buff, .sequence = sequence++};
+            if (queue_push(nffile->blockQueue, (void *)job) == QUEUE_CLOSED) {
+                ReleaseBlock(nffile, buff);
+                free(job);
+                terminate = 1;
+            } else {
+                blockCount++;
+                terminate = atomic_load(&nffile->terminate);
+            }
+            continue;
+        }
+
         block_header = nfread(nffile);
         if (!block_header) {
             dbg_printf("block_header == NULL\n");
@@ -1386,7 +2661,7 @@ __attribute__((noreturn)) void *nfreader(void *arg) {
         }
 
         if (queue_push(nffile->processQueue, (void *)block_header) == QUEUE_CLOSED) {
-            FreeDataBlock(block_header);
+            ReleaseBlock(nffile, block_header);
             dbg_printf("nfreader - processQueue closed\n");
             terminate = 1;
         } else {
@@ -1404,7 +2679,12 @@ __attribute__((noreturn)) void *nfreader(void *arg) {
     }
 
     // eof or error ends processing
-    queue_close(nffile->processQueue);
+    // with uncompress workers, the last worker closes the processQueue
+    if (nffile->numUncompress)
+        queue_close(nffile->blockQueue);
+    else
+        queue_close(nffile->processQueue);
+    if (readBlock) free(readBlock);
 
     dbg_printf("nfreader done - read %u blocks\n", blockCount);
     dbg_printf("nfreader exit\n");
@@ -1431,6 +2711,41 @@ int WriteBlock(nffile_t *nffile) {
 
 }  // End of WriteBlock
 
+// adaptive compression - select the compression of a data block according to the number of
+// blocks waiting in the processQueue. If the writers keep up, the file compression and level is
+// used. With a growing backlog, the fastest level of the file compression - or LZ4, if the
+// compression has no fast level - and under pressure fast LZ4 is used. The compression of the block is recorded in the block flags
+static void SelectCompression(nffile_t *nffile, int *compression, int *level) {
+    if (*compression == NOT_COMPRESSED) return;
+
+    size_t backlog = queue_length(nffile->processQueue);
+    if (backlog >= PressureBacklog) {
+        *compression = LZ4_COMPRESSED;
+        *level = 0;
+    } else if (backlog > 0) {
+        switch (*compression) {
+            case LZ4_COMPRESSED:
+                *level = 0;
+                break;
+            case ZSTD_COMPRESSED:
+                if (nffile->zstdCDict) {
+                    // the level of a digested dictionary is fixed
+                    *compression = LZ4_COMPRESSED;
+                    *level = 0;
+                } else {
+                    *level = 1;
+                }
+                break;
+            case BZ2_COMPRESSED:
+                // bzip2 has no fast level
+                *compression = LZ4_COMPRESSED;
+                *level = 0;
+                break;
+        }
+    }
+
+}  // End of SelectCompression
+
 static int nfwrite(nffile_t *nffile, dataBlock_t *block_header) {
     if (block_header->size == 0) {
         return 1;
@@ -1438,13 +2753,31 @@ static int nfwrite(nffile_t *nffile, dataBlock_t *block_header) {
 
     dbg_printf("nfwrite - write: %u\n", block_header->size);
 
+    // summarise data blocks for the block index - appendix blocks are not indexed
+    int indexBlock = !TestFlag(block_header->flags, FLAG_BLOCK_AUTOREAD);
+    blockIndex_t blockIndex;
+    if (indexBlock) ScanBlock(block_header, &blockIndex);
+
+    // delta/varint encode flow records. Blocks, which do not get smaller are written as they are
+    // column encoded blocks keep their size, but compress better
+    dataBlock_t *encoded = NULL;
+    if ((nffile->encode || nffile->column) && indexBlock && block_header->type == DATA_BLOCK_TYPE_3) {
+        encoded = NewDataBlock();
+        if (encoded) {
+            int ok = nffile->column ? EncodeColumnBlock(block_header, encoded, nffile->buff_size)
+                                    : EncodeBlock(block_header, encoded, nffile->buff_size);
+            if (ok) block_header = encoded;
+        }
+    }
+
     dataBlock_t *buff = NULL;
     dataBlock_t *wptr = NULL;
     int failed = 0;
     // compress according file compression
     int compression = nffile->file_header->compression;
     int level = nffile->compression_level;
-    dbg_printf("nfwrite - compression: %u\n", compression);
+    if (nffile->adaptive && indexBlock) SelectCompression(nffile, &compression, &level);
+    dbg_printf("nfwrite - compression: %u, level: %d\n", compression, level);
     switch (compression) {
         case NOT_COMPRESSED:
             wptr = block_header;
@@ -1466,22 +2799,35 @@ static int nfwrite(nffile_t *nffile, dataBlock_t *block_header) {
             break;
         case ZSTD_COMPRESSED:
             buff = NewDataBlock();
-            if (Compress_Block_ZSTD(block_header, buff, nffile->buff_size, level) < 0) failed = 1;
+            // appendix blocks are readable without the dictionary
+            if (Compress_Block_ZSTD(block_header, buff, nffile->buff_size, level, indexBlock ? nffile->zstdCDict : NULL) < 0) failed = 1;
             wptr = buff;
             break;
     }
 
     if (failed) {  // error
         FreeDataBlock(buff);
+        FreeDataBlock(encoded);
         return 0;
     }
 
+    // record the compression of the block, if it differs from the file compression
+    wptr->flags &= ~(FLAG_BLOCK_COMPRESSION | BLOCK_COMPRESSION_MASK);
+    if (compression != nffile->file_header->compression) {
+        wptr->flags |= FLAG_BLOCK_COMPRESSION | (compression << 8);
+    }
+
     dbg_printf("WriteBlock - type: %u, size: %u, compressed: %u, numRecords: %u, flags: %u\n", wptr->type, block_header->size, compression,
                wptr->NumRecords, wptr->flags);
 
     pthread_mutex_lock(&nffile->wlock);
+    if (indexBlock) {
+        blockIndex.offset = lseek(nffile->fd, 0, SEEK_CUR);
+        AddBlockIndex(nffile, &blockIndex);
+    }
     ssize_t ret = write(nffile->fd, (void *)wptr, sizeof(dataBlock_t) + wptr->size);
     FreeDataBlock(buff);
+    FreeDataBlock(encoded);
     if (ret < 0) {
         pthread_mutex_unlock(&nffile->wlock);
         LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
@@ -1529,9 +2875,14 @@ __attribute__((noreturn)) void *nfwriter(void *arg) {
 static int SignalTerminate(nffile_t *nffile) {
     // set terminate
     atomic_store(&nffile->terminate, 1);
+    // queue_close() wakes all threads waiting on the queues
     queue_close(nffile->processQueue);
+    queue_close(nffile->blockQueue);
 
-    pthread_cond_broadcast(&(nffile->processQueue->cond));
+    // wake uncompress workers waiting for their turn
+    pthread_mutex_lock(&nffile->sequenceLock);
+    pthread_cond_broadcast(&nffile->sequenceCond);
+    pthread_mutex_unlock(&nffile->sequenceLock);
     for (unsigned i = 0; i < NumWorkers; i++) {
         if (nffile->worker[i]) {
             int err = pthread_join(nffile->worker[i], NULL);
@@ -1562,8 +2913,9 @@ int ChangeIdent(char *filename, char *Ident) {
     }
 
     // file is valid - re-open the file mode RDWR
+    // the file header is rewritten at offset 0 - do not open with O_APPEND
     close(nffile->fd);
-    nffile->fd = open(filename, O_RDWR | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    nffile->fd = open(filename, O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (nffile->fd < 0) {
         LogError("Failed to open file %s: '%s'", filename, strerror(errno));
         DisposeFile(nffile);
@@ -1581,6 +2933,12 @@ int ChangeIdent(char *filename, char *Ident) {
             DisposeFile(nffile);
             return 0;
         }
+        // cut off old appendix
+        if (ftruncate(nffile->fd, nffile->file_header->offAppendix) < 0) {
+            LogError("ftruncate() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            DisposeFile(nffile);
+            return 0;
+        }
     } else {
         // if no appendix
         if (lseek(nffile->fd, 0, SEEK_END) < 0) {
@@ -1590,10 +2948,7 @@ int ChangeIdent(char *filename, char *Ident) {
         }
     }
 
-    if (!WriteAppendix(nffile)) {
-        LogError("Failed to write appendix");
-    }
-
+    // CloseUpdateFile() writes the new appendix
     if (!CloseUpdateFile(nffile)) {
         return 0;
     }
@@ -1616,7 +2971,7 @@ void ModifyCompressFile(int compress) {
         // last file
         if (!nffile_r || (nffile_r == EMPTY_LIST)) break;
 
-        if (nffile_r->file_header->compression == (compress & 0xFFFF)) {
+        if (nffile_r->file_header->compression == (compress & 0xFF) && (compress & (COMPRESSION_DELTA | COMPRESSION_COLUMN | COMPRESSION_ADAPTIVE)) == 0) {
             printf("File %s is already same compression method\n", nffile_r->fileName);
             continue;
         }
@@ -1649,7 +3004,8 @@ void ModifyCompressFile(int compress) {
             dataBlock_t *block_header = queue_pop(nffile_r->processQueue);
             if (block_header == QUEUE_CLOSED)  // EOF
                 break;
-            queue_push(nffile_w->processQueue, block_header);
+            block_header = DetachBlock(nffile_r, block_header);
+            if (block_header) queue_push(nffile_w->processQueue, block_header);
         }
 
         printf("File %s compression changed\n", nffile_r->fileName);
@@ -1680,6 +3036,8 @@ int QueryFile(char *filename, int verbose) {
 
     type1 = type2 = type3 = type4 = 0;
     totalRecords = numBlocks = 0;
+    // number of blocks with their own compression
+    uint32_t blockCompression[ZSTD_COMPRESSED + 1] = {0};
 
     if (stat(filename, &stat_buf)) {
         LogError("Can't stat '%s': %s", filename, strerror(errno));
@@ -1719,7 +3077,7 @@ int QueryFile(char *filename, int verbose) {
             return 0;
         }
     } else {
-        if (fileHeader.version != LAYOUT_VERSION_2) {
+        if (fileHeader.version != LAYOUT_VERSION_2 && fileHeader.version != LAYOUT_VERSION_3) {
             LogError("Unknown layout version: %u", fileHeader.version);
             close(fd);
             return 0;
@@ -1797,6 +3155,20 @@ int QueryFile(char *filename, int verbose) {
     nffile->block_header = NewDataBlock();
     memcpy(nffile->file_header, &fileHeader, sizeof(fileHeader));
 
+    if (fileHeader.version != LAYOUT_VERSION_1 && fileHeader.appendixBlocks) {
+        ReadAppendix(nffile);
+    }
+
+    // the ZSTD dictionary required for the data blocks is in front of the data blocks
+    if (fileHeader.version == LAYOUT_VERSION_3) {
+        if (!ReadDictBlocks(nffile)) {
+            LogError("Error reading dictionary blocks");
+            close(fd);
+            return 0;
+        }
+        if (nffile->zstdDict) printf("Dictionary : %u bytes\n", nffile->zstdDictSize);
+    }
+
     dataBlock_t *buff = NewDataBlock();
 
     printf("Checking data blocks\n");
@@ -1868,10 +3240,8 @@ int QueryFile(char *filename, int verbose) {
             printf("Checking block %i, offset: %lld, type: %u, size: %u, flags: 0x%x, records: %u\n", numBlocks, (long long)fpos,
                    nffile->block_header->type, nffile->block_header->size, nffile->block_header->flags, nffile->block_header->NumRecords);
         }
-        int compression = nffile->file_header->compression;
-        if (TestFlag(nffile->block_header->flags, FLAG_BLOCK_UNCOMPRESSED)) {
-            compression = NOT_COMPRESSED;
-        }
+        int compression = BlockCompression(nffile, nffile->block_header);
+        if (TestFlag(nffile->block_header->flags, FLAG_BLOCK_COMPRESSION) && compression <= ZSTD_COMPRESSED) blockCompression[compression]++;
 
         nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(dataBlock_t));
         ret = read(nffile->fd, nffile->buff_ptr, nffile->block_header->size);
@@ -1927,7 +3297,7 @@ int QueryFile(char *filename, int verbose) {
                 dataBlock_t *b = nffile->block_header;
                 nffile->block_header = buff;
                 buff = b;
-                if (Uncompress_Block_ZSTD(buff, nffile->block_header, nffile->buff_size) < 0) {
+                if (Uncompress_Block_ZSTD(buff, nffile->block_header, nffile->buff_size, nffile->zstdDDict) < 0) {
                     LogError("Zstd decompress failed");
                     failed = 1;
                 }
@@ -1943,6 +3313,28 @@ int QueryFile(char *filename, int verbose) {
             printf("Uncompressed block %i, type: %u, size: %u, flags: 0x%x, records: %u\n", numBlocks, nffile->block_header->type,
                    nffile->block_header->size, nffile->block_header->flags, nffile->block_header->NumRecords);
 
+        if (TestFlag(nffile->block_header->flags, FLAG_BLOCK_ENCODED)) {
+            // encoded records - check the decoded records
+            if (!DecodeBlock(nffile->block_header, buff, nffile->buff_size)) {
+                LogError("Error in block: %u, corrupt encoded records", numBlocks);
+                close(fd);
+                return 0;
+            }
+            dataBlock_t *b = nffile->block_header;
+            nffile->block_header = buff;
+            buff = b;
+        } else if (TestFlag(nffile->block_header->flags, FLAG_BLOCK_COLUMN)) {
+            // column encoded records - check the decoded records
+            if (!DecodeColumnBlock(nffile->block_header, buff, nffile->buff_size)) {
+                LogError("Error in block: %u, corrupt column encoded records", numBlocks);
+                close(fd);
+                return 0;
+            }
+            dataBlock_t *b = nffile->block_header;
+            nffile->block_header = buff;
+            buff = b;
+        }
+
         nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(dataBlock_t));
 
         // record counting
@@ -2031,6 +3423,9 @@ int QueryFile(char *filename, int verbose) {
     if (type2) printf("Type 2 blocks : %u\n", type2);
     if (type3) printf("Type 3 blocks : %u\n", type3);
     if (type4) printf("Type 4 blocks : %u\n", type4);
+    for (int i = 0; i <= ZSTD_COMPRESSED; i++) {
+        if (blockCompression[i]) printf("%-4s blocks   : %u\n", compressionName[i], blockCompression[i]);
+    }
     printf("Records       : %u\n", totalRecords);
 
     DisposeFile(nffile);
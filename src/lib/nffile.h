@@ -202,10 +202,34 @@ typedef struct nffile_s {
 
     queue_t *processQueue;  // blocks ready to be processed. Connects consumer/producer threads
 
+    // parallel uncompress of data blocks while reading
+    queue_t *blockQueue;               // raw blocks to be uncompressed by the uncompress workers
+    uint32_t numUncompress;            // number of uncompress workers, 0 if nfreader uncompresses
+    _Atomic uint32_t activeUncompress; // number of running uncompress workers
+    uint32_t nextSequence;             // sequence number of next block to push into processQueue
+    pthread_mutex_t sequenceLock;      // lock and condition for ordered processQueue push
+    pthread_cond_t sequenceCond;
+
+    void *mapAddr;     // memory mapped file for reading, NULL if not mapped
+    size_t mapSize;    // size of mapping
+    size_t mapOffset;  // read offset of next data block in mapping
+
+    blockIndex_t *blockIndex;  // block index of data blocks, if available
+    uint32_t indexSize;        // number of allocated index entries
+    uint32_t numIndex;         // number of valid index entries
+
     stat_record_t *stat_record;  // flow stat record
     char *ident;                 // source identifier
     char *fileName;              // file name
     uint16_t compression_level;  // compression level, if available.
+    int encode;                  // delta/varint encode records of data blocks before compression
+    int column;                  // column encode records of data blocks before compression
+    int adaptive;                // select compression per data block according to the processQueue backlog
+
+    void *zstdDict;         // ZSTD dictionary of this file, NULL if none
+    uint32_t zstdDictSize;  // size of dictionary
+    void *zstdCDict;        // digested dictionary for compression
+    void *zstdDDict;        // digested dictionary for decompression
 } nffile_t;
 
 // returnn value, if all files in list are processed
@@ -245,10 +269,27 @@ typedef struct record_header_s {
 
 int Init_nffile(int workers, queue_t *fileList);
 
+void DisposePrefetcher(void);
+
+// ParseCompression() flag: column encode records before compression
+#define COMPRESSION_COLUMN 0x100
+// ParseCompression() flag: delta/varint encode records before compression
+#define COMPRESSION_DELTA 0x200
+// ParseCompression() flag: select compression per block according to the writer backlog
+#define COMPRESSION_ADAPTIVE 0x400
+
 int ParseCompression(char *arg);
 
 unsigned ReportBlocks(void);
 
+unsigned ReportSkippedBlocks(void);
+
+void SetIndexTimeWindow(uint64_t msecFirst, uint64_t msecLast);
+
+void SetIndexFilter(void *engine);
+
+int LoadZstdDictionary(char *dictFile);
+
 void SumStatRecords(stat_record_t *s1, stat_record_t *s2);
 
 nffile_t *OpenFile(char *filename, nffile_t *nffile);
@@ -279,6 +320,10 @@ nffile_t *GetNextFile(nffile_t *nffile);
 
 int ReadBlock(nffile_t *nffile);
 
+dataBlock_t *TakeBlock(nffile_t *nffile);
+
+void ReleaseDataBlock(dataBlock_t *dataBlock);
+
 int WriteBlock(nffile_t *nffile);
 
 void SetIdent(nffile_t *nffile, char *Ident);
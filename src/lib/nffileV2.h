@@ -51,6 +51,13 @@
  *   +-----------+-------------+-------------+-------------+-----+-------------+
  *   |Fileheader | datablock 0 | datablock 1 | datablock 2 | ... | datablock n |
  *   +-----------+-------------+-------------+-------------+-----+-------------+
+ *
+ * Files, which may contain delta/varint or column encoded data blocks, data blocks with their own
+ * compression or data blocks compressed with a ZSTD dictionary, are recognized as LAYOUT_VERSION_3.
+ * The layout is the same as layout 2, except for optional dictionary blocks between the file
+ * header and the first data block. The version makes older nfdump versions reject these files,
+ * as they can not decode the records of encoded blocks, uncompress all blocks with the
+ * compression of the file and do not know the dictionary.
  */
 
 typedef struct fileHeaderV2_s {
@@ -59,6 +66,7 @@ typedef struct fileHeaderV2_s {
 
     uint16_t version;  // version of binary file layout
 #define LAYOUT_VERSION_2 2
+#define LAYOUT_VERSION_3 3
 
     uint32_t nfdversion;  // version of nfdump created this file
 #define NFDVERSION 0xF1070200
@@ -132,9 +140,17 @@ typedef struct dataBlock_s {
     uint16_t flags;  // Bit 0: 0: file block compression, 1: block uncompressed
                      // Bit 1: 0: file block encryption, 1: block unencrypted
                      // Bit 2: 0: no autoread, 1: autoread - internal structure
+                     // Bit 3: 0: plain records, 1: column encoded records - see nfencode.c
+                     // Bit 4: 0: plain records, 1: delta/varint encoded records - see nfencode.c
+                     // Bit 5: 0: file block compression, 1: block compression in bits 8-11
 #define FLAG_BLOCK_UNCOMPRESSED 0x1
 #define FLAG_BLOCK_UNENCRYPTED 0x2
 #define FLAG_BLOCK_AUTOREAD 0x4
+#define FLAG_BLOCK_COLUMN 0x8
+#define FLAG_BLOCK_ENCODED 0x10
+#define FLAG_BLOCK_COMPRESSION 0x20
+#define BLOCK_COMPRESSION_MASK 0x0F00
+#define BLOCK_COMPRESSION(b) (((b)->flags & BLOCK_COMPRESSION_MASK) >> 8)
 } dataBlock_t;
 
 /*
@@ -154,5 +170,73 @@ typedef struct recordHeader_s {
 
 #define TYPE_IDENT 0x8001
 #define TYPE_STAT 0x8002
+#define TYPE_BLOCKINDEX 0x8003
+#define TYPE_ZSTDDICT 0x8004
+
+/*
+ * Block index
+ * ===========
+ * The appendix may contain a block index, which summarises each data block of the file.
+ * Entries are stored in file order, one entry per data block. As a record size is limited
+ * to 16bit, the index is split into multiple TYPE_BLOCKINDEX array records. Each record
+ * starts with an array record header, followed by numElements entries of size elementSize.
+ *
+ *   +--------------------+---------+---------+-----+---------+
+ *   | arrayRecordHeader  | entry 0 | entry 1 | ... | entry n |
+ *   +--------------------+---------+---------+-----+---------+
+ *
+ * Readers may use the index to skip data blocks, which can not contain any matching record,
+ * either by time or by the zone maps of the filter elements.
+ */
+typedef struct blockIndex_s {
+    uint64_t offset;        // file offset of the data block header
+    uint64_t msecFirstMin;  // min/max msecFirst of all flow records in block
+    uint64_t msecFirstMax;
+    uint64_t msecLastMin;  // min/max msecLast of all flow records in block
+    uint64_t msecLastMax;
+    uint32_t NumRecords;  // number of records in block
+    uint16_t flags;
+#define INDEX_NOSKIP 0x1  // block contains non flow records and must always be read
+    uint16_t fill;
+    // protocol mix of flow records
+    uint32_t numTCP;
+    uint32_t numUDP;
+    uint32_t numICMP;
+    uint32_t numOther;
+    // zone maps - min/max values of all V3 records in block, which contain the element
+    // min > max: no record in block contains the element
+    uint32_t src4AddrMin;
+    uint32_t src4AddrMax;
+    uint32_t dst4AddrMin;
+    uint32_t dst4AddrMax;
+    uint16_t srcPortMin;
+    uint16_t srcPortMax;
+    uint16_t dstPortMin;
+    uint16_t dstPortMax;
+    uint16_t exporterIDMin;
+    uint16_t exporterIDMax;
+    uint8_t protoMin;
+    uint8_t protoMax;
+    uint16_t fill2;
+} blockIndex_t;
+
+// max number of index entries per TYPE_BLOCKINDEX record - the record size must fit into
+// the uint16_t size of the array record header (arrayRecordHeader_t in nfxV3.h)
+#define MAXINDEXENTRIES ((UINT16_MAX - sizeof(arrayRecordHeader_t)) / sizeof(blockIndex_t))
+
+/*
+ * ZSTD dictionary
+ * ===============
+ * A layout 3 file may contain the ZSTD dictionary used to compress its data blocks. The dictionary
+ * is written with the file header in uncompressed autoread blocks in front of the first data
+ * block, so the data blocks of a file still being written are readable. The dictionary is split
+ * into TYPE_ZSTDDICT array records of elementSize 1 with numElements bytes each, which are
+ * concatenated in order. Dictionary blocks are not counted in NumBlocks.
+ */
+
+// max number of dictionary bytes per TYPE_ZSTDDICT record
+#define MAXDICTCHUNK 32768
+// max size of a ZSTD dictionary
+#define MAXDICTSIZE (1024 * 1024)
 
 #endif  //_NFFILEV2_H
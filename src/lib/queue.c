@@ -33,6 +33,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdatomic.h>
@@ -45,6 +46,21 @@
 #include "config.h"
 #include "util.h"
 
+// closed bit in next_free
+#define QUEUE_CLOSED_BIT (~(SIZE_MAX >> 1))
+
+// number of busy wait loops and sched_yield() calls, before a thread parks
+#define SPINLOOPS 128
+#define YIELDLOOPS 16
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX()
+#endif
+
 queue_t *queue_init(size_t length) {
     queue_t *queue;
 
@@ -53,6 +69,9 @@ queue_t *queue_init(size_t length) {
         return NULL;
     }
 
+    // a single element can not tell a free from a used element by its sequence
+    if (length == 1) length = 2;
+
     queue = calloc(1, sizeof(queue_t) + length * sizeof(element_t));
     if (!queue) {
         LogError("malloc() allocation error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
@@ -62,15 +81,21 @@ queue_t *queue_init(size_t length) {
         LogError("pthread_mutex_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
-    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+    if (pthread_cond_init(&queue->c_cond, NULL) != 0 || pthread_cond_init(&queue->p_cond, NULL) != 0) {
         LogError("pthread_cond_init() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         return NULL;
     }
 
     queue->length = length;
     queue->mask = length - 1;
+    for (size_t i = 0; i < length; i++) {
+        atomic_init(&queue->element[i].sequence, i);
+    }
+    atomic_init(&queue->next_free, 0);
+    atomic_init(&queue->next_avail, 0);
     atomic_init(&queue->c_wait, 0);
     atomic_init(&queue->p_wait, 0);
+    atomic_init(&queue->maxUsed, 0);
 
     return queue;
 
@@ -78,51 +103,106 @@ queue_t *queue_init(size_t length) {
 
 void queue_free(queue_t *queue) {
     queue_sync(queue);
+    pthread_cond_destroy(&queue->c_cond);
+    pthread_cond_destroy(&queue->p_cond);
+    pthread_mutex_destroy(&queue->mutex);
     free(queue);
 
 }  // End of Queue_free
 
-void queue_open(queue_t *queue) {
+// wake up parked threads waiting on cond, if any
+static void queue_wakeup(queue_t *queue, _Atomic unsigned *waiting, pthread_cond_t *cond, int all) {
+    // pairs with the fence in queue_park()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed) == 0) return;
+
     pthread_mutex_lock(&(queue->mutex));
-    queue->closed = 0;
+    if (all)
+        pthread_cond_broadcast(cond);
+    else
+        pthread_cond_signal(cond);
     pthread_mutex_unlock(&(queue->mutex));
 
-}  // End of queue_open
+}  // End of queue_wakeup
 
-void queue_close(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    queue->closed = 1;
-    if (queue->num_elements == 0) {
-        pthread_cond_signal(&(queue->cond));
+// return the number of elements, including elements claimed by producers, which are not yet pushed
+static size_t queue_used(queue_t *queue) {
+    size_t next_avail = atomic_load(&queue->next_avail);
+    size_t next_free = atomic_load(&queue->next_free) & ~QUEUE_CLOSED_BIT;
+    return next_free - next_avail;
+
+}  // End of queue_used
+
+// producer may continue - queue has a free element or is closed
+static int queue_can_push(queue_t *queue) {
+    size_t pos = atomic_load(&queue->next_free);
+    if (pos & QUEUE_CLOSED_BIT) return 1;
+    return atomic_load(&queue->element[pos & queue->mask].sequence) == pos;
+
+}  // End of queue_can_push
+
+// consumer may continue - queue has an element to pop or is closed
+static int queue_can_pop(queue_t *queue) {
+    size_t pos = atomic_load(&queue->next_avail);
+    if (atomic_load(&queue->element[pos & queue->mask].sequence) == pos + 1) return 1;
+    return queue_done(queue);
+
+}  // End of queue_can_pop
+
+// wait for the queue to change state. Spin and yield first and park the thread
+// on cond, if the state does not change within the spin loops
+static void queue_park(queue_t *queue, _Atomic unsigned *waiting, pthread_cond_t *cond, int (*ready)(queue_t *), unsigned *spin) {
+    if (*spin < SPINLOOPS) {
+        (*spin)++;
+        CPU_RELAX();
+        return;
+    }
+    if (*spin < (SPINLOOPS + YIELDLOOPS)) {
+        (*spin)++;
+        sched_yield();
+        return;
     }
+
+    pthread_mutex_lock(&(queue->mutex));
+    atomic_fetch_add(waiting, 1);
+    // pairs with the fence in queue_wakeup()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ready(queue)) pthread_cond_wait(cond, &(queue->mutex));
+    atomic_fetch_sub(waiting, 1);
     pthread_mutex_unlock(&(queue->mutex));
 
+}  // End of queue_park
+
+void queue_open(queue_t *queue) {
+    atomic_fetch_and(&queue->next_free, ~QUEUE_CLOSED_BIT);
+
+}  // End of queue_open
+
+void queue_close(queue_t *queue) {
+    atomic_fetch_or(&queue->next_free, QUEUE_CLOSED_BIT);
+
+    // wake all waiting consumers and producers
+    queue_wakeup(queue, &queue->c_wait, &queue->c_cond, 1);
+    queue_wakeup(queue, &queue->p_wait, &queue->p_cond, 1);
+
 }  // End of queue_close
 
 size_t queue_length(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    size_t length = queue->num_elements;
-    pthread_mutex_unlock(&(queue->mutex));
-
-    return length;
+    return queue_used(queue);
 
 }  // End of queue_length
 
 queueStat_t queue_stat(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    queueStat_t stat = queue->stat;
-    stat.length = queue->num_elements;
-    queue->stat.maxUsed = 0;
-    pthread_mutex_unlock(&(queue->mutex));
+    queueStat_t stat;
+    stat.maxUsed = atomic_exchange(&queue->maxUsed, 0);
+    stat.length = queue_used(queue);
     return stat;
 }  // End of queue_stat
 
 uint32_t queue_done(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
-    uint32_t done = queue->num_elements == 0 && queue->closed;
-    pthread_mutex_unlock(&(queue->mutex));
-
-    return done;
+    size_t next_avail = atomic_load(&queue->next_avail);
+    size_t next_free = atomic_load(&queue->next_free);
+    return (next_free & QUEUE_CLOSED_BIT) && (next_free & ~QUEUE_CLOSED_BIT) == next_avail;
 
 }  // End of queue_length
 
@@ -144,7 +224,8 @@ void queue_sync(queue_t *queue) {
         struct timeval tv = {0};
         tv.tv_usec = 1;
         pthread_mutex_lock(&(queue->mutex));
-        pthread_cond_broadcast(&(queue->cond));
+        pthread_cond_broadcast(&(queue->c_cond));
+        pthread_cond_broadcast(&(queue->p_cond));
         pthread_mutex_unlock(&(queue->mutex));
         select(0, NULL, NULL, NULL, &tv);
     }
@@ -152,30 +233,33 @@ void queue_sync(queue_t *queue) {
 }  // end of queue_sync
 
 void *queue_push(queue_t *queue, void *data) {
-    pthread_mutex_lock(&(queue->mutex));
+    unsigned spin = 0;
     while (1) {
-        if (queue->closed) {
-            pthread_mutex_unlock(&(queue->mutex));
-            return QUEUE_CLOSED;
-        }
-        if (queue->num_elements < queue->length) {
-            unsigned index = queue->next_free;
-            queue->element[index] = data;
-            queue->num_elements++;
-            queue->next_free = (queue->next_free + 1) & queue->mask;
-
-            if (queue->stat.maxUsed < queue->num_elements) queue->stat.maxUsed = queue->num_elements;
-
-            if (atomic_load(&queue->c_wait)) {
-                pthread_cond_signal(&(queue->cond));
+        size_t pos = atomic_load_explicit(&queue->next_free, memory_order_relaxed);
+        if (pos & QUEUE_CLOSED_BIT) return QUEUE_CLOSED;
+
+        element_t *element = &queue->element[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&element->sequence, memory_order_acquire);
+        if (sequence == pos) {
+            // element is free - claim it. Fails, if another producer was faster or the queue got closed
+            if (atomic_compare_exchange_weak_explicit(&queue->next_free, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                element->data = data;
+                atomic_store_explicit(&element->sequence, pos + 1, memory_order_release);
+
+                size_t used = queue_used(queue);
+                size_t maxUsed = atomic_load_explicit(&queue->maxUsed, memory_order_relaxed);
+                while (used > maxUsed &&
+                       !atomic_compare_exchange_weak_explicit(&queue->maxUsed, &maxUsed, used, memory_order_relaxed, memory_order_relaxed))
+                    ;
+
+                queue_wakeup(queue, &queue->c_wait, &queue->c_cond, 0);
+                return NULL;
             }
-            pthread_mutex_unlock(&(queue->mutex));
-            return NULL;
-        } else {
-            queue->p_wait++;
-            pthread_cond_wait(&(queue->cond), &(queue->mutex));
-            queue->p_wait--;
+        } else if ((intptr_t)(sequence - pos) < 0) {
+            // queue full - wait for a consumer
+            queue_park(queue, &queue->p_wait, &queue->p_cond, queue_can_push, &spin);
         }
+        // else another producer claimed the element - retry
     }
 
     /*NOTREACHED*/
@@ -183,29 +267,26 @@ void *queue_push(queue_t *queue, void *data) {
 }  // End of queue_push
 
 void *queue_pop(queue_t *queue) {
-    pthread_mutex_lock(&(queue->mutex));
+    unsigned spin = 0;
     while (1) {
-        if (queue->closed && queue->num_elements == 0) {
-            pthread_mutex_unlock(&(queue->mutex));
-            return QUEUE_CLOSED;
-        }
-
-        if (queue->num_elements > 0) {
-            unsigned index = queue->next_avail;
-            void *data = queue->element[index];
-            queue->num_elements--;
-            queue->next_avail = (queue->next_avail + 1) & queue->mask;
-
-            if (queue->p_wait) {
-                pthread_cond_signal(&(queue->cond));
+        size_t pos = atomic_load_explicit(&queue->next_avail, memory_order_relaxed);
+        element_t *element = &queue->element[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&element->sequence, memory_order_acquire);
+        if (sequence == pos + 1) {
+            // element holds data - claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->next_avail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                void *data = element->data;
+                // free element for the next round of the ring
+                atomic_store_explicit(&element->sequence, pos + queue->length, memory_order_release);
+                queue_wakeup(queue, &queue->p_wait, &queue->p_cond, 0);
+                return data;
             }
-            pthread_mutex_unlock(&(queue->mutex));
-            return data;
-        } else {
-            atomic_fetch_add(&queue->c_wait, 1);
-            pthread_cond_wait(&(queue->cond), &(queue->mutex));
-            atomic_fetch_sub(&queue->c_wait, 1);
+        } else if ((intptr_t)(sequence - (pos + 1)) < 0) {
+            // queue empty, or the producer of this element did not yet finish its push
+            if (queue_done(queue)) return QUEUE_CLOSED;
+            queue_park(queue, &queue->c_wait, &queue->c_cond, queue_can_pop, &spin);
         }
+        // else another consumer claimed the element - retry
     }
 
     /*NOTREACHED*/
@@ -33,13 +33,27 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define QUEUE_FULL (void *)-1
 #define QUEUE_EMPTY (void *)-2
 #define QUEUE_CLOSED (void *)-3
 
+/*
+ * Lock-free bounded ring buffer for multiple producers and consumers.
+ * Each element carries a sequence number, which tells producers and consumers
+ * whether the element is free or holds data for the current round of the ring.
+ * Producers and consumers claim an element by advancing next_free or next_avail
+ * with a compare and swap. With a single producer and consumer the swap never
+ * fails and a push or pop takes no lock. The closed state is the top bit of
+ * next_free, so no push succeeds after a queue_close().
+ * Threads, which can not push or pop, spin, then yield and finally park on
+ * the condition variable. The mutex is only taken for parking and waking up.
+ */
+
 typedef struct element_s {
+    _Atomic size_t sequence;
     void *data;
 } element_t;
 
@@ -48,21 +62,25 @@ typedef struct queueStat_s {
     size_t length;
 } queueStat_t;
 
+#define QUEUE_CACHELINE 64
+
 typedef struct queue_s {
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    uint32_t closed;
+    _Atomic size_t next_free;  // next element to push and closed bit
+    char pad1[QUEUE_CACHELINE - sizeof(size_t)];
+    _Atomic size_t next_avail;  // next element to pop
+    char pad2[QUEUE_CACHELINE - sizeof(size_t)];
 
     size_t length;
     size_t mask;
-    unsigned next_free;
-    unsigned next_avail;
-    _Atomic unsigned c_wait;
-    _Atomic unsigned p_wait;
-    size_t num_elements;
-
-    queueStat_t stat;
-    void *element[1];
+    _Atomic unsigned c_wait;  // number of parked consumers
+    _Atomic unsigned p_wait;  // number of parked producers
+    _Atomic size_t maxUsed;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t c_cond;
+    pthread_cond_t p_cond;
+
+    element_t element[1];
 } queue_t;
 
 queue_t *queue_init(size_t length);
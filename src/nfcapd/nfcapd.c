@@ -151,6 +151,9 @@ static void usage(char *name) {
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=<comp>:delta\tDelta encode flows before compression.\n"
+        "-z=<comp>:column\tColumn encode flows before compression.\n"
+        "-z=<comp>:adapt\tAdapt compression per block to the collector load.\n"
         "-B bufflen\tSet socket buffer to bufflen bytes\n"
         "-e\t\tExpire data at each cycle.\n"
         "-D\t\tFork to background\n"
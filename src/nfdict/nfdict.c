@@ -0,0 +1,307 @@
+/*
+ *  Copyright (c) 2024, Peter Haag
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * nfdict trains a ZSTD dictionary from the flow records of existing nfdump files.
+ * Set the dictionary file as 'zstddict' in nfdump.conf, to compress new zstd
+ * compressed files with this dictionary. Each file stores its dictionary in front
+ * of the data blocks, therefore files remain readable after the dictionary has been changed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zdict.h>
+
+#include "config.h"
+#include "flist.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfxV3.h"
+#include "util.h"
+
+// default dictionary size. Each file stores a copy of the dictionary
+#define DEFAULTDICTSIZE (16 * 1024)
+
+// max size of a single sample. The records of a data block are split into samples of
+// about the size of small blocks, written by collectors at low flow rates
+#define MAXSAMPLESIZE (16 * 1024)
+
+// stop collecting samples at this size
+#define MAXSAMPLEBUFF (256 * ONEMB)
+
+typedef struct samples_s {
+    void *buff;         // all samples concatenated
+    size_t buffSize;    // allocated size of buff
+    size_t totalSize;   // sum of all sample sizes
+    size_t *sizes;      // size of each sample
+    uint32_t numSamples;
+    uint32_t maxSamples;
+} samples_t;
+
+/* Function Prototypes */
+static void usage(char *name);
+
+static int AddSample(samples_t *samples, void *data, size_t size);
+
+static int CollectSamples(samples_t *samples, int verbose);
+
+static int TrainDictionary(samples_t *samples, size_t dictSize, char *wfile);
+
+/* Functions */
+
+static void usage(char *name) {
+    printf(
+        "usage %s [options] \n"
+        "-h\t\tthis text you see right here.\n"
+        "-q\t\tDo not print progress spinner and filenames.\n"
+        "-r <path>\tread input from single file or all files in directory.\n"
+        "-s <size>\tSize of dictionary in bytes. Accepts K as factor. Default 16K.\n"
+        "-w <file>\tName of dictionary file.\n",
+        name);
+} /* usage */
+
+static int AddSample(samples_t *samples, void *data, size_t size) {
+    if ((samples->totalSize + size) > samples->buffSize) {
+        size_t buffSize = samples->buffSize ? 2 * samples->buffSize : 16 * ONEMB;
+        void *buff = realloc(samples->buff, buffSize);
+        if (!buff) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        samples->buff = buff;
+        samples->buffSize = buffSize;
+    }
+    if (samples->numSamples == samples->maxSamples) {
+        uint32_t maxSamples = samples->maxSamples ? 2 * samples->maxSamples : 1024;
+        size_t *sizes = realloc(samples->sizes, maxSamples * sizeof(size_t));
+        if (!sizes) {
+            LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            return 0;
+        }
+        samples->sizes = sizes;
+        samples->maxSamples = maxSamples;
+    }
+
+    memcpy(samples->buff + samples->totalSize, data, size);
+    samples->totalSize += size;
+    samples->sizes[samples->numSamples++] = size;
+    return 1;
+
+}  // End of AddSample
+
+// collect the records of all data blocks as samples
+static int CollectSamples(samples_t *samples, int verbose) {
+    nffile_t *nffile = GetNextFile(NULL);
+    if (nffile == NULL) {
+        LogError("GetNextFile() error in %s line %d", __FILE__, __LINE__);
+        return 0;
+    }
+    if (nffile == EMPTY_LIST) {
+        LogError("Empty file list. No files to process");
+        return 0;
+    }
+    if (verbose) printf("Processing file: %s\n", nffile->fileName);
+
+    int done = 0;
+    while (!done && samples->totalSize < MAXSAMPLEBUFF) {
+        // get next data block from file
+        int ret = ReadBlock(nffile);
+
+        switch (ret) {
+            case NF_CORRUPT:
+            case NF_ERROR:
+                if (ret == NF_CORRUPT)
+                    LogError("Skip corrupt data file '%s'", nffile->fileName);
+                else
+                    LogError("Read error in file '%s': %s", nffile->fileName, strerror(errno));
+                // fall through - get next file in chain
+            case NF_EOF: {
+                nffile_t *next = GetNextFile(nffile);
+                if (next == EMPTY_LIST) {
+                    done = 1;
+                } else if (next == NULL) {
+                    done = 1;
+                    LogError("Unexpected end of file list");
+                } else if (verbose) {
+                    printf("Processing file: %s\n", nffile->fileName);
+                }
+                continue;
+            }
+        }
+
+        if (nffile->block_header->type != DATA_BLOCK_TYPE_3) continue;
+
+        // split the records of the block into samples
+        void *sampleStart = nffile->buff_ptr;
+        size_t sampleSize = 0;
+        recordHeader_t *recordHeader = (recordHeader_t *)nffile->buff_ptr;
+        uint32_t sumSize = 0;
+        for (int i = 0; i < nffile->block_header->NumRecords; i++) {
+            if ((sumSize + recordHeader->size) > ret || recordHeader->size < sizeof(recordHeader_t)) {
+                LogError("Corrupt data file. Inconsistent block size in %s line %d", __FILE__, __LINE__);
+                break;
+            }
+            if ((sampleSize + recordHeader->size) > MAXSAMPLESIZE && sampleSize) {
+                if (!AddSample(samples, sampleStart, sampleSize)) {
+                    CloseFile(nffile);
+                    DisposeFile(nffile);
+                    return 0;
+                }
+                sampleStart = (void *)recordHeader;
+                sampleSize = 0;
+            }
+            sampleSize += recordHeader->size;
+            sumSize += recordHeader->size;
+            recordHeader = (recordHeader_t *)((void *)recordHeader + recordHeader->size);
+        }
+        if (sampleSize && !AddSample(samples, sampleStart, sampleSize)) {
+            CloseFile(nffile);
+            DisposeFile(nffile);
+            return 0;
+        }
+    }
+
+    CloseFile(nffile);
+    DisposeFile(nffile);
+    return 1;
+
+}  // End of CollectSamples
+
+static int TrainDictionary(samples_t *samples, size_t dictSize, char *wfile) {
+    if (samples->numSamples == 0) {
+        LogError("No flow records found to train a dictionary");
+        return 0;
+    }
+
+    void *dict = malloc(dictSize);
+    if (!dict) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    size_t size = ZDICT_trainFromBuffer(dict, dictSize, samples->buff, samples->sizes, samples->numSamples);
+    if (ZDICT_isError(size)) {
+        LogError("Failed to train dictionary from %u samples: %s", samples->numSamples, ZDICT_getErrorName(size));
+        free(dict);
+        return 0;
+    }
+
+    int fd = open(wfile, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        LogError("Failed to open file %s: '%s'", wfile, strerror(errno));
+        free(dict);
+        return 0;
+    }
+    ssize_t ret = write(fd, dict, size);
+    close(fd);
+    free(dict);
+    if (ret != (ssize_t)size) {
+        LogError("write() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return 0;
+    }
+
+    printf("Dictionary %s: %zu bytes, trained from %u samples with %zu bytes\n", wfile, size, samples->numSamples, samples->totalSize);
+    return 1;
+
+}  // End of TrainDictionary
+
+int main(int argc, char **argv) {
+    char *wfile = NULL;
+    size_t dictSize = DEFAULTDICTSIZE;
+    flist_t flist = {0};
+
+    int verbose = 1;
+    int c;
+    while ((c = getopt(argc, argv, "hqr:s:w:")) != EOF) {
+        switch (c) {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'r':
+                CheckArgLen(optarg, MAXPATHLEN);
+                if (TestPath(optarg, S_IFREG) == PATH_OK) {
+                    flist.single_file = strdup(optarg);
+                } else if (TestPath(optarg, S_IFDIR) == PATH_OK) {
+                    flist.multiple_files = strdup(optarg);
+                } else {
+                    LogError("%s is not a file or directory", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's': {
+                char *end;
+                dictSize = strtoul(optarg, &end, 10);
+                if (*end == 'k' || *end == 'K') {
+                    dictSize *= 1024;
+                    end++;
+                }
+                if (*end || dictSize < 1024 || dictSize > MAXDICTSIZE) {
+                    LogError("Invalid dictionary size '%s'. Expect 1K .. %uK", optarg, MAXDICTSIZE / 1024);
+                    exit(EXIT_FAILURE);
+                }
+            } break;
+            case 'w':
+                CheckArgLen(optarg, MAXPATHLEN);
+                wfile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(0);
+        }
+    }
+
+    if (wfile == NULL) {
+        LogError("Expect -w <file>");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    queue_t *fileList = SetupInputFileSequence(&flist);
+    if (!fileList || !Init_nffile(0, fileList)) exit(EXIT_FAILURE);
+
+    samples_t samples = {0};
+    if (!CollectSamples(&samples, verbose) || !TrainDictionary(&samples, dictSize, wfile)) exit(EXIT_FAILURE);
+
+    free(samples.buff);
+    free(samples.sizes);
+    return 0;
+}
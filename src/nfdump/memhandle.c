@@ -69,96 +69,112 @@ static MemHandler_t *MemHandler = NULL;
 
 #define MaxMemBlocks 256
 
-static int nfalloc_Init(uint32_t memBlockSize) {
-    MemHandler = (MemHandler_t *)calloc(1, sizeof(MemHandler_t));
-    if (!MemHandler) {
+// create a new memory arena. An arena returned by nfalloc_New may be used by its owner thread
+// with nfmalloc_arena() without any locking
+static MemHandler_t *nfalloc_New(uint32_t memBlockSize) {
+    MemHandler_t *handler = (MemHandler_t *)calloc(1, sizeof(MemHandler_t));
+    if (!handler) {
         LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        return 0;
+        return NULL;
     }
 
-    MemHandler->memblock = (void **)calloc(MaxMemBlocks, sizeof(void *));
-    if (!MemHandler->memblock) {
+    handler->memblock = (void **)calloc(MaxMemBlocks, sizeof(void *));
+    if (!handler->memblock) {
         LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        return 0;
+        free(handler);
+        return NULL;
     }
 
     if (memBlockSize == 0) memBlockSize = DefaultMemBlockSize;
 
-    MemHandler->BlockSize = memBlockSize;
+    handler->BlockSize = memBlockSize;
+    handler->MaxBlocks = MaxMemBlocks;
+    handler->NumBlocks = 0;
+    handler->CurrentBlock = -1;        // non allocated
+    handler->Allocted = memBlockSize;  // force new allocation with next nfmalloc
+    handler->lock = 0;
 
-    MemHandler->memblock[0] = calloc(1, memBlockSize);
-    if (!MemHandler->memblock[0]) {
-        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
-        return 0;
+    return handler;
+
+}  // End of nfalloc_New
+
+// free all memory blocks of an arena and the arena itself
+static void nfalloc_Dispose(MemHandler_t *handler) {
+    if (!handler) return;
+
+    for (int i = 0; i < handler->NumBlocks; i++) {
+        free(handler->memblock[i]);
     }
+    handler->NumBlocks = 0;
+    handler->CurrentBlock = -1;
+    handler->Allocted = handler->BlockSize;
 
-    MemHandler->MaxBlocks = MaxMemBlocks;
-    MemHandler->NumBlocks = 0;
-    MemHandler->CurrentBlock = -1;        // non allocated
-    MemHandler->Allocted = memBlockSize;  // force new allocation with next nfmalloc
-    MemHandler->lock = 0;
+    free((void *)handler->memblock);
+    handler->memblock = NULL;
+    handler->MaxBlocks = 0;
+    free((void *)handler);
 
-    return 1;
+}  // End of nfalloc_Dispose
+
+static int nfalloc_Init(uint32_t memBlockSize) {
+    MemHandler = nfalloc_New(memBlockSize);
+    return MemHandler != NULL;
 
 }  // End of nfalloc_Init
 
 static void nfalloc_free(void) {
-    if (!MemHandler) return;
-
-    for (int i = 0; i < MemHandler->NumBlocks; i++) {
-        free(MemHandler->memblock[i]);
-    }
-    MemHandler->NumBlocks = 0;
-    MemHandler->CurrentBlock = -1;
-    MemHandler->Allocted = MemHandler->BlockSize;
-
-    free((void *)MemHandler->memblock);
-    MemHandler->memblock = NULL;
-    MemHandler->MaxBlocks = 0;
-    free((void *)MemHandler);
+    nfalloc_Dispose(MemHandler);
+    MemHandler = NULL;
 
 }  // End of nfalloc_free
 
-static inline void *nfmalloc(size_t size) {
+// allocate memory from an arena, which is not shared with other threads - no locking
+static inline void *nfmalloc_arena(MemHandler_t *handler, size_t size) {
     // make sure size of memory is aligned
     size_t aligned_size = (((size) + ALIGN_BYTES) & ~ALIGN_BYTES);
 
-    GetLock(MemHandler);
-    if ((MemHandler->Allocted + aligned_size) <= MemHandler->BlockSize) {
+    if ((handler->Allocted + aligned_size) <= handler->BlockSize) {
         // enough space available in current memblock
-        void *p = MemHandler->memblock[MemHandler->CurrentBlock] + MemHandler->Allocted;
-        MemHandler->Allocted += aligned_size;
+        void *p = handler->memblock[handler->CurrentBlock] + handler->Allocted;
+        handler->Allocted += aligned_size;
         dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lx\n", size, aligned_size, (long unsigned)p);
-        ReleaseLock(MemHandler);
         return p;
     }
 
     // not enough space - allocate a new memblock
 
-    MemHandler->CurrentBlock++;
-    if (MemHandler->CurrentBlock >= MemHandler->MaxBlocks) {
+    handler->CurrentBlock++;
+    if (handler->CurrentBlock >= handler->MaxBlocks) {
         // we run out in memblock array - re-allocate memblock array
-        MemHandler->MaxBlocks += MaxMemBlocks;
-        MemHandler->memblock = (void **)realloc(MemHandler->memblock, MemHandler->MaxBlocks * sizeof(void *));
-        if (!MemHandler->memblock) {
+        handler->MaxBlocks += MaxMemBlocks;
+        handler->memblock = (void **)realloc(handler->memblock, handler->MaxBlocks * sizeof(void *));
+        if (!handler->memblock) {
             LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
             exit(255);
         }
     }
 
     // allocate new memblock
-    void *p = malloc(MemHandler->BlockSize);
+    void *p = malloc(handler->BlockSize);
     if (!p) {
         LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
         exit(255);
     }
-    MemHandler->memblock[MemHandler->CurrentBlock] = p;
-    MemHandler->Allocted = aligned_size;
-    MemHandler->NumBlocks++;
-    ReleaseLock(MemHandler);
+    handler->memblock[handler->CurrentBlock] = p;
+    handler->Allocted = aligned_size;
+    handler->NumBlocks++;
     dbg_printf("Mem Handle: Requested: %zu, aligned: %zu, ptr: %lu\n", size, aligned_size, (long unsigned)p);
     return p;
 
+}  // End of nfmalloc_arena
+
+// allocate memory from the shared arena
+static inline void *nfmalloc(size_t size) {
+    GetLock(MemHandler);
+    void *p = nfmalloc_arena(MemHandler, size);
+    ReleaseLock(MemHandler);
+    return p;
+
 }  // End of nfmalloc
 
 static inline void *nfcalloc(size_t count, size_t size) {
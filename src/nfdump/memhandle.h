@@ -31,10 +31,16 @@
 #ifndef _MEMHANDLE_H
 #define _MEMHANDLE_H 1
 
+static struct MemHandler_s *nfalloc_New(uint32_t memBlockSize);
+
+static void nfalloc_Dispose(struct MemHandler_s *handler);
+
 static int nfalloc_Init(uint32_t memBlockSize);
 
 static void nfalloc_free(void);
 
+static inline void *nfmalloc_arena(struct MemHandler_s *handler, size_t size);
+
 static inline void *nfmalloc(size_t size);
 
 static inline void *nfcalloc(size_t count, size_t size);
@@ -36,6 +36,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -79,8 +80,37 @@ static uint32_t processed = 0;
 static uint32_t passed = 0;
 static bool HasGeoDB = false;
 static uint32_t skipped_blocks = 0;
+static int processThreads = 0;
 static uint64_t t_first_flow, t_last_flow;
 
+// block of V3 records to be processed by a process worker
+typedef struct processJob_s {
+    dataBlock_t *dataBlock;
+    char *ident;  // ident of the file of this block
+} processJob_t;
+
+// parameters and thread local state of a process worker
+typedef struct processWorker_s {
+    pthread_t tid;
+    queue_t *jobQueue;
+    void *engine;
+    int flow_stat;
+    int element_stat;
+    int hasTimeWindow;
+    uint64_t twin_msecFirst;
+    uint64_t twin_msecLast;
+
+    flowCache_t *flowCache;  // thread local flow cache, NULL: use shared flow cache
+    statTable_t *statTable;  // thread local stat tables, NULL: use shared stat tables
+    recordHandle_t *handles;  // FILTERBATCH record handles for batch filtering
+    stat_record_t stat_record;
+    uint32_t processed;
+    uint32_t passed;
+} processWorker_t;
+
+// the flow cache in bidir mode and tables, which could not be allocated per worker, are shared
+static pthread_mutex_t aggregateLock = PTHREAD_MUTEX_INITIALIZER;
+
 extension_map_list_t *extension_map_list;
 
 extern exporter_t **exporter_list;
@@ -95,6 +125,8 @@ static void PrintSummary(stat_record_t *stat_record, outputParams_t *outputParam
 static stat_record_t process_data(void *engine, char *wfile, int element_stat, int flow_stat, int sort_flows, RecordPrinter_t print_record,
                                   timeWindow_t *timeWindow, uint64_t limitRecords, outputParams_t *outputParams, int compress);
 
+static void *processWorker(void *arg);
+
 /* Functions */
 
 #include "nfdump_inline.c"
@@ -122,6 +154,7 @@ static void usage(char *name) {
         "-N\t\tPrint plain numbers\n"
         "-s <expr>[/<order>]\tGenerate statistics for <expr> any valid record element.\n"
         "\t\tand ordered by <order>: packets, bytes, flows, bps pps and bpp.\n"
+        "\t\t<expr>:a[<counters>] approximates the statistic in fixed memory.\n"
         "-q\t\tQuiet: Do not print the header and bottom stat lines.\n"
         "-i <ident>\tChange Ident to <ident> in file given by -r.\n"
         "-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 - 4: ZSTD"
@@ -130,6 +163,9 @@ static void usage(char *name) {
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=<comp>:delta\tDelta encode flows before compression.\n"
+        "-z=<comp>:column\tColumn encode flows before compression.\n"
+        "-z=<comp>:adapt\tAdapt compression per block to the writer backlog.\n"
         "-l <expr>\tSet limit on packets for line and packed output format.\n"
         "\t\tkey: 32 character string or 64 digit hex string starting with 0x.\n"
         "-L <expr>\tSet limit on bytes for line and packed output format.\n"
@@ -159,6 +195,7 @@ static void usage(char *name) {
         "-E <file>\tPrint exporter and sampling info for collected flows.\n"
         "-v <file>\tverify netflow data file. Print version and blocks.\n"
         "-W <num>\tOptionally set the number of workers to compress flows\n"
+        "-P <num>\tProcess flows with <num> threads for statistics and aggregation.\n"
         "-x <file>\tverify extension records in netflow data file.\n"
         "-X\t\tDump Filtertable and exit (debug option).\n"
         "-Z\t\tCheck filter syntax and exit.\n"
@@ -233,6 +270,208 @@ static int SetStat(char *str, int *element_stat, int *flow_stat) {
 
 }  // End of SetStat
 
+// time based filter - match flows within the time window
+static inline int MatchTimeWindow(recordHandle_t *recordHandle, uint64_t twin_msecFirst, uint64_t twin_msecLast) {
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+    if (genericFlow == NULL) return 0;
+    return genericFlow->msecFirst > twin_msecFirst && genericFlow->msecLast < twin_msecLast;
+}  // End of MatchTimeWindow
+
+// add a matching record to the flow cache and/or element statistics
+static inline void AggregateRecord(recordHandle_t *recordHandle, int flow_stat, int element_stat) {
+    if (flow_stat) {
+        AddFlowCache(recordHandle);
+        if (element_stat) {
+            AddElementStat(recordHandle);
+        }
+    } else if (element_stat) {
+        AddElementStat(recordHandle);
+    }
+}  // End of AggregateRecord
+
+// map up to numRecords consecutive V3 records of a block, starting at record_ptr, to handles and select the
+// records within the time window for FilterRecordBatch(). The batch ends before the first non V3 record or
+// the end of the remaining size bytes of the block. Returns the number of mapped records
+static uint32_t MapRecordBatch(recordHandle_t *handles, uint64_t *selection, record_header_t *record_ptr, uint32_t numRecords, uint32_t size,
+                               uint32_t processed, int hasTimeWindow, uint64_t twin_msecFirst, uint64_t twin_msecLast) {
+    if (numRecords > FILTERBATCH) numRecords = FILTERBATCH;
+    memset((void *)selection, 0, (FILTERBATCH / 64) * sizeof(uint64_t));
+
+    uint32_t sumSize = 0;
+    uint32_t i = 0;
+    for (; i < numRecords; i++) {
+        // inconsistent blocks are reported by the record loop
+        if ((sumSize + record_ptr->size) > size || record_ptr->size < sizeof(record_header_t)) break;
+        if (record_ptr->type != V3Record) break;
+
+        MapRecordHandle(&handles[i], (recordHeaderV3_t *)record_ptr, processed + 1 + i);
+        if (!hasTimeWindow || MatchTimeWindow(&handles[i], twin_msecFirst, twin_msecLast)) selection[i >> 6] |= 1ULL << (i & 0x3F);
+        sumSize += record_ptr->size;
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+    return i;
+
+}  // End of MapRecordBatch
+
+// returns true, if the block contains V3 records only, which are handed to a process worker
+static int IsV3Block(dataBlock_t *dataBlock, uint32_t size) {
+    if (dataBlock->type != DATA_BLOCK_TYPE_3) return 0;
+
+    uint32_t sumSize = 0;
+    record_header_t *record_ptr = (record_header_t *)((void *)dataBlock + sizeof(dataBlock_t));
+    for (uint32_t i = 0; i < dataBlock->NumRecords; i++) {
+        // inconsistent blocks are reported by the record loop
+        if ((sumSize + record_ptr->size) > size || record_ptr->size < sizeof(record_header_t)) return 0;
+        if (record_ptr->type != V3Record) return 0;
+        sumSize += record_ptr->size;
+        record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+    }
+    return 1;
+
+}  // End of IsV3Block
+
+// map the V3 records of a data block in batches and pass them to the filter engine for sampling
+// returns 1, if sampling is complete
+static int SampleFilterBlock(void *engine, dataBlock_t *dataBlock, const char *ident, recordHandle_t *handles) {
+    record_header_t *record_ptr = (record_header_t *)((void *)dataBlock + sizeof(dataBlock_t));
+    uint32_t recordsLeft = dataBlock->NumRecords;
+    while (recordsLeft) {
+        uint32_t numRecords = recordsLeft < FILTERBATCH ? recordsLeft : FILTERBATCH;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            MapRecordHandle(&handles[i], (recordHeaderV3_t *)record_ptr, i + 1);
+            record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+        }
+        if (FilterSample(engine, handles, numRecords, ident)) return 1;
+        recordsLeft -= numRecords;
+    }
+    return 0;
+
+}  // End of SampleFilterBlock
+
+// aggregate the matching records of a filtered batch. The records are added to the thread local
+// flow cache and stat tables in parallel with the other workers. Shared tables are updated with
+// the aggregate lock held
+static void AggregateBatch(processWorker_t *worker, recordHandle_t **selected, uint32_t numSelected) {
+    int flow_stat = worker->flow_stat;
+    if (flow_stat && worker->flowCache) {
+        AddLocalFlowBatch(worker->flowCache, selected, numSelected);
+        flow_stat = 0;
+    }
+    int element_stat = worker->element_stat;
+    if (element_stat && worker->statTable) {
+        for (uint32_t i = 0; i < numSelected; i++) AddLocalElementStat(worker->statTable, selected[i]);
+        element_stat = 0;
+    }
+    if (!flow_stat && !element_stat) return;
+
+    pthread_mutex_lock(&aggregateLock);
+    for (uint32_t i = 0; i < numSelected; i++) AggregateRecord(selected[i], flow_stat, element_stat);
+    pthread_mutex_unlock(&aggregateLock);
+
+}  // End of AggregateBatch
+
+// filter all records of a block in batches and aggregate the matching records of each batch
+// with the record handles mapped for filtering
+static void ProcessV3Block(processWorker_t *worker, dataBlock_t *dataBlock, const char *ident) {
+    record_header_t *record_ptr = (record_header_t *)((void *)dataBlock + sizeof(dataBlock_t));
+    uint32_t recordsLeft = dataBlock->NumRecords;
+    while (recordsLeft) {
+        uint64_t selection[FILTERBATCH / 64];
+        uint32_t numRecords = MapRecordBatch(worker->handles, selection, record_ptr, recordsLeft, dataBlock->size, worker->processed, worker->hasTimeWindow,
+                                             worker->twin_msecFirst, worker->twin_msecLast);
+        // the block was checked by IsV3Block()
+        recordHeaderV3_t *lastRecord = worker->handles[numRecords - 1].recordHeaderV3;
+        record_ptr = (record_header_t *)((void *)lastRecord + lastRecord->size);
+        FilterRecordBatch(worker->engine, worker->handles, numRecords, ident, selection);
+
+        recordHandle_t *selected[FILTERBATCH];
+        uint32_t numSelected = 0;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            if (selection[i >> 6] & (1ULL << (i & 0x3F))) {
+                UpdateStatRecord(&worker->stat_record, &worker->handles[i]);
+                selected[numSelected++] = &worker->handles[i];
+            }
+        }
+        if (numSelected) AggregateBatch(worker, selected, numSelected);
+
+        worker->processed += numRecords;
+        worker->passed += numSelected;
+        recordsLeft -= numRecords;
+    }
+
+}  // End of ProcessV3Block
+
+__attribute__((noreturn)) static void *processWorker(void *arg) {
+    processWorker_t *worker = (processWorker_t *)arg;
+
+    while (1) {
+        processJob_t *job = queue_pop(worker->jobQueue);
+        if (job == QUEUE_CLOSED) break;
+
+        ProcessV3Block(worker, job->dataBlock, job->ident);
+        ReleaseDataBlock(job->dataBlock);
+        free(job->ident);
+        free(job);
+    }
+
+    pthread_exit(NULL);
+    /* UNREACHED */
+
+}  // End of processWorker
+
+// start numWorkers process workers, which filter and aggregate the V3 blocks pushed into jobQueue
+static processWorker_t *StartProcessWorkers(int numWorkers, queue_t *jobQueue, void *engine, int flow_stat, int element_stat, timeWindow_t *timeWindow,
+                                            uint64_t twin_msecFirst, uint64_t twin_msecLast) {
+    processWorker_t *workers = calloc(numWorkers, sizeof(processWorker_t));
+    if (!workers) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        processWorker_t *worker = &workers[i];
+        worker->jobQueue = jobQueue;
+        worker->engine = engine;
+        worker->flow_stat = flow_stat;
+        worker->element_stat = element_stat;
+        worker->hasTimeWindow = timeWindow != NULL;
+        worker->twin_msecFirst = twin_msecFirst;
+        worker->twin_msecLast = twin_msecLast;
+        worker->stat_record.firstseen = 0x7fffffffffffffffLL;
+        worker->flowCache = flow_stat ? NewFlowCache() : NULL;
+        worker->statTable = element_stat ? NewStatTable() : NULL;
+        worker->handles = calloc(FILTERBATCH, sizeof(recordHandle_t));
+        if (!worker->handles) {
+            LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        int err = pthread_create(&worker->tid, NULL, processWorker, (void *)worker);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return workers;
+
+}  // End of StartProcessWorkers
+
+// wait for all process workers to finish, add their counters and stat records and merge their flow caches
+static void JoinProcessWorkers(processWorker_t *workers, int numWorkers, stat_record_t *stat_record) {
+    for (int i = 0; i < numWorkers; i++) {
+        processWorker_t *worker = &workers[i];
+        pthread_join(worker->tid, NULL);
+        SumStatRecords(stat_record, &worker->stat_record);
+        processed += worker->processed;
+        passed += worker->passed;
+        free(worker->handles);
+    }
+    free(workers);
+
+    MergeFlowCaches(numWorkers);
+    MergeStatTables(numWorkers);
+
+}  // End of JoinProcessWorkers
+
 static stat_record_t process_data(void *engine, char *wfile, int element_stat, int flow_stat, int sort_flows, RecordPrinter_t print_record,
                                   timeWindow_t *timeWindow, uint64_t limitRecords, outputParams_t *outputParams, int compress) {
     nffile_t *nffile_w, *nffile_r;
@@ -250,7 +489,11 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
             twin_msecLast = timeWindow->last * 1000LL;
         else
             twin_msecLast = 0x7FFFFFFFFFFFFFFFLL;
+        // let nfreader skip data blocks outside the time window
+        SetIndexTimeWindow(twin_msecFirst, twin_msecLast);
     }
+    // let nfreader skip data blocks, which can not match the filter
+    SetIndexFilter(engine);
 
     // do not print flows when doing any stats are sorting
     if (sort_flows || flow_stat || element_stat) {
@@ -291,11 +534,49 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
         SetIdent(nffile_w, nffile_r->ident);
     }
 
-    recordHandle_t *recordHandle = (recordHandle_t *)calloc(1, sizeof(recordHandle_t));
-    if (!recordHandle) {
+    recordHandle_t *singleHandle = (recordHandle_t *)calloc(1, sizeof(recordHandle_t));
+    if (!singleHandle) {
+        LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        return stat_record;
+    }
+
+    // with a fast filter, consecutive V3 records are mapped and filtered in batches of FILTERBATCH records
+    int batchFilter = FilterBatchable(engine);
+    recordHandle_t *batchHandles = (recordHandle_t *)calloc(FILTERBATCH, sizeof(recordHandle_t));
+    if (!batchHandles) {
         LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
         return stat_record;
     }
+    uint64_t batchSelection[FILTERBATCH / 64];
+
+    // statistics and aggregations filter and aggregate blocks of V3 records in parallel
+    // all other blocks are processed by this thread
+    // for statistics and aggregations, the first V3 records are sampled to reorder the AND/OR blocks
+    // of the filter by the selectivity of their elements. Other runs do not filter enough records
+    int sampleFilter = (flow_stat || element_stat) && FilterReorderable(engine);
+
+    int numWorkers = 0;
+    queue_t *jobQueue = NULL;
+    processWorker_t *workers = NULL;
+    // V3 blocks read, while the filter is sampled, are held back from the workers
+    processJob_t **heldJobs = NULL;
+    uint32_t numHeld = 0;
+    uint32_t maxHeld = 0;
+    if (processThreads > 1 && (flow_stat || element_stat) && limitRecords == 0) {
+        if (FilterThreadSafe(engine)) {
+            size_t queueSize = 1;
+            while (queueSize < (2 * processThreads)) queueSize <<= 1;
+            jobQueue = queue_init(queueSize);
+            if (!jobQueue) exit(EXIT_FAILURE);
+            queue_open(jobQueue);
+            numWorkers = processThreads;
+            workers = StartProcessWorkers(numWorkers, jobQueue, engine, flow_stat, element_stat, timeWindow, twin_msecFirst, twin_msecLast);
+            if (!workers) exit(EXIT_FAILURE);
+        } else {
+            LogError("Filter with regex can not be processed in parallel. Use 1 thread");
+        }
+    }
+
     int done = 0;
     while (!done) {
         // get next data block from file
@@ -341,8 +622,43 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
             continue;
         }
 
+        if (sampleFilter && IsV3Block(nffile_r->block_header, ret)) {
+            sampleFilter = SampleFilterBlock(engine, nffile_r->block_header, nffile_r->ident, batchHandles) == 0;
+        }
+
+        if (numWorkers && IsV3Block(nffile_r->block_header, ret)) {
+            processJob_t *job = malloc(sizeof(processJob_t));
+            if (!job) {
+                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            job->ident = nffile_r->ident ? strdup(nffile_r->ident) : NULL;
+            job->dataBlock = TakeBlock(nffile_r);
+            if (!job->dataBlock) exit(EXIT_FAILURE);
+            if (sampleFilter) {
+                // the workers must not filter any records, until the filter is reordered
+                if (numHeld == maxHeld) {
+                    maxHeld = maxHeld ? 2 * maxHeld : 16;
+                    heldJobs = realloc(heldJobs, maxHeld * sizeof(processJob_t *));
+                    if (!heldJobs) {
+                        LogError("realloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                heldJobs[numHeld++] = job;
+                continue;
+            }
+            for (uint32_t i = 0; i < numHeld; i++) queue_push(jobQueue, heldJobs[i]);
+            numHeld = 0;
+            queue_push(jobQueue, job);
+            continue;
+        }
+
         uint32_t sumSize = 0;
         record_header_t *record_ptr = nffile_r->buff_ptr;
+        // the current batch holds the records batchFirst .. batchFirst + batchSize - 1 of this block
+        uint32_t batchFirst = 0;
+        uint32_t batchSize = 0;
         dbg_printf("Block has %i records\n", nffile_r->block_header->NumRecords);
         for (int i = 0; i < nffile_r->block_header->NumRecords && !done; i++) {
             record_header_t *process_ptr = record_ptr;
@@ -355,28 +671,39 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
             switch (record_ptr->type) {
                 case V3Record:
                 case CommonRecordType: {
-                    if (__builtin_expect(record_ptr->type == CommonRecordType, 0)) {
-                        dbg_printf("Convert nfdump 1.6.x v2 record\n");
-                        process_ptr = ConvertRecordV2((common_record_t *)record_ptr);
-                        if (!process_ptr) goto NEXT;
-                    }
-                    MapRecordHandle(recordHandle, (recordHeaderV3_t *)process_ptr, ++processed);
-
-                    // Time based filter
-                    // if no time filter is given, the result is always true
+                    recordHandle_t *recordHandle;
                     int match = 1;
-                    if (timeWindow) {
-                        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-                        if (genericFlow) {
-                            match = (genericFlow->msecFirst > twin_msecFirst && genericFlow->msecLast < twin_msecLast);
-                        } else {
-                            match = 0;
+                    if (batchFilter && record_ptr->type == V3Record) {
+                        if (i >= (batchFirst + batchSize)) {
+                            // map and filter the next batch of V3 records with user supplied time window and filter
+                            batchFirst = i;
+                            batchSize = MapRecordBatch(batchHandles, batchSelection, record_ptr, nffile_r->block_header->NumRecords - i,
+                                                       ret - sumSize + record_ptr->size, processed, timeWindow != NULL, twin_msecFirst, twin_msecLast);
+                            FilterRecordBatch(engine, batchHandles, batchSize, nffile_r->ident, batchSelection);
                         }
-                    }
+                        uint32_t batchIndex = i - batchFirst;
+                        recordHandle = &batchHandles[batchIndex];
+                        processed++;
+                        match = (batchSelection[batchIndex >> 6] & (1ULL << (batchIndex & 0x3F))) != 0;
+                    } else {
+                        if (__builtin_expect(record_ptr->type == CommonRecordType, 0)) {
+                            dbg_printf("Convert nfdump 1.6.x v2 record\n");
+                            process_ptr = ConvertRecordV2((common_record_t *)record_ptr);
+                            if (!process_ptr) goto NEXT;
+                        }
+                        recordHandle = singleHandle;
+                        MapRecordHandle(recordHandle, (recordHeaderV3_t *)process_ptr, ++processed);
 
-                    if (match) {
-                        // filter netflow record with user supplied filter
-                        match = FilterRecord(engine, recordHandle, nffile_r->ident);
+                        // Time based filter
+                        // if no time filter is given, the result is always true
+                        if (timeWindow) {
+                            match = MatchTimeWindow(recordHandle, twin_msecFirst, twin_msecLast);
+                        }
+
+                        if (match) {
+                            // filter netflow record with user supplied filter
+                            match = FilterRecord(engine, recordHandle, nffile_r->ident);
+                        }
                     }
                     if (match == 0) {  // record failed to pass all filters
                         // go to next record
@@ -401,13 +728,10 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
 #endif
                     UpdateStatRecord(&stat_record, recordHandle);
 
-                    if (flow_stat) {
-                        AddFlowCache(recordHandle);
-                        if (element_stat) {
-                            AddElementStat(recordHandle);
-                        }
-                    } else if (element_stat) {
-                        AddElementStat(recordHandle);
+                    if (flow_stat || element_stat) {
+                        if (numWorkers) pthread_mutex_lock(&aggregateLock);
+                        AggregateRecord(recordHandle, flow_stat, element_stat);
+                        if (numWorkers) pthread_mutex_unlock(&aggregateLock);
                     } else if (sort_flows) {
                         InsertFlow(recordHandle);
                     } else {
@@ -488,7 +812,18 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
 
     }  // while
 
+    if (numWorkers) {
+        // less than FILTERSAMPLE records - the filter is not reordered
+        for (uint32_t i = 0; i < numHeld; i++) queue_push(jobQueue, heldJobs[i]);
+        free(heldJobs);
+        queue_close(jobQueue);
+        JoinProcessWorkers(workers, numWorkers, &stat_record);
+        queue_free(jobQueue);
+    }
+
     CloseFile(nffile_r);
+    // no more files are read - release the files opened ahead
+    DisposePrefetcher();
 
     // flush output file
     if (write_file) {
@@ -506,6 +841,8 @@ static stat_record_t process_data(void *engine, char *wfile, int element_stat, i
     }
 
     DisposeFile(nffile_r);
+    free(batchHandles);
+    free(singleHandle);
     return stat_record;
 
 }  // End of process_data
@@ -566,7 +903,7 @@ int main(int argc, char **argv) {
 
     Ident[0] = '\0';
     int c;
-    while ((c = getopt(argc, argv, "6aA:Bbc:C:D:E:G:s:ghn:i:jf:qyz::r:v:w:J:M:NImO:R:XZt:TVv:W:x:o:")) != EOF) {
+    while ((c = getopt(argc, argv, "6aA:Bbc:C:D:E:G:s:ghn:i:jf:qyz::r:v:w:J:M:NImO:P:R:XZt:TVv:W:x:o:")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -797,6 +1134,14 @@ int main(int argc, char **argv) {
                     exit(EXIT_FAILURE);
                 }
                 break;
+            case 'P':
+                CheckArgLen(optarg, 16);
+                processThreads = atoi(optarg);
+                if (processThreads < 1 || processThreads > MAXWORKERS) {
+                    LogError("Number of process threads out of range 1..%d", MAXWORKERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case '6':  // print long IPv6 addr
                 Setv6Mode(1);
                 break;
@@ -1017,6 +1362,7 @@ int main(int argc, char **argv) {
     sum_stat = process_data(engine, wfile, element_stat, aggregate || flow_stat, print_order != NULL, print_record, flist.timeWindow, limitRecords,
                             outputParams, compress);
     nfprof_end(&profile_data, processed);
+    skipped_blocks += ReportSkippedBlocks();
 
     if (passed == 0) {
         printf("No matching flows\n");
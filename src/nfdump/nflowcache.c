@@ -34,26 +34,30 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "blocksort.h"
 #include "config.h"
 #include "exporter.h"
 #include "ja3/ja3.h"
-#include "khash.h"
 #include "klist.h"
 #include "maxmind.h"
 #include "memhandle.h"
+#include "nfconf.h"
 #include "nfdump.h"
 #include "nffile.h"
 #include "nfxV3.h"
@@ -153,11 +157,8 @@ static struct aggregationElement_s {
 /* Element of the flow hash ( cache ) */
 typedef struct FlowHashRecord {
     // record chain - for FlowList
-    union {
-        struct FlowHashRecord *next;
-        uint8_t *hashkey;
-    };
-    uint32_t hash;     // the full 32bit hash value - cached for khash resize
+    struct FlowHashRecord *next;
+    uint32_t hash;     // the full 32bit hash value - selects the merge and spill partition
     uint16_t hashLen;  // lenhth of hashKey
     uint8_t inFlags;   // tcp in flags
     uint8_t outFlags;  // tcp out flags XXX unused currently
@@ -251,29 +252,123 @@ typedef struct SortElement {
     uint64_t count;
 } SortElement_t;
 
-// definitions for khash flow cache
+// definitions for the flow table
 typedef uint8_t *hashkey_t;  // hash key - byte sequence
 
+#ifdef SUPERFASTHASH
 static inline uint32_t SuperFastHash(const char *data, int len);
+#define FlowKeyHash(key, len) SuperFastHash((const char *)(key), (len))
+#else
+static inline uint32_t FlowKeyHash(const void *key, size_t len);
+#endif
+
+// load 8 key bytes - keys are not necessarily 8 byte aligned
+static inline uint64_t LoadKey64(const uint8_t *p) {
+    uint64_t v;
+    memcpy((void *)&v, (void *)p, sizeof(uint64_t));
+    return v;
+}  // End of LoadKey64
+
+// compare two hash keys of the same length. The default IPv4 and IPv6 5-tuple keys
+// FlowKeyV4_t and FlowKeyV6_t are compared as 64bit words without any branch
+static inline int FlowKeyEqual(const uint8_t *k1, const uint8_t *k2, size_t len) {
+    switch (len) {
+        case sizeof(FlowKeyV4_t):
+            return ((LoadKey64(k1) ^ LoadKey64(k2)) | (LoadKey64(k1 + 8) ^ LoadKey64(k2 + 8))) == 0;
+        case sizeof(FlowKeyV6_t):
+            return ((LoadKey64(k1) ^ LoadKey64(k2)) | (LoadKey64(k1 + 8) ^ LoadKey64(k2 + 8)) | (LoadKey64(k1 + 16) ^ LoadKey64(k2 + 16)) |
+                    (LoadKey64(k1 + 24) ^ LoadKey64(k2 + 24)) | (LoadKey64(k1 + 32) ^ LoadKey64(k2 + 32))) == 0;
+    }
+    // custom aggregation keys
+    while (len >= sizeof(uint64_t)) {
+        if (LoadKey64(k1) != LoadKey64(k2)) return 0;
+        k1 += sizeof(uint64_t);
+        k2 += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+    return len == 0 || memcmp((void *)k1, (void *)k2, len) == 0;
+}  // End of FlowKeyEqual
 
 /*
-// hash func - reduce byte sequence to kh_int
-static kh_inline khint_t __HashFunc(const FlowHashRecord_t record) {
-        return SuperFastHash((char *)record.hashkey, hashKeyLen);
-}
-*/
-#define __HashFunc(k) (k).hash
+ * Flow table - open addressing with linear probing
+ * A slot holds the hash value of a flow and the index of its entry. The entries are stored
+ * in insert order in two dense arrays: the keys, inline with keyStride bytes per entry and
+ * zero padded, and the flows with their counters and record. A probe reads the compact slot
+ * array and the key of a matching hash value only. The flow is touched, once the key matches.
+ * The tag of a key passed around holds the key length in the upper and the hash in the lower 32bit.
+ */
+typedef struct flowSlot_s {
+    uint32_t hash;   // hash value of the key
+    uint32_t entry;  // entry index + 1, 0: empty slot
+} flowSlot_t;
+
+typedef struct flowTable_s {
+    flowSlot_t *slot;
+    uint8_t *keys;            // inline keys, keyStride bytes per entry
+    FlowHashRecord_t *flows;  // flow counters and record of each entry
+    uint32_t mask;            // number of slots - 1
+    uint32_t size;            // number of entries
+    uint32_t keyStride;       // bytes per key
+} flowTable_t;
+
+#define FlowTag(hash, len) (((uint64_t)(len) << 32) | (uint64_t)(hash))
+#define FlowTableMinSize 4096
+// the entries fill up to a load factor of 0.75 of the slots
+#define FlowTableEntries(numSlots) (((numSlots) >> 2) * 3)
+#define FlowTableMemory(table) \
+    ((size_t)((table)->mask + 1) * sizeof(flowSlot_t) + (size_t)FlowTableEntries((table)->mask + 1) * ((table)->keyStride + sizeof(FlowHashRecord_t)))
 
-// compare func - compare two hash keys
-static kh_inline khint_t __HashEqual(FlowHashRecord_t r1, FlowHashRecord_t r2) {
-    return r1.hash == r2.hash && r1.hashLen == r2.hashLen && memcmp((void *)r1.hashkey, (void *)r2.hashkey, r2.hashLen) == 0;
-}
-// insert FlowHash definitions/code
-KHASH_INIT(FlowHash, FlowHashRecord_t, char, 0, __HashFunc, __HashEqual)
-// FlowHash var
-static khash_t(FlowHash) *FlowHash = NULL;
 sig_atomic_t lock = 0;
 
+// number of records, which are keyed and prefetched in advance by AddLocalFlowBatch()
+#define FlowBatchSize 16
+
+// flow cache - a flow table and the memory of its records
+struct flowCache_s {
+    flowTable_t *table;
+    struct MemHandler_s *arena;  // thread local arena, NULL: shared arena
+    uint8_t *keyBuffer;          // FlowBatchSize keys to build the keys of new records
+};
+
+// main flow cache
+static flowCache_t FlowCache = {0};
+
+// thread local flow caches, merged by MergeFlowCaches()
+static flowCache_t **threadCache = NULL;
+static int numThreadCaches = 0;
+
+// hash partitioned flow tables of MergeFlowCaches(). Each partition owns the
+// hash values in the range [n * 2^32/numFlowPartitions, (n+1) * 2^32/numFlowPartitions)
+static flowTable_t **FlowPartition = NULL;
+static int numFlowPartitions = 0;
+#define FlowPartitionIndex(hash, num) ((uint32_t)(((uint64_t)(hash) * (uint64_t)(num)) >> 32))
+
+typedef struct mergeWorker_s {
+    pthread_t tid;
+    int partition;
+    flowTable_t *table;
+} mergeWorker_t;
+
+// spill the flow cache into hash partitioned temporary files, when it exceeds the memory budget
+#define SpillPartitions 32
+static struct spill_s {
+    size_t maxMemory;  // memory budget of the flow cache in bytes, 0: no limit
+    char *tmpDir;      // directory for the spill directory
+    char *dir;         // private spill directory, created with the first spill
+    int numRounds;     // number of spills - each spill writes one file per partition
+    int loading;       // a partition is loaded - do not spill
+    int finished;      // all flows are spilled
+} Spill = {0};
+
+// a sorted run of an aggregated partition
+typedef struct spillRun_s {
+    nffile_t *nffile;
+    recordHeaderV3_t *record;  // current record
+    uint32_t remaining;        // records left in current block
+    FlowHashRecord_t flow;     // current flow
+    uint64_t count;            // order value of current flow
+} spillRun_t;
+
 // linear FlowList
 static struct FlowList_s {
     FlowHashRecord_t *head;
@@ -283,8 +378,6 @@ static struct FlowList_s {
 
 #define MaxAggrStackSize 64
 static int aggregateInfo[MaxAggrStackSize] = {0};
-static void *keymemV4 = NULL;
-static void *keymemV6 = NULL;
 static size_t keymenV4Len = 0;
 static size_t keymenV6Len = 0;
 
@@ -295,6 +388,123 @@ static uint32_t bidir_flows = 0;
 #include "nfdump_inline.c"
 #include "nffile_inline.c"
 
+// allocate memory for keys and records of a flow cache
+static inline void *FlowCacheAlloc(flowCache_t *flowCache, size_t size) {
+    return flowCache->arena ? nfmalloc_arena(flowCache->arena, size) : nfmalloc(size);
+}  // End of FlowCacheAlloc
+
+// allocate the slots and the entries of a flow table for numSlots slots
+static void AllocFlowTable(flowTable_t *table, uint32_t numSlots) {
+    table->mask = numSlots - 1;
+    table->slot = calloc(numSlots, sizeof(flowSlot_t));
+    table->keys = realloc(table->keys, (size_t)FlowTableEntries(numSlots) * table->keyStride);
+    table->flows = realloc(table->flows, (size_t)FlowTableEntries(numSlots) * sizeof(FlowHashRecord_t));
+    if (!table->slot || !table->keys || !table->flows) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+}  // End of AllocFlowTable
+
+// create a flow table for at least minEntries flows
+static flowTable_t *NewFlowTable(uint32_t minEntries) {
+    uint32_t numSlots = FlowTableMinSize;
+    while (FlowTableEntries(numSlots) < minEntries && numSlots < 0x80000000) numSlots <<= 1;
+
+    flowTable_t *table = calloc(1, sizeof(flowTable_t));
+    if (!table) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    // keys are zero padded to the largest key, 8 byte aligned
+    size_t keyStride = keymenV4Len > keymenV6Len ? keymenV4Len : keymenV6Len;
+    table->keyStride = (keyStride + 7) & ~(size_t)7;
+    AllocFlowTable(table, numSlots);
+
+    return table;
+
+}  // End of NewFlowTable
+
+static void FreeFlowTable(flowTable_t *table) {
+    if (!table) return;
+    free(table->slot);
+    free(table->keys);
+    free(table->flows);
+    free(table);
+}  // End of FreeFlowTable
+
+static void ClearFlowTable(flowTable_t *table) {
+    memset((void *)table->slot, 0, ((size_t)table->mask + 1) * sizeof(flowSlot_t));
+    table->size = 0;
+}  // End of ClearFlowTable
+
+// double the number of slots. The entries are kept in place, the slots are rebuilt from
+// the stored hash values - no key is hashed again
+static void GrowFlowTable(flowTable_t *table) {
+    flowSlot_t *oldSlot = table->slot;
+    uint32_t oldSlots = table->mask + 1;
+    AllocFlowTable(table, oldSlots << 1);
+
+    for (uint32_t i = 0; i < oldSlots; i++) {
+        if (oldSlot[i].entry == 0) continue;
+        uint32_t slot = oldSlot[i].hash & table->mask;
+        while (table->slot[slot].entry) slot = (slot + 1) & table->mask;
+        table->slot[slot] = oldSlot[i];
+    }
+    free(oldSlot);
+
+}  // End of GrowFlowTable
+
+// prefetch the first probe slot of tag
+static inline void PrefetchFlowSlot(flowTable_t *table, uint64_t tag) {
+    __builtin_prefetch((void *)&table->slot[(uint32_t)tag & table->mask]);
+}  // End of PrefetchFlowSlot
+
+// probe for key. Returns the slot of the key or the empty slot, where the key is inserted
+static inline uint32_t ProbeFlowSlot(flowTable_t *table, const uint8_t *key, uint64_t tag) {
+    uint32_t hash = (uint32_t)tag;
+    uint32_t keyLen = tag >> 32;
+    uint32_t slot = hash & table->mask;
+    while (table->slot[slot].entry) {
+        if (table->slot[slot].hash == hash) {
+            uint32_t entry = table->slot[slot].entry - 1;
+            if (FlowKeyEqual(table->keys + (size_t)entry * table->keyStride, key, keyLen) && table->flows[entry].hashLen == keyLen) return slot;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+    return slot;
+}  // End of ProbeFlowSlot
+
+// find the entry of key. Returns -1, if the key is not in the table
+static inline int64_t FindFlowEntry(flowTable_t *table, const uint8_t *key, uint64_t tag) {
+    uint32_t slot = ProbeFlowSlot(table, key, tag);
+    return (int64_t)table->slot[slot].entry - 1;
+}  // End of FindFlowEntry
+
+// find or insert the entry of key. A new entry gets the key and the hash and key length
+// of its flow, found is set to 0 and the other fields of the flow must be set by the caller
+static inline uint32_t PutFlowEntry(flowTable_t *table, const uint8_t *key, uint64_t tag, int *found) {
+    uint32_t slot = ProbeFlowSlot(table, key, tag);
+    if (table->slot[slot].entry) {
+        *found = 1;
+        return table->slot[slot].entry - 1;
+    }
+
+    if (table->size == FlowTableEntries(table->mask + 1)) {
+        GrowFlowTable(table);
+        slot = ProbeFlowSlot(table, key, tag);
+    }
+
+    uint32_t entry = table->size++;
+    table->slot[slot].hash = (uint32_t)tag;
+    table->slot[slot].entry = entry + 1;
+    memcpy((void *)(table->keys + (size_t)entry * table->keyStride), (void *)key, table->keyStride);
+    table->flows[entry].hash = (uint32_t)tag;
+    table->flows[entry].hashLen = tag >> 32;
+    *found = 0;
+    return entry;
+
+}  // End of PutFlowEntry
+
 #undef get16bits
 #if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) || defined(_MSC_VER) || defined(__BORLANDC__) || defined(__TURBOC__)
 #define get16bits(d) (*((const uint16_t *)(d)))
@@ -311,10 +521,14 @@ static uint32_t bidir_flows = 0;
 
 static inline void *New_HashKey(void *keymem, recordHandle_t *recordHandle, int swap_flow);
 
-static inline int NeedSwap(int GuessDir, void *genericFlowKey);
+static inline int NeedSwap(int GuessDir, FlowHashRecord_t *record);
 
 static SortElement_t *GetSortList(size_t *size);
 
+static void SpillFlowCache(void);
+
+static void RemoveSpillDir(void);
+
 static void ApplyAggregateMask(recordHandle_t *recordHandle, struct aggregationElement_s *aggregationElement);
 
 static void ApplyNetMaskBits(recordHandle_t *recordHandle, struct aggregationElement_s *aggregationElement);
@@ -322,27 +536,14 @@ static void ApplyNetMaskBits(recordHandle_t *recordHandle, struct aggregationEle
 static void PrintSortList(SortElement_t *SortList, uint32_t maxindex, outputParams_t *outputParams, int GuessFlowDirection,
                           RecordPrinter_t print_record, int ascending);
 
-static inline int NeedSwap(int GuessDir, void *genericFlowKey) {
+// returns true, if the flow direction of the record of an aggregated flow needs to be swapped
+static inline int NeedSwap(int GuessDir, FlowHashRecord_t *record) {
     if (GuessDir == 0) return 0;
 
-    uint16_t *af = (uint16_t *)genericFlowKey;
-    if (*af == AF_INET) {
-        FlowKeyV4_t *flowKey = (FlowKeyV4_t *)genericFlowKey;
-        if ((flowKey->proto == IPPROTO_TCP || flowKey->proto == IPPROTO_UDP) &&
-            (((flowKey->srcPort < 1024) && (flowKey->dstPort >= 1024)) || ((flowKey->srcPort < 32768) && (flowKey->dstPort >= 32768)) ||
-             ((flowKey->srcPort < 49152) && (flowKey->dstPort >= 49152))))
-            return 1;
-        else
-            return 0;
-    } else {
-        FlowKeyV6_t *flowKey = (FlowKeyV6_t *)genericFlowKey;
-        if ((flowKey->proto == IPPROTO_TCP || flowKey->proto == IPPROTO_UDP) &&
-            (((flowKey->srcPort < 1024) && (flowKey->dstPort >= 1024)) || ((flowKey->srcPort < 32768) && (flowKey->dstPort >= 32768)) ||
-             ((flowKey->srcPort < 49152) && (flowKey->dstPort >= 49152))))
-            return 1;
-        else
-            return 0;
-    }
+    recordHandle_t recordHandle;
+    MapRecordHandle(&recordHandle, record->flowrecord, 0);
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
+    return genericFlow && NeedSwapGeneric(GuessDir, genericFlow);
 }  // End of NeedSwap
 
 static inline void PreProcess(void *inPtr, preprocess_t process, recordHandle_t *recordHandle) {
@@ -392,6 +593,55 @@ static inline void PreProcess(void *inPtr, preprocess_t process, recordHandle_t
     }
 }  // End of PreProcess
 
+#ifndef SUPERFASTHASH
+// 64x64 -> 128bit multiply, folded to 64bit
+static inline uint64_t FlowHashMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}  // End of FlowHashMix
+
+#define FLOWHASH_P0 0xa0761d6478bd642fULL
+#define FLOWHASH_P1 0xe7037ed1a0b428dbULL
+#define FLOWHASH_P2 0x8ebc6af09c88c6e3ULL
+
+// wyhash style hash of a flow key. Consumes the key in 64bit words, the last word
+// is zero padded. The 64bit hash is folded into 32bit, as the flow table slot index
+// uses the low bits and the merge and spill partitions use the high bits.
+static inline uint32_t FlowKeyHash(const void *key, size_t len) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t seed = FLOWHASH_P0 ^ len;
+
+    while (len >= 2 * sizeof(uint64_t)) {
+        seed = FlowHashMix(LoadKey64(p) ^ FLOWHASH_P1, LoadKey64(p + 8) ^ seed);
+        p += 2 * sizeof(uint64_t);
+        len -= 2 * sizeof(uint64_t);
+    }
+
+    uint64_t a = 0, b = 0;
+    if (len >= sizeof(uint64_t)) {
+        a = LoadKey64(p);
+        p += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+    if (len) memcpy((void *)&b, (void *)p, len);
+
+    uint64_t hash = FlowHashMix(FlowHashMix(a ^ FLOWHASH_P1, b ^ seed), FLOWHASH_P2);
+    return (uint32_t)(hash ^ (hash >> 32));
+
+}  // End of FlowKeyHash
+
+#else
 static inline uint32_t SuperFastHash(const char *data, int len) {
     uint32_t hash = len;
 
@@ -439,6 +689,7 @@ static inline uint32_t SuperFastHash(const char *data, int len) {
 
     return hash;
 }
+#endif
 
 static inline void *New_HashKey(void *keymem, recordHandle_t *recordHandle, int swap_flow) {
     EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
@@ -488,10 +739,11 @@ static inline void *New_HashKey(void *keymem, recordHandle_t *recordHandle, int
                 case 16: {
                     ((uint64_t *)keymem)[0] = ((uint64_t *)inPtr)[0];
                     ((uint64_t *)keymem)[1] = ((uint64_t *)inPtr)[1];
-                    keymem += sizeof(uint64_t);
+                    keymem += 2 * sizeof(uint64_t);
                 } break;
                 default:
                     memcpy((void *)keymem, inPtr, param->length);
+                    keymem += param->length;
             }
         }
 
@@ -553,7 +805,7 @@ static uint64_t null_record(FlowHashRecord_t *record, flowDir_t inout) { return
 static uint64_t flows_record(FlowHashRecord_t *record, flowDir_t inout) { return record->flows; }
 
 static uint64_t packets_record(FlowHashRecord_t *record, flowDir_t inout) {
-    if (NeedSwap(GuessDirection, record->hashkey)) {
+    if (NeedSwap(GuessDirection, record)) {
         if (inout == IN)
             inout = OUT;
         else if (inout == OUT)
@@ -568,7 +820,7 @@ static uint64_t packets_record(FlowHashRecord_t *record, flowDir_t inout) {
 }
 
 static uint64_t bytes_record(FlowHashRecord_t *record, flowDir_t inout) {
-    if (NeedSwap(GuessDirection, record->hashkey)) {
+    if (NeedSwap(GuessDirection, record)) {
         if (inout == IN)
             inout = OUT;
         else if (inout == OUT)
@@ -696,8 +948,9 @@ static SortElement_t *GetSortList(size_t *size) {
     dbg_printf("Enter %s\n", __func__);
     SortElement_t *list;
 
-    size_t hashSize = kh_size(FlowHash);
-    if (hashSize) {  // aggregated flows in khash
+    size_t hashSize = FlowCache.table ? FlowCache.table->size : 0;
+    for (int i = 0; i < numFlowPartitions; i++) hashSize += FlowPartition[i]->size;
+    if (hashSize) {  // aggregated flows in flow tables
         list = (SortElement_t *)calloc(hashSize, sizeof(SortElement_t));
         if (!list) {
             LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
@@ -706,10 +959,11 @@ static SortElement_t *GetSortList(size_t *size) {
         }
 
         int c = 0;
-        for (khiter_t k = kh_begin(FlowHash); k != kh_end(FlowHash); ++k) {  // traverse
-            if (kh_exist(FlowHash, k)) {
-                FlowHashRecord_t *r = &kh_key(FlowHash, k);
-                list[c++].record = (void *)r;
+        for (int i = -1; i < numFlowPartitions; i++) {
+            flowTable_t *table = i < 0 ? FlowCache.table : FlowPartition[i];
+            if (!table) continue;
+            for (uint32_t entry = 0; entry < table->size; entry++) {  // traverse
+                list[c++].record = (void *)&table->flows[entry];
             }
         }
         *size = hashSize;
@@ -742,18 +996,182 @@ static SortElement_t *GetSortList(size_t *size) {
 int Init_FlowCache(void) {
     if (!nfalloc_Init(0)) return 0;
 
-    FlowHash = kh_init(FlowHash);
+    // the flow table is created with the first flow, when the key length is known
+    FlowCache = (flowCache_t){.table = NULL, .arena = NULL, .keyBuffer = NULL};
     FlowList = (struct FlowList_s){.head = NULL, .tail = &FlowList.head, .NumRecords = 0};
     keymenV4Len = sizeof(FlowKeyV4_t);
     keymenV6Len = sizeof(FlowKeyV6_t);
 
     aggregateInfo[0] = -1;
     LoadedGeoDB = Loaded_MaxMind();
+
+    // spilling is disabled again by SetBidirAggregation()
+    int maxMemory = ConfGetValue("aggrmemory");
+    if (maxMemory > 0) {
+        Spill.maxMemory = (size_t)maxMemory * 1024 * 1024;
+        Spill.tmpDir = ConfGetString("tmpdir");
+        if (Spill.tmpDir == NULL) Spill.tmpDir = getenv("TMPDIR");
+        if (Spill.tmpDir == NULL) Spill.tmpDir = "/tmp";
+    }
+
     return 1;
 
 }  // End of Init_FlowCache
 
-void Dispose_FlowTable(void) { nfalloc_free(); }  // End of Dispose_FlowTable
+void Dispose_FlowTable(void) {
+    for (int i = 0; i < numThreadCaches; i++) {
+        FreeFlowTable(threadCache[i]->table);
+        free(threadCache[i]->keyBuffer);
+        nfalloc_Dispose(threadCache[i]->arena);
+        free(threadCache[i]);
+    }
+    free(threadCache);
+    threadCache = NULL;
+    numThreadCaches = 0;
+
+    for (int i = 0; i < numFlowPartitions; i++) FreeFlowTable(FlowPartition[i]);
+    free(FlowPartition);
+    FlowPartition = NULL;
+    numFlowPartitions = 0;
+
+    RemoveSpillDir();
+    Spill.numRounds = 0;
+
+    FreeFlowTable(FlowCache.table);
+    free(FlowCache.keyBuffer);
+    FlowCache.table = NULL;
+    FlowCache.keyBuffer = NULL;
+
+    nfalloc_free();
+
+}  // End of Dispose_FlowTable
+
+// create a thread local flow cache with its own memory arena. Flows are added by the owner thread
+// with AddLocalFlowBatch() without any locking. Must be called before the threads are started.
+// Returns NULL in bidir mode, as a bidir flow needs to see all flows in one cache, and if the
+// flow cache may be spilled
+flowCache_t *NewFlowCache(void) {
+    // spilling needs all flows in the main cache
+    if (bidir_flows || Spill.maxMemory) return NULL;
+
+    flowCache_t **cacheList = realloc(threadCache, (numThreadCaches + 1) * sizeof(flowCache_t *));
+    flowCache_t *flowCache = calloc(1, sizeof(flowCache_t));
+    if (!cacheList || !flowCache) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(flowCache);
+        if (cacheList) threadCache = cacheList;
+        return NULL;
+    }
+    threadCache = cacheList;
+
+    flowCache->arena = nfalloc_New(0);
+    if (!flowCache->arena) {
+        free(flowCache);
+        return NULL;
+    }
+    threadCache[numThreadCaches++] = flowCache;
+
+    return flowCache;
+
+}  // End of NewFlowCache
+
+// returns true, if the record of flow a comes before the record of flow b - the earliest flow
+// or the lower record for flows with the same start time
+static inline int FirstRecord(FlowHashRecord_t *a, FlowHashRecord_t *b) {
+    if (a->msecFirst != b->msecFirst) return a->msecFirst < b->msecFirst;
+    uint16_t size = a->flowrecord->size < b->flowrecord->size ? a->flowrecord->size : b->flowrecord->size;
+    int cmp = memcmp(a->flowrecord, b->flowrecord, size);
+    return cmp ? cmp < 0 : a->flowrecord->size < b->flowrecord->size;
+}  // End of FirstRecord
+
+// merge the flows of partition worker->partition of a source table
+static void MergePartition(mergeWorker_t *worker, flowTable_t *source) {
+    if (!source) return;
+    flowTable_t *table = worker->table;
+    for (uint32_t entry = 0; entry < source->size; entry++) {
+        FlowHashRecord_t *r = &source->flows[entry];
+        if (FlowPartitionIndex(r->hash, numFlowPartitions) != worker->partition) continue;
+
+        int found;
+        uint32_t p = PutFlowEntry(table, source->keys + (size_t)entry * source->keyStride, FlowTag(r->hash, r->hashLen), &found);
+        if (!found) {
+            table->flows[p] = *r;
+        } else {
+            // flow exists in other cache - keep the record of the earliest flow, so the result does
+            // not depend on the thread, which added a flow. Record memory remains in the arenas
+            FlowHashRecord_t *flow = &table->flows[p];
+            if (FirstRecord(r, flow)) flow->flowrecord = r->flowrecord;
+            flow->inBytes += r->inBytes;
+            flow->inPackets += r->inPackets;
+            flow->outBytes += r->outBytes;
+            flow->outPackets += r->outPackets;
+            flow->inFlags |= r->inFlags;
+            flow->outFlags |= r->outFlags;
+            if (r->msecFirst < flow->msecFirst) flow->msecFirst = r->msecFirst;
+            if (r->msecLast > flow->msecLast) flow->msecLast = r->msecLast;
+            flow->flows += r->flows;
+        }
+    }
+
+}  // End of MergePartition
+
+__attribute__((noreturn)) static void *mergeWorker(void *arg) {
+    mergeWorker_t *worker = (mergeWorker_t *)arg;
+
+    MergePartition(worker, FlowCache.table);
+    for (int i = 0; i < numThreadCaches; i++) {
+        MergePartition(worker, threadCache[i]->table);
+    }
+
+    pthread_exit(NULL);
+    /* UNREACHED */
+
+}  // End of mergeWorker
+
+// merge the main flow cache and all thread local flow caches into numThreads hash partitions,
+// one merge thread per partition. Must be called once, after all threads adding flows have finished
+void MergeFlowCaches(int numThreads) {
+    dbg_printf("Enter %s\n", __func__);
+    if (numThreadCaches == 0) return;
+    if (numThreads < 1) numThreads = 1;
+
+    FlowPartition = calloc(numThreads, sizeof(flowTable_t *));
+    mergeWorker_t *workers = calloc(numThreads, sizeof(mergeWorker_t));
+    if (!FlowPartition || !workers) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    numFlowPartitions = numThreads;
+
+    // each partition gets about its share of the largest cache
+    size_t maxSize = FlowCache.table ? FlowCache.table->size : 0;
+    for (int i = 0; i < numThreadCaches; i++) {
+        if (threadCache[i]->table && threadCache[i]->table->size > maxSize) maxSize = threadCache[i]->table->size;
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        FlowPartition[i] = NewFlowTable(maxSize / numThreads + 1);
+        workers[i].partition = i;
+        workers[i].table = FlowPartition[i];
+        int err = pthread_create(&workers[i].tid, NULL, mergeWorker, (void *)&workers[i]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(255);
+        }
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    free(workers);
+
+    // all flows are in the partitions now. Records remain in the arenas
+    if (FlowCache.table) ClearFlowTable(FlowCache.table);
+    for (int i = 0; i < numThreadCaches; i++) {
+        FreeFlowTable(threadCache[i]->table);
+        threadCache[i]->table = NULL;
+    }
+
+}  // End of MergeFlowCaches
 
 // Parse flow cache print order -O
 int Parse_PrintOrder(char *order) {
@@ -1059,244 +1477,217 @@ void InsertFlow(recordHandle_t *recordHandle) {
 
 }  // End of InsertFlow
 
-static void AddBidirFlow(recordHandle_t *recordHandle) {
-    dbg_printf("Enter %s\n", __func__);
-    recordHeaderV3_t *record = recordHandle->recordHeaderV3;
-    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
-    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
-    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
-    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
-    uint64_t inPackets = genericFlow->inPackets;
-    uint64_t inBytes = genericFlow->inBytes;
+// create the flow table and the key buffer of a flow cache. The key length is known with the first flow
+static void InitFlowCacheTable(flowCache_t *flowCache) {
+    flowCache->table = NewFlowTable(0);
+    flowCache->keyBuffer = calloc(FlowBatchSize, flowCache->table->keyStride);
+    if (!flowCache->keyBuffer) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+}  // End of InitFlowCacheTable
+
+// build the zero padded hash key of a flow. Returns the tag of the key or 0 for a flow without IPs
+static inline uint64_t FlowCacheKey(flowTable_t *table, uint8_t *key, recordHandle_t *recordHandle, int swap_flow) {
+    size_t keyLen = 0;
+    if (recordHandle->extensionList[EXipv4FlowID]) {
+        keyLen = keymenV4Len;
+    } else if (recordHandle->extensionList[EXipv6FlowID]) {
+        keyLen = keymenV6Len;
+    } else {
+        // hmm .. a flow without IPs .. skip
+        return 0;
+    }
+
+    memset((void *)key, 0, table->keyStride);
+#ifdef DEVEL
+    void *endOfKey = New_HashKey(key, recordHandle, swap_flow);
+    printf("Key diff: %zu, len: %zu\n", endOfKey - (void *)key, keyLen);
+#else
+    New_HashKey(key, recordHandle, swap_flow);
+#endif
+
+    return FlowTag(FlowKeyHash(key, keyLen), keyLen);
+
+}  // End of FlowCacheKey
+
+// initialise the flow of a new slot with the counters of genericFlow and cntFlow and a copy of the record
+static inline void NewFlow(flowCache_t *flowCache, FlowHashRecord_t *flow, recordHeaderV3_t *record, EXgenericFlow_t *genericFlow, EXcntFlow_t *cntFlow) {
+    flow->inBytes = genericFlow->inBytes;
+    flow->inPackets = genericFlow->inPackets;
+    if (cntFlow) {
+        flow->outBytes = cntFlow->outBytes;
+        flow->outPackets = cntFlow->outPackets;
+        flow->flows = cntFlow->flows ? cntFlow->flows : 1;
+    } else {
+        flow->outBytes = 0;
+        flow->outPackets = 0;
+        flow->flows = 1;
+    }
+    flow->inFlags = genericFlow->tcpFlags;
+    flow->outFlags = 0;
+
+    flow->msecFirst = genericFlow->msecFirst;
+    flow->msecLast = genericFlow->msecLast;
+
+    void *p = FlowCacheAlloc(flowCache, record->size);
+    memcpy((void *)p, record, record->size);
+    flow->flowrecord = p;
+
+}  // End of NewFlow
+
+// add the counters of genericFlow and cntFlow to flow - swapped in and out for a reverse flow
+static inline void UpdateFlow(FlowHashRecord_t *flow, EXgenericFlow_t *genericFlow, EXcntFlow_t *cntFlow, int reverse) {
     uint64_t outBytes = 0;
     uint64_t outPackets = 0;
     uint64_t aggrFlows = 1;
     if (cntFlow) {
+        outBytes = cntFlow->outBytes;
         outPackets = cntFlow->outPackets;
-        outBytes = cntFlow->outPackets;
-        aggrFlows = cntFlow->flows;
+        if (cntFlow->flows) aggrFlows = cntFlow->flows;
     }
 
-    static void *bidirkeymem = NULL;
+    if (reverse) {
+        flow->outBytes += genericFlow->inBytes;
+        flow->outPackets += genericFlow->inPackets;
+        flow->inBytes += outBytes;
+        flow->inPackets += outPackets;
+        flow->outFlags |= genericFlow->tcpFlags;
+    } else {
+        flow->inBytes += genericFlow->inBytes;
+        flow->inPackets += genericFlow->inPackets;
+        flow->outBytes += outBytes;
+        flow->outPackets += outPackets;
+        flow->inFlags |= genericFlow->tcpFlags;
+    }
 
-    size_t keyLen = 0;
-    void **keymem = NULL;
-    if (ipv4Flow) {
-        keymem = &keymemV4;
-        keyLen = keymenV4Len;
-    } else if (ipv6Flow) {
-        keymem = &keymemV6;
-        keyLen = keymenV6Len;
-    } else
-        return;
+    if (genericFlow->msecFirst < flow->msecFirst) {
+        flow->msecFirst = genericFlow->msecFirst;
+    }
+    if (genericFlow->msecLast > flow->msecLast) {
+        flow->msecLast = genericFlow->msecLast;
+    }
 
-    if (*keymem == NULL) *keymem = nfmalloc(keyLen);
+    flow->flows += aggrFlows;
 
-    New_HashKey(*keymem, recordHandle, 0);
-    uint32_t forwardHash = SuperFastHash(*keymem, keyLen);
+}  // End of UpdateFlow
 
-    FlowHashRecord_t r;
-    r.hashkey = *keymem;
-    r.hashLen = keyLen;
-    r.hash = forwardHash;
+static void AddBidirFlow(recordHandle_t *recordHandle) {
+    dbg_printf("Enter %s\n", __func__);
+    recordHeaderV3_t *record = recordHandle->recordHeaderV3;
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
 
-    int ret;
-    khiter_t k = kh_get(FlowHash, FlowHash, r);
-    if (k != kh_end(FlowHash)) {
-        // flow record found - best case! update all fields
-        kh_key(FlowHash, k).inBytes += inBytes;
-        kh_key(FlowHash, k).inPackets += inPackets;
-        kh_key(FlowHash, k).outBytes += outBytes;
-        kh_key(FlowHash, k).outPackets += outPackets;
-        kh_key(FlowHash, k).inFlags |= genericFlow->tcpFlags;
-
-        if (genericFlow->msecFirst < kh_key(FlowHash, k).msecFirst) {
-            kh_key(FlowHash, k).msecFirst = genericFlow->msecFirst;
-        }
-        if (genericFlow->msecLast > kh_key(FlowHash, k).msecLast) {
-            kh_key(FlowHash, k).msecLast = genericFlow->msecLast;
-        }
+    if (FlowCache.table == NULL) InitFlowCacheTable(&FlowCache);
+    flowTable_t *table = FlowCache.table;
 
-        kh_key(FlowHash, k).flows += aggrFlows;
-    } else if (genericFlow->proto != IPPROTO_TCP && genericFlow->proto != IPPROTO_UDP) {
-        // no flow record found and no TCP/UDP bidir flows. Insert flow record into hash
-        k = kh_put(FlowHash, FlowHash, r, &ret);
-        kh_key(FlowHash, k).inBytes = inBytes;
-        kh_key(FlowHash, k).inPackets = inPackets;
-        kh_key(FlowHash, k).outBytes = outBytes;
-        kh_key(FlowHash, k).outPackets = outPackets;
-        kh_key(FlowHash, k).flows = aggrFlows;
-        kh_key(FlowHash, k).inFlags = genericFlow->tcpFlags;
-        kh_key(FlowHash, k).outFlags = 0;
-
-        kh_key(FlowHash, k).msecFirst = genericFlow->msecFirst;
-        kh_key(FlowHash, k).msecLast = genericFlow->msecLast;
-
-        void *p = malloc(record->size);
-        if (!p) {
-            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-            exit(255);
-        }
-        memcpy((void *)p, record, record->size);
-        kh_key(FlowHash, k).flowrecord = p;
+    uint8_t *key = FlowCache.keyBuffer;
+    uint64_t tag = FlowCacheKey(table, key, recordHandle, 0);
+    if (tag == 0) return;
 
-        // keymen got part of the cache
-        *keymem = NULL;
-    } else {
-        // for bidir flows do
+    int64_t entry = FindFlowEntry(table, key, tag);
+    if (entry >= 0) {
+        // flow record found - best case! update all fields
+        UpdateFlow(&table->flows[entry], genericFlow, cntFlow, 0);
+        return;
+    }
 
-        // generate reverse hash key to search for bidir flow
-        // we need it only to lookup
-        if (bidirkeymem == NULL) {
-            bidirkeymem = nfmalloc(keymenV6Len);
+    if (genericFlow->proto == IPPROTO_TCP || genericFlow->proto == IPPROTO_UDP) {
+        // for bidir flows do
+        // generate the hash key for reverse record (bidir) - we need it only to lookup
+        uint8_t *reverseKey = FlowCache.keyBuffer + table->keyStride;
+        uint64_t reverseTag = FlowCacheKey(table, reverseKey, recordHandle, 1);
+        entry = FindFlowEntry(table, reverseKey, reverseTag);
+        if (entry >= 0) {
+            // we found a corresponding flow - so update all fields in reverse direction
+            UpdateFlow(&table->flows[entry], genericFlow, cntFlow, 1);
+            return;
         }
+    }
 
-        // generate the hash key for reverse record (bidir)
-        New_HashKey(bidirkeymem, recordHandle, 1);
-        r.hashkey = bidirkeymem;
-        r.hashLen = keyLen;
-        r.hash = SuperFastHash(bidirkeymem, keyLen);
+    // no flow record found or no bidir flow found. Insert original flow into the table
+    int found;
+    uint32_t newEntry = PutFlowEntry(table, key, tag, &found);
+    NewFlow(&FlowCache, &table->flows[newEntry], record, genericFlow, cntFlow);
 
-        k = kh_get(FlowHash, FlowHash, r);
-        if (k != kh_end(FlowHash)) {
-            // we found a corresponding flow - so update all fields in reverse direction
-            kh_key(FlowHash, k).outBytes += inBytes;
-            kh_key(FlowHash, k).outPackets += inPackets;
-            kh_key(FlowHash, k).inBytes += outBytes;
-            kh_key(FlowHash, k).inPackets += outPackets;
-            kh_key(FlowHash, k).outFlags |= genericFlow->tcpFlags;
-
-            if (genericFlow->msecFirst < kh_key(FlowHash, k).msecFirst) {
-                kh_key(FlowHash, k).msecFirst = genericFlow->msecFirst;
-            }
-            if (genericFlow->msecLast > kh_key(FlowHash, k).msecLast) {
-                kh_key(FlowHash, k).msecLast = genericFlow->msecLast;
-            }
+}  // End of AddBidirFlow
 
-            kh_key(FlowHash, k).flows += aggrFlows;
-        } else {
-            // no bidir flow found
-            // insert original flow into the cache
-            r.hashkey = *keymem;
-            r.hash = forwardHash;
-            r.hashLen = keyLen;
-            k = kh_put(FlowHash, FlowHash, r, &ret);
-            kh_key(FlowHash, k).inBytes = inBytes;
-            kh_key(FlowHash, k).inPackets = inPackets;
-            kh_key(FlowHash, k).outBytes = outBytes;
-            kh_key(FlowHash, k).outPackets = outPackets;
-            kh_key(FlowHash, k).flows = aggrFlows;
-            kh_key(FlowHash, k).inFlags = genericFlow->tcpFlags;
-            kh_key(FlowHash, k).outFlags = 0;
-
-            kh_key(FlowHash, k).msecFirst = genericFlow->msecFirst;
-            kh_key(FlowHash, k).msecLast = genericFlow->msecLast;
-
-            void *p = malloc(record->size);
-            if (!p) {
-                LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
-                exit(255);
-            }
-            memcpy((void *)p, record, record->size);
-            kh_key(FlowHash, k).flowrecord = p;
+// add a keyed flow to the flow table of a flow cache. The flow cache must not be shared with other threads
+static inline void PutFlow(flowCache_t *flowCache, uint8_t *key, uint64_t tag, recordHeaderV3_t *record, EXgenericFlow_t *genericFlow,
+                           EXcntFlow_t *cntFlow) {
+    flowTable_t *table = flowCache->table;
+    int found;
+    uint32_t entry = PutFlowEntry(table, key, tag, &found);
+    if (found) {
+        // flow record found - best case! update all fields
+        UpdateFlow(&table->flows[entry], genericFlow, cntFlow, 0);
+        return;
+    }
 
-            // keymen got part of the cache
-            *keymem = NULL;
-        }
+    // no flow record found. Insert flow record into table
+    NewFlow(flowCache, &table->flows[entry], record, genericFlow, cntFlow);
+
+    if (Spill.maxMemory && flowCache == &FlowCache && !Spill.loading) {
+        size_t memory = (size_t)MemHandler->CurrentBlock * MemHandler->BlockSize + MemHandler->Allocted + FlowTableMemory(table);
+        if (memory > Spill.maxMemory) SpillFlowCache();
     }
 
-}  // End of AddBidirFlow
+}  // End of PutFlow
 
-void AddFlowCache(recordHandle_t *recordHandle) {
+// add a flow to the flow cache. The flow cache must not be shared with other threads
+static void AddFlow(flowCache_t *flowCache, recordHandle_t *recordHandle) {
     dbg_printf("Enter %s\n", __func__);
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (!genericFlow) return;
 
-    EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle->extensionList[EXipv4FlowID];
-    EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle->extensionList[EXipv6FlowID];
-    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
-    uint64_t inPackets = genericFlow->inPackets;
-    uint64_t inBytes = genericFlow->inBytes;
-    uint64_t outBytes = 0;
-    uint64_t outPackets = 0;
-    uint64_t aggrFlows = 1;
-    if (cntFlow) {
-        outPackets = cntFlow->outPackets;
-        outBytes = cntFlow->outPackets;
-        aggrFlows = cntFlow->flows ? cntFlow->flows : 1;
-    }
+    if (flowCache->table == NULL) InitFlowCacheTable(flowCache);
 
-    recordHeaderV3_t *record = recordHandle->recordHeaderV3;
+    uint8_t *key = flowCache->keyBuffer;
+    uint64_t tag = FlowCacheKey(flowCache->table, key, recordHandle, 0);
+    if (tag == 0) return;
 
-    if (bidir_flows) return AddBidirFlow(recordHandle);
+    PutFlow(flowCache, key, tag, recordHandle->recordHeaderV3, genericFlow, (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID]);
 
-    size_t keyLen = 0;
-    void **keymem = NULL;
-    if (ipv4Flow) {
-        keymem = &keymemV4;
-        keyLen = keymenV4Len;
-    } else if (ipv6Flow) {
-        keymem = &keymemV6;
-        keyLen = keymenV6Len;
-    } else {
-        // hmm .. a flow without IPs .. skip
-        return;
-    }
+}  // End of AddFlow
 
-    if (*keymem == NULL) *keymem = nfmalloc(keyLen);
+void AddFlowCache(recordHandle_t *recordHandle) {
+    dbg_printf("Enter %s\n", __func__);
+    if (recordHandle->extensionList[EXgenericFlowID] == NULL) return;
 
-#ifdef DEVEL
-    void *endOfKey = New_HashKey(*keymem, recordHandle, 0);
-    printf("Key diff: %zu, len: %zu\n", endOfKey - *keymem, keyLen);
-#else
-    New_HashKey(*keymem, recordHandle, 0);
-#endif
+    if (bidir_flows) return AddBidirFlow(recordHandle);
 
-    FlowHashRecord_t r;
-    r.hashkey = *keymem;
-    r.hashLen = keyLen;
-    r.hash = SuperFastHash(*keymem, keyLen);
+    AddFlow(&FlowCache, recordHandle);
 
-    int ret;
-    khiter_t k = kh_put(FlowHash, FlowHash, r, &ret);
-    if (ret == 0) {
-        // flow record found - best case! update all fields
-        kh_key(FlowHash, k).inBytes += inBytes;
-        kh_key(FlowHash, k).inPackets += inPackets;
-        kh_key(FlowHash, k).outBytes += outBytes;
-        kh_key(FlowHash, k).outPackets += outPackets;
-        kh_key(FlowHash, k).inFlags |= genericFlow->tcpFlags;
-
-        if (genericFlow->msecFirst < kh_key(FlowHash, k).msecFirst) {
-            kh_key(FlowHash, k).msecFirst = genericFlow->msecFirst;
+}  // End of AddFlowCache
+
+// add the mapped V3 records of a filtered batch to a thread local flow cache. The records are processed
+// in batches of FlowBatchSize records. The keys of a batch are built and hashed first and their slots are
+// prefetched, so the slots are in the cache, when the flows are added
+void AddLocalFlowBatch(flowCache_t *flowCache, recordHandle_t **handles, uint32_t numRecords) {
+    dbg_printf("Enter %s\n", __func__);
+    if (flowCache->table == NULL) InitFlowCacheTable(flowCache);
+    flowTable_t *table = flowCache->table;
+
+    uint64_t tag[FlowBatchSize];
+    EXgenericFlow_t *genericFlow[FlowBatchSize];
+    EXcntFlow_t *cntFlow[FlowBatchSize];
+
+    for (uint32_t i = 0; i < numRecords; i += FlowBatchSize) {
+        uint32_t batchSize = (numRecords - i) < FlowBatchSize ? (numRecords - i) : FlowBatchSize;
+        for (uint32_t j = 0; j < batchSize; j++) {
+            recordHandle_t *recordHandle = handles[i + j];
+            genericFlow[j] = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
+            cntFlow[j] = (EXcntFlow_t *)recordHandle->extensionList[EXcntFlowID];
+            tag[j] = genericFlow[j] ? FlowCacheKey(table, flowCache->keyBuffer + j * table->keyStride, recordHandle, 0) : 0;
+            if (tag[j]) PrefetchFlowSlot(table, tag[j]);
         }
-        if (genericFlow->msecLast > kh_key(FlowHash, k).msecLast) {
-            kh_key(FlowHash, k).msecLast = genericFlow->msecLast;
+        for (uint32_t j = 0; j < batchSize; j++) {
+            if (tag[j] == 0) continue;
+            PutFlow(flowCache, flowCache->keyBuffer + j * table->keyStride, tag[j], handles[i + j]->recordHeaderV3, genericFlow[j], cntFlow[j]);
         }
-
-        kh_key(FlowHash, k).flows += aggrFlows;
-    } else {
-        // no flow record found and no TCP/UDP bidir flows. Insert flow record into hash
-        kh_key(FlowHash, k).inBytes = inBytes;
-        kh_key(FlowHash, k).inPackets = inPackets;
-        kh_key(FlowHash, k).outBytes = outBytes;
-        kh_key(FlowHash, k).outPackets = outPackets;
-        kh_key(FlowHash, k).flows = aggrFlows;
-        kh_key(FlowHash, k).inFlags = genericFlow->tcpFlags;
-        kh_key(FlowHash, k).outFlags = 0;
-
-        kh_key(FlowHash, k).msecFirst = genericFlow->msecFirst;
-        kh_key(FlowHash, k).msecLast = genericFlow->msecLast;
-
-        void *p = nfmalloc(record->size);
-        memcpy((void *)p, record, record->size);
-        kh_key(FlowHash, k).flowrecord = p;
-
-        // keymen got part of the cache
-        *keymem = NULL;
     }
 
-}  // End of AddFlowCache
+}  // End of AddLocalFlowBatch
 
 // print SortList - apply possible aggregation mask to zero out aggregated fields
 static inline void PrintSortList(SortElement_t *SortList, uint32_t maxindex, outputParams_t *outputParams, int GuessFlowDirection,
@@ -1328,6 +1719,8 @@ static inline void PrintSortList(SortElement_t *SortList, uint32_t maxindex, out
         if (cntFlow == NULL && (r->flows > 1 || r->outPackets)) {
             recordHandle.extensionList[EXcntFlowID] = &tmpCntFlow;
             cntFlow = &tmpCntFlow;
+        }
+        if (cntFlow) {
             cntFlow->outPackets = r->outPackets;
             cntFlow->outBytes = r->outBytes;
             cntFlow->flows = r->flows;
@@ -1343,6 +1736,68 @@ static inline void PrintSortList(SortElement_t *SortList, uint32_t maxindex, out
 
 }  // End of PrintSortList
 
+// export a flow record with the aggregated counters of the flow
+static inline int ExportFlowRecord(nffile_t *nffile, FlowHashRecord_t *r, uint32_t flowCount, int GuessFlowDirection) {
+    recordHeaderV3_t *recordHeaderV3 = (r->flowrecord);
+
+    // check, if we need cntFlow extension
+    int exCntSize = 0;
+    if (r->outPackets || r->outBytes || r->flows > 1) {
+        exCntSize = EXcntFlowSize;
+    }
+
+    if (!CheckBufferSpace(nffile, recordHeaderV3->size + exCntSize)) {
+        return 0;
+    }
+
+    // write record
+    memcpy(nffile->buff_ptr, (void *)recordHeaderV3, recordHeaderV3->size);
+    // remap header to written memory
+    recordHeaderV3 = nffile->buff_ptr;
+
+    recordHandle_t recordHandle = {0};
+    MapRecordHandle(&recordHandle, recordHeaderV3, flowCount);
+
+    // check if cntFlow already exists
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle.extensionList[EXcntFlowID];
+
+    if (cntFlow == NULL && exCntSize) {
+        PushExtension(recordHeaderV3, EXcntFlow, extPtr);
+        cntFlow = extPtr;
+    }
+    nffile->buff_ptr += recordHeaderV3->size;
+    nffile->block_header->size += recordHeaderV3->size;
+    nffile->block_header->NumRecords++;
+
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
+    if (genericFlow) {
+        genericFlow->inPackets = r->inPackets;
+        genericFlow->inBytes = r->inBytes;
+        genericFlow->msecFirst = r->msecFirst;
+        genericFlow->msecLast = r->msecLast;
+        genericFlow->tcpFlags = r->inFlags;
+    }
+    if (cntFlow) {
+        cntFlow->outPackets = r->outPackets;
+        cntFlow->outBytes = r->outBytes;
+        cntFlow->flows = r->flows;
+    }
+
+    if (NeedSwapGeneric(GuessFlowDirection, genericFlow)) {
+        EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle.extensionList[EXipv4FlowID];
+        EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle.extensionList[EXipv6FlowID];
+        EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle.extensionList[EXflowMiscID];
+        EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle.extensionList[EXasRoutingID];
+        SwapRawFlow(genericFlow, ipv4Flow, ipv6Flow, flowMisc, cntFlow, asRouting);
+    }
+
+    // Update statistics
+    UpdateRawStat(nffile->stat_record, genericFlow, cntFlow);
+
+    return 1;
+
+}  // End of ExportFlowRecord
+
 // export SortList - apply possible aggregation mask to zero out aggregated fields
 static inline void ExportSortList(SortElement_t *SortList, uint32_t maxindex, nffile_t *nffile, int GuessFlowDirection, int ascending) {
     dbg_printf("Enter %s\n", __func__);
@@ -1350,65 +1805,298 @@ static inline void ExportSortList(SortElement_t *SortList, uint32_t maxindex, nf
         int j = ascending ? i : maxindex - 1 - i;
 
         FlowHashRecord_t *r = (FlowHashRecord_t *)(SortList[j].record);
+        if (!ExportFlowRecord(nffile, r, i + 1, GuessFlowDirection)) return;
+    }
 
-        recordHeaderV3_t *recordHeaderV3 = (r->flowrecord);
+}  // End of ExportSortList
 
-        // check, if we need cntFlow extension
-        int exCntSize = 0;
-        if (r->outPackets || r->outBytes || r->flows > 1) {
-            exCntSize = EXcntFlowSize;
+// remove all flows from the main flow cache and free its memory. The table is created again
+// with its initial size, as the slots and entries of a grown table count against the memory budget
+static void ClearFlowCache(void) {
+    if (FlowCache.table) {
+        FreeFlowTable(FlowCache.table);
+        FlowCache.table = NewFlowTable(0);
+    }
+    nfalloc_free();
+    if (!nfalloc_Init(0)) exit(255);
+
+}  // End of ClearFlowCache
+
+// remove the spill directory with all files in it. Registered with atexit(), so that no
+// flow data is left behind on error exits
+static void RemoveSpillDir(void) {
+    if (Spill.dir == NULL) return;
+
+    DIR *dir = opendir(Spill.dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            char spillFile[MAXPATHLEN];
+            snprintf(spillFile, MAXPATHLEN, "%s/%s", Spill.dir, entry->d_name);
+            unlink(spillFile);
         }
+        closedir(dir);
+    }
+    rmdir(Spill.dir);
+    free(Spill.dir);
+    Spill.dir = NULL;
+
+}  // End of RemoveSpillDir
+
+// create the private spill directory - mode 0700, so the spill files can not be read or
+// replaced by other users
+static void CreateSpillDir(void) {
+    static int registered = 0;
+
+    char template[MAXPATHLEN];
+    snprintf(template, MAXPATHLEN, "%s/nfdump.spill.XXXXXX", Spill.tmpDir);
+    if (mkdtemp(template) == NULL) {
+        LogError("mkdtemp() error for '%s': %s", template, strerror(errno));
+        exit(255);
+    }
+    Spill.dir = strdup(template);
+    if (!Spill.dir) {
+        LogError("strdup() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        rmdir(template);
+        exit(255);
+    }
+    if (!registered) {
+        atexit(RemoveSpillDir);
+        registered = 1;
+    }
 
-        if (!CheckBufferSpace(nffile, recordHeaderV3->size + exCntSize)) {
-            return;
+}  // End of CreateSpillDir
+
+// write all flows of the main flow cache into one spill file per hash partition and clear the cache
+static void SpillFlowCache(void) {
+    if (Spill.dir == NULL) CreateSpillDir();
+
+    dbg_printf("Enter %s\n", __func__);
+    for (int partition = 0; partition < SpillPartitions; partition++) {
+        char spillFile[MAXPATHLEN];
+        snprintf(spillFile, MAXPATHLEN, "%s/%d.%d", Spill.dir, Spill.numRounds, partition);
+        nffile_t *nffile = OpenNewFile(spillFile, NULL, CREATOR_NFDUMP, LZ4_COMPRESSED, NOT_ENCRYPTED);
+        if (!nffile) {
+            LogError("Failed to open spill file '%s'", spillFile);
+            exit(255);
         }
 
-        // write record
-        memcpy(nffile->buff_ptr, (void *)recordHeaderV3, recordHeaderV3->size);
-        // remap header to written memory
-        recordHeaderV3 = nffile->buff_ptr;
+        uint32_t flowCount = 0;
+        flowTable_t *table = FlowCache.table;
+        for (uint32_t entry = 0; entry < table->size; entry++) {
+            FlowHashRecord_t *r = &table->flows[entry];
+            if (FlowPartitionIndex(r->hash, SpillPartitions) != partition) continue;
+            if (!ExportFlowRecord(nffile, r, ++flowCount, 0)) {
+                LogError("Failed to write spill file '%s'", spillFile);
+                exit(255);
+            }
+        }
+        if (nffile->block_header->NumRecords) WriteBlock(nffile);
+        CloseUpdateFile(nffile);
+        DisposeFile(nffile);
+    }
+    Spill.numRounds++;
+    LogVerbose("Flow cache spilled to disk: %d times", Spill.numRounds);
 
-        recordHandle_t recordHandle = {0};
-        MapRecordHandle(&recordHandle, recordHeaderV3, i + 1);
+    ClearFlowCache();
 
-        // check if cntFlow already exists
-        EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle.extensionList[EXcntFlowID];
+}  // End of SpillFlowCache
 
-        if (cntFlow == NULL && exCntSize) {
-            PushExtension(recordHeaderV3, EXcntFlow, extPtr);
-            cntFlow = extPtr;
+// aggregate all spilled flows of a partition in the main flow cache
+static void LoadSpillPartition(int partition) {
+    dbg_printf("Enter %s\n", __func__);
+    ClearFlowCache();
+
+    Spill.loading = 1;
+    for (int round = 0; round < Spill.numRounds; round++) {
+        char spillFile[MAXPATHLEN];
+        snprintf(spillFile, MAXPATHLEN, "%s/%d.%d", Spill.dir, round, partition);
+        nffile_t *nffile = OpenFile(spillFile, NULL);
+        if (!nffile) {
+            LogError("Failed to open spill file '%s'", spillFile);
+            exit(255);
         }
-        nffile->buff_ptr += recordHeaderV3->size;
-        nffile->block_header->size += recordHeaderV3->size;
-        nffile->block_header->NumRecords++;
 
-        EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
-        if (genericFlow) {
-            genericFlow->inPackets = r->inPackets;
-            genericFlow->inBytes = r->inBytes;
-            genericFlow->msecFirst = r->msecFirst;
-            genericFlow->msecLast = r->msecLast;
-            genericFlow->tcpFlags = r->inFlags;
+        uint32_t flowCount = 0;
+        while (ReadBlock(nffile) > 0) {
+            record_header_t *record_ptr = (record_header_t *)nffile->buff_ptr;
+            for (int i = 0; i < nffile->block_header->NumRecords; i++) {
+                if (record_ptr->type == V3Record) {
+                    recordHandle_t recordHandle = {0};
+                    MapRecordHandle(&recordHandle, (recordHeaderV3_t *)record_ptr, ++flowCount);
+                    AddFlow(&FlowCache, &recordHandle);
+                }
+                record_ptr = (record_header_t *)((void *)record_ptr + record_ptr->size);
+            }
         }
-        if (cntFlow) {
-            cntFlow->outPackets = r->outPackets;
-            cntFlow->outBytes = r->outBytes;
-            cntFlow->flows = r->flows;
+        CloseFile(nffile);
+        DisposeFile(nffile);
+    }
+    Spill.loading = 0;
+
+}  // End of LoadSpillPartition
+
+// read the next flow of a sorted run. Returns 0 at the end of the run
+static int NextRunFlow(spillRun_t *run, int order) {
+    while (run->remaining == 0) {
+        if (ReadBlock(run->nffile) <= 0) return 0;
+        run->record = (recordHeaderV3_t *)run->nffile->buff_ptr;
+        run->remaining = run->nffile->block_header->NumRecords;
+    }
+
+    recordHeaderV3_t *record = run->record;
+    run->record = (recordHeaderV3_t *)((void *)record + record->size);
+    run->remaining--;
+
+    recordHandle_t recordHandle = {0};
+    MapRecordHandle(&recordHandle, record, 1);
+    EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle.extensionList[EXgenericFlowID];
+    EXcntFlow_t *cntFlow = (EXcntFlow_t *)recordHandle.extensionList[EXcntFlowID];
+
+    FlowHashRecord_t *flow = &run->flow;
+    memset((void *)flow, 0, sizeof(FlowHashRecord_t));
+    flow->flowrecord = record;
+    flow->flows = 1;
+    if (genericFlow) {
+        flow->inPackets = genericFlow->inPackets;
+        flow->inBytes = genericFlow->inBytes;
+        flow->msecFirst = genericFlow->msecFirst;
+        flow->msecLast = genericFlow->msecLast;
+        flow->inFlags = genericFlow->tcpFlags;
+    }
+    if (cntFlow) {
+        flow->outPackets = cntFlow->outPackets;
+        flow->outBytes = cntFlow->outBytes;
+        flow->flows = cntFlow->flows;
+    }
+    run->count = order_mode[order].record_function(flow, order_mode[order].inout);
+
+    return 1;
+
+}  // End of NextRunFlow
+
+// print or export the spilled flows. The partitions are aggregated one after the other. Unordered
+// partitions are printed right away. For an order, each partition is sorted into a run file and the
+// runs are merged into the output. Exported flows are appended to wfile, printed otherwise
+static void ProcessSpill(int order, int ascending, outputParams_t *outputParams, RecordPrinter_t print_record, nffile_t *wfile, int GuessDir) {
+    dbg_printf("Enter %s\n", __func__);
+    if (!Spill.finished) {
+        if (FlowCache.table && FlowCache.table->size) SpillFlowCache();
+        Spill.finished = 1;
+    }
+
+    // spill files are not indexed for any query
+    SetIndexTimeWindow(0, 0);
+    SetIndexFilter(NULL);
+
+    outputParams_t params = {0};
+    if (outputParams) params = *outputParams;
+    uint32_t topN = params.topN;
+    params.topN = 0;
+    uint32_t numFlows = 0;
+
+    for (int partition = 0; partition < SpillPartitions; partition++) {
+        if (topN && numFlows >= topN) break;
+        LoadSpillPartition(partition);
+
+        size_t maxindex;
+        SortElement_t *SortList = GetSortList(&maxindex);
+        if (!SortList) continue;
+
+        if (order == 0) {
+            if (topN && (numFlows + maxindex) > topN) maxindex = topN - numFlows;
+            if (wfile)
+                ExportSortList(SortList, maxindex, wfile, GuessDir, ascending);
+            else
+                PrintSortList(SortList, maxindex, &params, GuessDir, print_record, ascending);
+            numFlows += maxindex;
+        } else {
+            for (int i = 0; i < maxindex; i++) {
+                FlowHashRecord_t *r = (FlowHashRecord_t *)(SortList[i].record);
+                SortList[i].count = order_mode[order].record_function(r, order_mode[order].inout);
+            }
+            if (maxindex >= 2) {
+                if (maxindex < 100) {
+                    heapSort(SortList, maxindex, 0, DESCENDING);
+                } else {
+                    blocksort((SortRecord_t *)SortList, maxindex);
+                }
+            }
+
+            // no more than topN flows of a partition are needed
+            if (topN && maxindex > topN) {
+                if (!ascending) memmove(SortList, SortList + maxindex - topN, topN * sizeof(SortElement_t));
+                maxindex = topN;
+            }
+
+            char runFile[MAXPATHLEN];
+            snprintf(runFile, MAXPATHLEN, "%s/run.%d", Spill.dir, partition);
+            nffile_t *nffile = OpenNewFile(runFile, NULL, CREATOR_NFDUMP, LZ4_COMPRESSED, NOT_ENCRYPTED);
+            if (!nffile) {
+                LogError("Failed to open spill file '%s'", runFile);
+                exit(255);
+            }
+            ExportSortList(SortList, maxindex, nffile, 0, ascending);
+            if (nffile->block_header->NumRecords) WriteBlock(nffile);
+            CloseUpdateFile(nffile);
+            DisposeFile(nffile);
+        }
+        free(SortList);
+    }
+    ClearFlowCache();
+
+    if (order == 0) return;
+
+    // merge the sorted runs
+    spillRun_t *runs = calloc(SpillPartitions, sizeof(spillRun_t));
+    if (!runs) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    int numRuns = 0;
+    for (int partition = 0; partition < SpillPartitions; partition++) {
+        char runFile[MAXPATHLEN];
+        snprintf(runFile, MAXPATHLEN, "%s/run.%d", Spill.dir, partition);
+        nffile_t *nffile = OpenFile(runFile, NULL);
+        if (!nffile) continue;
+        // the file is read by the open file handle
+        unlink(runFile);
+        runs[numRuns].nffile = nffile;
+        if (NextRunFlow(&runs[numRuns], order)) {
+            numRuns++;
+        } else {
+            CloseFile(nffile);
+            DisposeFile(nffile);
         }
+    }
 
-        if (NeedSwapGeneric(GuessFlowDirection, genericFlow)) {
-            EXipv4Flow_t *ipv4Flow = (EXipv4Flow_t *)recordHandle.extensionList[EXipv4FlowID];
-            EXipv6Flow_t *ipv6Flow = (EXipv6Flow_t *)recordHandle.extensionList[EXipv6FlowID];
-            EXflowMisc_t *flowMisc = (EXflowMisc_t *)recordHandle.extensionList[EXflowMiscID];
-            EXasRouting_t *asRouting = (EXasRouting_t *)recordHandle.extensionList[EXasRoutingID];
-            SwapRawFlow(genericFlow, ipv4Flow, ipv6Flow, flowMisc, cntFlow, asRouting);
+    while (numRuns && (topN == 0 || numFlows < topN)) {
+        int next = 0;
+        for (int i = 1; i < numRuns; i++) {
+            if (ascending ? runs[i].count < runs[next].count : runs[i].count > runs[next].count) next = i;
         }
 
-        // Update statistics
-        UpdateRawStat(nffile->stat_record, genericFlow, cntFlow);
+        SortElement_t element = {.record = (void *)&runs[next].flow, .count = runs[next].count};
+        if (wfile)
+            ExportSortList(&element, 1, wfile, GuessDir, 1);
+        else
+            PrintSortList(&element, 1, &params, GuessDir, print_record, 1);
+        numFlows++;
+
+        if (!NextRunFlow(&runs[next], order)) {
+            CloseFile(runs[next].nffile);
+            DisposeFile(runs[next].nffile);
+            runs[next] = runs[--numRuns];
+        }
+    }
+    for (int i = 0; i < numRuns; i++) {
+        CloseFile(runs[i].nffile);
+        DisposeFile(runs[i].nffile);
     }
+    free(runs);
 
-}  // End of ExportSortList
+}  // End of ProcessSpill
 
 int SetBidirAggregation(void) {
     dbg_printf("Enter %s\n", __func__);
@@ -1419,6 +2107,12 @@ int SetBidirAggregation(void) {
     }
     bidir_flows = 1;
 
+    // bidir flows need the reverse flow in the same cache - no spilling
+    if (Spill.maxMemory) {
+        LogInfo("Memory limit aggrmemory is ignored for bidir aggregation");
+        Spill.maxMemory = 0;
+    }
+
     return 1;
 
 }  // End of SetBidirAggregation
@@ -1428,6 +2122,21 @@ void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams) {
     dbg_printf("Enter %s\n", __func__);
     size_t maxindex;
 
+    if (Spill.numRounds) {
+        for (int order_index = 0; order_mode[order_index].string != NULL; order_index++) {
+            if ((FlowStat_order & (1 << order_index)) == 0) continue;
+            if (!outputParams->quiet && outputParams->mode == MODE_PLAIN) {
+                if (outputParams->topN != 0)
+                    printf("Top %i flows ordered by %s:\n", outputParams->topN, order_mode[order_index].string);
+                else
+                    printf("Top flows ordered by %s:\n", order_mode[order_index].string);
+            }
+            PrintProlog(outputParams);
+            ProcessSpill(order_index, PrintDirection, outputParams, print_record, NULL, 0);
+        }
+        return;
+    }
+
     // Get sort array
     SortElement_t *SortList = GetSortList(&maxindex);
     if (!SortList) {
@@ -1473,6 +2182,11 @@ void PrintFlowTable(RecordPrinter_t print_record, outputParams_t *outputParams,
     dbg_printf("Enter %s\n", __func__);
     GuessDirection = GuessDir;
 
+    if (Spill.numRounds) {
+        ProcessSpill(PrintOrder, PrintDirection, outputParams, print_record, NULL, GuessDir);
+        return;
+    }
+
     size_t maxindex;
     SortElement_t *SortList = GetSortList(&maxindex);
     if (!SortList) return;
@@ -1505,28 +2219,32 @@ int ExportFlowTable(nffile_t *nffile, int aggregate, int bidir, int GuessDir) {
 
     ExportExporterList(nffile);
 
-    size_t maxindex;
-    SortElement_t *SortList = GetSortList(&maxindex);
-    if (!SortList) return 0;
+    if (Spill.numRounds) {
+        ProcessSpill(PrintOrder, PrintDirection, NULL, NULL, nffile, GuessDir);
+    } else {
+        size_t maxindex;
+        SortElement_t *SortList = GetSortList(&maxindex);
+        if (!SortList) return 0;
 
-    if (PrintOrder) {
-        // for any -O print mode
-        for (int i = 0; i < maxindex; i++) {
-            FlowHashRecord_t *r = (FlowHashRecord_t *)(SortList[i].record);
-            SortList[i].count = order_mode[PrintOrder].record_function(r, order_mode[PrintOrder].inout);
-        }
+        if (PrintOrder) {
+            // for any -O print mode
+            for (int i = 0; i < maxindex; i++) {
+                FlowHashRecord_t *r = (FlowHashRecord_t *)(SortList[i].record);
+                SortList[i].count = order_mode[PrintOrder].record_function(r, order_mode[PrintOrder].inout);
+            }
 
-        if (maxindex >= 2) {
-            if (maxindex < 100) {
-                heapSort(SortList, maxindex, 0, DESCENDING);
-            } else {
-                blocksort((SortRecord_t *)SortList, maxindex);
+            if (maxindex >= 2) {
+                if (maxindex < 100) {
+                    heapSort(SortList, maxindex, 0, DESCENDING);
+                } else {
+                    blocksort((SortRecord_t *)SortList, maxindex);
+                }
             }
-        }
 
-        ExportSortList(SortList, maxindex, nffile, GuessDir, PrintDirection);
-    } else {
-        ExportSortList(SortList, maxindex, nffile, GuessDir, PrintDirection);
+            ExportSortList(SortList, maxindex, nffile, GuessDir, PrintDirection);
+        } else {
+            ExportSortList(SortList, maxindex, nffile, GuessDir, PrintDirection);
+        }
     }
 
     if (nffile->block_header->NumRecords) {
@@ -117,6 +117,8 @@
         }                                                                          \
     }
 
+typedef struct flowCache_s flowCache_t;
+
 int Init_FlowCache(void);
 
 void Dispose_FlowTable(void);
@@ -133,6 +135,12 @@ void InsertFlow(recordHandle_t *recordHandle);
 
 void AddFlowCache(recordHandle_t *recordHandle);
 
+flowCache_t *NewFlowCache(void);
+
+void AddLocalFlowBatch(flowCache_t *flowCache, recordHandle_t **handles, uint32_t numRecords);
+
+void MergeFlowCaches(int numThreads);
+
 void PrintFlowTable(RecordPrinter_t print_record, outputParams_t *outputParams, int GuessDir);
 
 void PrintFlowStat(RecordPrinter_t print_record, outputParams_t *outputParams);
@@ -36,6 +36,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -276,8 +277,13 @@ static struct StatRequest_s {
     uint32_t direction;   // bit field for sorting ascending/descending
     uint8_t StatType;     // index into StatParameters
     uint8_t order_proto;  // protocol separated statistics
+    uint32_t approx;      // number of sketch counters for an approximate stat, 0: exact stat
 } StatRequest[MaxStats];  // This number should do it for a single run
 
+// default number of counters of an approximate stat
+#define DefaultSketchCounters 10000
+#define MinSketchCounters 16
+
 static uint32_t NumStats = 0;  // number of stats in StatRequest
 
 // definitions for khash element stat
@@ -291,22 +297,224 @@ static uint32_t NumStats = 0;  // number of stats in StatRequest
 
 KHASH_INIT(ElementHash, hashkey_t, StatRecord_t, 1, kh_key_hash_func, kh_key_hash_equal)
 
-static khash_t(ElementHash) * ElementKHash[MaxStats];
+// index of an approximate stat - element key to counter slot
+KHASH_INIT(SketchHash, hashkey_t, uint32_t, 1, kh_key_hash_func, kh_key_hash_equal)
+
+/*
+ * Space-Saving sketch for approximate element stats -s <stat>:a
+ * The sketch keeps maxCounters elements with the largest counts of the order value. If a new element
+ * arrives with all counters in use, it takes the counter with the smallest count, inherits its count
+ * and records it as max error. The true order value of an element is in the range
+ * [count - error, count]. The counters in stat hold the values since the element took its counter.
+ */
+typedef struct sketchCounter_s {
+    StatRecord_t stat;  // must be first - StatTopN() lists &stat
+    uint64_t count;     // upper bound of the order value
+    uint64_t error;     // max overestimation of count
+    uint32_t heapPos;   // position in min heap
+} sketchCounter_t;
+
+typedef struct sketch_s {
+    khash_t(SketchHash) * index;
+    sketchCounter_t *counter;
+    uint32_t *heap;  // min heap of counter slots by count
+    uint32_t numCounters;
+    uint32_t maxCounters;
+} sketch_t;
+
+// element stat tables - one hash per requested stat and the memory of its var length keys
+struct statTable_s {
+    khash_t(ElementHash) * ElementKHash[MaxStats];
+    sketch_t *sketch[MaxStats];  // approximate stats
+    struct MemHandler_s *arena;  // thread local arena, NULL: shared arena
+};
+
+// main stat tables
+static statTable_t StatTable = {0};
+
+// thread local stat tables, merged by MergeStatTables()
+static statTable_t **threadTable = NULL;
+static int numThreadTables = 0;
+
+typedef struct statMerger_s {
+    pthread_t tid;
+    int first;  // first stat to merge
+    int step;   // merge every step stat
+} statMerger_t;
 
 static uint32_t LoadedGeoDB = 0;
 
 /* function prototypes */
 static int ParseListOrder(char *orderBy, struct StatRequest_s *request);
 
-static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, StatRecord_t *StatData, int type, int order_proto, int inout);
+static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, StatRecord_t *StatData, int type, int order_proto, int inout,
+                          int64_t maxError);
 
-static void PrintCvsStatLine(stat_record_t *stat, int printPlain, StatRecord_t *StatData, int type, int order_proto, int tag, int inout);
+static void PrintCvsStatLine(stat_record_t *stat, int printPlain, StatRecord_t *StatData, int type, int order_proto, int tag, int inout,
+                             int64_t maxError);
 
 static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int order, direction_t direction);
 
 #include "heapsort_inline.c"
 #include "memhandle.c"
 
+static sketch_t *NewSketch(uint32_t maxCounters) {
+    sketch_t *sketch = calloc(1, sizeof(sketch_t));
+    if (!sketch) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        return NULL;
+    }
+    sketch->counter = calloc(maxCounters, sizeof(sketchCounter_t));
+    sketch->heap = calloc(maxCounters, sizeof(uint32_t));
+    if (!sketch->counter || !sketch->heap) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(sketch->counter);
+        free(sketch->heap);
+        free(sketch);
+        return NULL;
+    }
+    sketch->index = kh_init(SketchHash);
+    kh_resize(SketchHash, sketch->index, maxCounters);
+    sketch->maxCounters = maxCounters;
+    sketch->numCounters = 0;
+
+    return sketch;
+
+}  // End of NewSketch
+
+static void FreeSketch(sketch_t *sketch) {
+    if (!sketch) return;
+
+    for (int i = 0; i < sketch->numCounters; i++) {
+        if (sketch->counter[i].stat.hashkey.ptrSize) free(sketch->counter[i].stat.hashkey.ptr);
+    }
+    kh_destroy(SketchHash, sketch->index);
+    free(sketch->counter);
+    free(sketch->heap);
+    free(sketch);
+
+}  // End of FreeSketch
+
+static inline void SketchSwap(sketch_t *sketch, uint32_t a, uint32_t b) {
+    uint32_t slot = sketch->heap[a];
+    sketch->heap[a] = sketch->heap[b];
+    sketch->heap[b] = slot;
+    sketch->counter[sketch->heap[a]].heapPos = a;
+    sketch->counter[sketch->heap[b]].heapPos = b;
+}  // End of SketchSwap
+
+static void SketchSiftDown(sketch_t *sketch, uint32_t pos) {
+    while (1) {
+        uint32_t smallest = pos;
+        uint32_t left = 2 * pos + 1;
+        uint32_t right = left + 1;
+        if (left < sketch->numCounters && sketch->counter[sketch->heap[left]].count < sketch->counter[sketch->heap[smallest]].count)
+            smallest = left;
+        if (right < sketch->numCounters && sketch->counter[sketch->heap[right]].count < sketch->counter[sketch->heap[smallest]].count)
+            smallest = right;
+        if (smallest == pos) return;
+        SketchSwap(sketch, pos, smallest);
+        pos = smallest;
+    }
+}  // End of SketchSiftDown
+
+static void SketchSiftUp(sketch_t *sketch, uint32_t pos) {
+    while (pos) {
+        uint32_t parent = (pos - 1) / 2;
+        if (sketch->counter[sketch->heap[parent]].count <= sketch->counter[sketch->heap[pos]].count) return;
+        SketchSwap(sketch, pos, parent);
+        pos = parent;
+    }
+}  // End of SketchSiftUp
+
+// add the values of an element with weight to the sketch. error is the max error already
+// contained in weight, when merging sketches
+static void SketchUpdate(sketch_t *sketch, hashkey_t *hashkey, StatRecord_t *values, uint64_t weight, uint64_t error) {
+    khiter_t k = kh_get(SketchHash, sketch->index, *hashkey);
+    if (k != kh_end(sketch->index)) {
+        sketchCounter_t *counter = &sketch->counter[kh_value(sketch->index, k)];
+        counter->stat.inBytes += values->inBytes;
+        counter->stat.inPackets += values->inPackets;
+        counter->stat.outBytes += values->outBytes;
+        counter->stat.outPackets += values->outPackets;
+        if (values->msecFirst < counter->stat.msecFirst) counter->stat.msecFirst = values->msecFirst;
+        if (values->msecLast > counter->stat.msecLast) counter->stat.msecLast = values->msecLast;
+        counter->stat.flows += values->flows;
+        counter->count += weight;
+        counter->error += error;
+        SketchSiftDown(sketch, counter->heapPos);
+        return;
+    }
+
+    sketchCounter_t *counter;
+    uint32_t slot;
+    uint64_t minCount = 0;
+    int takeOver = 0;
+    if (sketch->numCounters < sketch->maxCounters) {
+        slot = sketch->numCounters;
+        counter = &sketch->counter[slot];
+        sketch->heap[slot] = slot;
+        counter->heapPos = slot;
+        sketch->numCounters++;
+    } else {
+        // take over the counter of the smallest element
+        slot = sketch->heap[0];
+        counter = &sketch->counter[slot];
+        minCount = counter->count;
+        takeOver = 1;
+        k = kh_get(SketchHash, sketch->index, counter->stat.hashkey);
+        kh_del(SketchHash, sketch->index, k);
+        if (counter->stat.hashkey.ptrSize) free(counter->stat.hashkey.ptr);
+    }
+
+    counter->stat = *values;
+    counter->stat.hashkey = *hashkey;
+    if (hashkey->ptrSize) {
+        void *p = malloc(hashkey->ptrSize);
+        if (!p) {
+            LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        memcpy(p, hashkey->ptr, hashkey->ptrSize);
+        counter->stat.hashkey.ptr = p;
+    }
+    counter->count = minCount + weight;
+    counter->error = minCount + error;
+
+    int ret;
+    k = kh_put(SketchHash, sketch->index, counter->stat.hashkey, &ret);
+    kh_value(sketch->index, k) = slot;
+
+    // a new counter is appended at the end of the heap, a taken over counter is the heap root
+    if (takeOver)
+        SketchSiftDown(sketch, counter->heapPos);
+    else
+        SketchSiftUp(sketch, counter->heapPos);
+
+}  // End of SketchUpdate
+
+// merge sketch source into sketch. An element missing in a full source sketch may have
+// a count up to the smallest count of source, which is added to the count and error
+static void SketchMerge(sketch_t *sketch, sketch_t *source) {
+    for (int i = 0; i < source->numCounters; i++) {
+        sketchCounter_t *counter = &source->counter[i];
+        SketchUpdate(sketch, &counter->stat.hashkey, &counter->stat, counter->count, counter->error);
+    }
+
+    if (source->numCounters < source->maxCounters) return;
+
+    uint64_t minCount = source->counter[source->heap[0]].count;
+    for (int i = 0; i < sketch->numCounters; i++) {
+        sketchCounter_t *counter = &sketch->counter[i];
+        if (kh_get(SketchHash, source->index, counter->stat.hashkey) == kh_end(source->index)) {
+            counter->count += minCount;
+            counter->error += minCount;
+        }
+    }
+    for (int i = sketch->numCounters / 2; i > 0; i--) SketchSiftDown(sketch, i - 1);
+
+}  // End of SketchMerge
+
 static uint64_t null_element(StatRecord_t *record, flowDir_t inout) { return 0; }
 
 static uint64_t flows_element(StatRecord_t *record, flowDir_t inout) { return record->flows; }
@@ -370,15 +578,72 @@ int Init_StatTable(void) {
     if (!nfalloc_Init(8 * 1024 * 1024)) return 0;
 
     for (int i = 0; i < MaxStats; i++) {
-        ElementKHash[i] = kh_init(ElementHash);
+        StatTable.ElementKHash[i] = kh_init(ElementHash);
+        StatTable.sketch[i] = NULL;
+        if (i < NumStats && StatRequest[i].approx) {
+            StatTable.sketch[i] = NewSketch(StatRequest[i].approx);
+            if (!StatTable.sketch[i]) return 0;
+        }
     }
+    StatTable.arena = NULL;
 
     LoadedGeoDB = Loaded_MaxMind();
     return 1;
 
 }  // End of Init_StatTable
 
-void Dispose_StatTable(void) { nfalloc_free(); }  // End of Dispose_Tables
+void Dispose_StatTable(void) {
+    for (int i = 0; i < numThreadTables; i++) {
+        for (int j = 0; j < MaxStats; j++) {
+            if (threadTable[i]->ElementKHash[j]) kh_destroy(ElementHash, threadTable[i]->ElementKHash[j]);
+            FreeSketch(threadTable[i]->sketch[j]);
+        }
+        nfalloc_Dispose(threadTable[i]->arena);
+        free(threadTable[i]);
+    }
+    free(threadTable);
+    threadTable = NULL;
+    numThreadTables = 0;
+
+    for (int i = 0; i < MaxStats; i++) {
+        FreeSketch(StatTable.sketch[i]);
+        StatTable.sketch[i] = NULL;
+    }
+
+    nfalloc_free();
+
+}  // End of Dispose_Tables
+
+// create thread local stat tables with their own memory arena. Records are added by the owner thread
+// with AddLocalElementStat() without any locking. Must be called before the threads are started
+statTable_t *NewStatTable(void) {
+    statTable_t **tableList = realloc(threadTable, (numThreadTables + 1) * sizeof(statTable_t *));
+    statTable_t *statTable = calloc(1, sizeof(statTable_t));
+    if (!tableList || !statTable) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        free(statTable);
+        if (tableList) threadTable = tableList;
+        return NULL;
+    }
+    threadTable = tableList;
+
+    statTable->arena = nfalloc_New(8 * 1024 * 1024);
+    if (!statTable->arena) {
+        free(statTable);
+        return NULL;
+    }
+    for (int i = 0; i < NumStats; i++) {
+        statTable->ElementKHash[i] = kh_init(ElementHash);
+        if (StatRequest[i].approx) {
+            statTable->sketch[i] = NewSketch(StatRequest[i].approx);
+            if (!statTable->sketch[i]) exit(255);
+        }
+    }
+    threadTable[numThreadTables++] = statTable;
+
+    return statTable;
+
+}  // End of NewStatTable
 
 static int ParseListOrder(char *orderBy, struct StatRequest_s *request) {
     request->orderBy = 0;
@@ -446,14 +711,31 @@ int SetElementStat(char *elementStat, char *orderBy) {
 
     struct StatRequest_s *request = &StatRequest[NumStats++];
     request->order_proto = 0;
+    request->approx = 0;
     char *optProto = strchr(elementStat, ':');
     if (optProto) {
         *optProto++ = 0;
-        if (optProto[0] == 'p' && optProto[1] == '\0') {
-            request->order_proto = 1;
-        } else {
-            LogError("Unknown statistic option :%s in %s", optProto, elementStat);
-            return 0;
+        char *opt = optProto;
+        while (*opt) {
+            if (*opt == 'p') {
+                request->order_proto = 1;
+                opt++;
+            } else if (*opt == 'a') {
+                // approximate stat with optional number of counters
+                opt++;
+                request->approx = DefaultSketchCounters;
+                if (isdigit(*opt)) {
+                    long counters = strtol(opt, &opt, 10);
+                    if (counters < MinSketchCounters || counters > 0x7FFFFFFF) {
+                        LogError("Number of counters %ld out of range for approximate statistic %s", counters, elementStat);
+                        return 0;
+                    }
+                    request->approx = counters;
+                }
+            } else {
+                LogError("Unknown statistic option :%s in %s", optProto, elementStat);
+                return 0;
+            }
         }
     }
 
@@ -479,6 +761,22 @@ int SetElementStat(char *elementStat, char *orderBy) {
         return 0;
     }
 
+    if (request->approx) {
+        // the sketch counts one order value, which must be a sum of the flow values
+        int order = 0;
+        while (orderByTable[order].string && (request->orderBy & (1 << order)) == 0) order++;
+        order_proc_element_t element_function = orderByTable[order].element_function;
+        if (request->orderBy != (1 << order) ||
+            (element_function != flows_element && element_function != packets_element && element_function != bytes_element)) {
+            LogError("Approximate statistic %s needs a single order of flows, packets or bytes", elementStat);
+            return 0;
+        }
+        if (request->direction) {
+            LogError("Approximate statistic %s can only be ordered descending", elementStat);
+            return 0;
+        }
+    }
+
     return 1;
 
 }  // End of SetElementStat
@@ -534,7 +832,8 @@ static inline void PreProcess(void *inPtr, preprocess_t process, recordHandle_t
     }
 }  // End of PreProcess
 
-void AddElementStat(recordHandle_t *recordHandle) {
+// add a record to the stat tables. The tables must not be shared with other threads
+static void AddStat(statTable_t *statTable, recordHandle_t *recordHandle) {
     EXgenericFlow_t *genericFlow = (EXgenericFlow_t *)recordHandle->extensionList[EXgenericFlowID];
     if (!genericFlow) return;
 
@@ -579,9 +878,14 @@ void AddElementStat(recordHandle_t *recordHandle) {
                     hashkey.v1 = ((uint64_t *)inPtr)[1];
                 } break;
                 default: {
-                    void *p = nfmalloc(length);
-                    hashkey.ptr = p;
-                    memcpy((void *)p, inPtr, length);
+                    if (StatRequest[i].approx) {
+                        // the sketch copies the key of a new element
+                        hashkey.ptr = inPtr;
+                    } else {
+                        void *p = statTable->arena ? nfmalloc_arena(statTable->arena, length) : nfmalloc(length);
+                        hashkey.ptr = p;
+                        memcpy((void *)p, inPtr, length);
+                    }
                     hashkey.ptrSize = length;
                 }
             }
@@ -595,38 +899,137 @@ void AddElementStat(recordHandle_t *recordHandle) {
                 outPackets = cntFlow->outPackets;
                 numFlows = cntFlow->flows ? cntFlow->flows : 1;
             }
+            if (StatRequest[i].approx) {
+                StatRecord_t values = {.msecFirst = genericFlow->msecFirst,
+                                       .msecLast = genericFlow->msecLast,
+                                       .inBytes = genericFlow->inBytes,
+                                       .inPackets = genericFlow->inPackets,
+                                       .outBytes = outBytes,
+                                       .outPackets = outPackets,
+                                       .flows = numFlows};
+                int order = 0;
+                while ((StatRequest[i].orderBy & (1 << order)) == 0) order++;
+                uint64_t weight = orderByTable[order].element_function(&values, orderByTable[order].inout);
+                SketchUpdate(statTable->sketch[i], &hashkey, &values, weight, 0);
+                index++;
+                continue;
+            }
+
+            khash_t(ElementHash) *hash = statTable->ElementKHash[i];
             int ret;
-            khiter_t k = kh_put(ElementHash, ElementKHash[i], hashkey, &ret);
+            khiter_t k = kh_put(ElementHash, hash, hashkey, &ret);
             if (ret == 0) {
-                kh_value(ElementKHash[i], k).inBytes += genericFlow->inBytes;
-                kh_value(ElementKHash[i], k).inPackets += genericFlow->inPackets;
-                kh_value(ElementKHash[i], k).outBytes += outBytes;
-                kh_value(ElementKHash[i], k).outPackets += outPackets;
+                kh_value(hash, k).inBytes += genericFlow->inBytes;
+                kh_value(hash, k).inPackets += genericFlow->inPackets;
+                kh_value(hash, k).outBytes += outBytes;
+                kh_value(hash, k).outPackets += outPackets;
 
-                if (genericFlow->msecFirst < kh_value(ElementKHash[i], k).msecFirst) {
-                    kh_value(ElementKHash[i], k).msecFirst = genericFlow->msecFirst;
+                if (genericFlow->msecFirst < kh_value(hash, k).msecFirst) {
+                    kh_value(hash, k).msecFirst = genericFlow->msecFirst;
                 }
-                if (genericFlow->msecLast > kh_value(ElementKHash[i], k).msecLast) {
-                    kh_value(ElementKHash[i], k).msecLast = genericFlow->msecLast;
+                if (genericFlow->msecLast > kh_value(hash, k).msecLast) {
+                    kh_value(hash, k).msecLast = genericFlow->msecLast;
                 }
-                kh_value(ElementKHash[i], k).flows += numFlows;
+                kh_value(hash, k).flows += numFlows;
 
             } else {
-                kh_value(ElementKHash[i], k).inBytes = genericFlow->inBytes;
-                kh_value(ElementKHash[i], k).inPackets = genericFlow->inPackets;
-                kh_value(ElementKHash[i], k).outBytes = outBytes;
-                kh_value(ElementKHash[i], k).outPackets = outPackets;
-                kh_value(ElementKHash[i], k).msecFirst = genericFlow->msecFirst;
-                kh_value(ElementKHash[i], k).msecLast = genericFlow->msecLast;
-                kh_value(ElementKHash[i], k).flows = numFlows;
-                kh_value(ElementKHash[i], k).hashkey = hashkey;
+                kh_value(hash, k).inBytes = genericFlow->inBytes;
+                kh_value(hash, k).inPackets = genericFlow->inPackets;
+                kh_value(hash, k).outBytes = outBytes;
+                kh_value(hash, k).outPackets = outPackets;
+                kh_value(hash, k).msecFirst = genericFlow->msecFirst;
+                kh_value(hash, k).msecLast = genericFlow->msecLast;
+                kh_value(hash, k).flows = numFlows;
+                kh_value(hash, k).hashkey = hashkey;
             }
             index++;
         } while (StatParameters[index].HeaderInfo == NULL);
     }  // for every requested -s stat
-}  // AddElementStat
+}  // End of AddStat
+
+void AddElementStat(recordHandle_t *recordHandle) { AddStat(&StatTable, recordHandle); }  // End of AddElementStat
+
+void AddLocalElementStat(statTable_t *statTable, recordHandle_t *recordHandle) {
+    AddStat(statTable, recordHandle);
+}  // End of AddLocalElementStat
+
+// merge every worker->step stat of all thread local tables into the main tables
+__attribute__((noreturn)) static void *statMerger(void *arg) {
+    statMerger_t *worker = (statMerger_t *)arg;
 
-static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, StatRecord_t *StatData, int type, int order_proto, int inout) {
+    for (int i = worker->first; i < NumStats; i += worker->step) {
+        if (StatRequest[i].approx) {
+            for (int j = 0; j < numThreadTables; j++) {
+                SketchMerge(StatTable.sketch[i], threadTable[j]->sketch[i]);
+                FreeSketch(threadTable[j]->sketch[i]);
+                threadTable[j]->sketch[i] = NULL;
+            }
+        }
+
+        khash_t(ElementHash) *hash = StatTable.ElementKHash[i];
+        for (int j = 0; j < numThreadTables; j++) {
+            khash_t(ElementHash) *source = threadTable[j]->ElementKHash[i];
+            for (khiter_t k = kh_begin(source); k != kh_end(source); ++k) {
+                if (!kh_exist(source, k)) continue;
+                StatRecord_t *r = &kh_value(source, k);
+
+                int ret;
+                khiter_t p = kh_put(ElementHash, hash, kh_key(source, k), &ret);
+                if (ret == 0) {
+                    StatRecord_t *stat = &kh_value(hash, p);
+                    stat->inBytes += r->inBytes;
+                    stat->inPackets += r->inPackets;
+                    stat->outBytes += r->outBytes;
+                    stat->outPackets += r->outPackets;
+                    if (r->msecFirst < stat->msecFirst) stat->msecFirst = r->msecFirst;
+                    if (r->msecLast > stat->msecLast) stat->msecLast = r->msecLast;
+                    stat->flows += r->flows;
+                } else {
+                    // var length keys remain in the arena of the thread table
+                    kh_value(hash, p) = *r;
+                }
+            }
+            kh_destroy(ElementHash, source);
+            threadTable[j]->ElementKHash[i] = NULL;
+        }
+    }
+
+    pthread_exit(NULL);
+    /* UNREACHED */
+
+}  // End of statMerger
+
+// merge all thread local stat tables into the main tables for StatTopN(). Each stat is merged
+// by one of numThreads threads. Must be called once, after all threads adding records have finished
+void MergeStatTables(int numThreads) {
+    if (numThreadTables == 0) return;
+    if (numThreads > (int)NumStats) numThreads = NumStats;
+    if (numThreads < 1) numThreads = 1;
+
+    statMerger_t *workers = calloc(numThreads, sizeof(statMerger_t));
+    if (!workers) {
+        LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        workers[i].first = i;
+        workers[i].step = numThreads;
+        int err = pthread_create(&workers[i].tid, NULL, statMerger, (void *)&workers[i]);
+        if (err) {
+            LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+            exit(255);
+        }
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    free(workers);
+
+}  // End of MergeStatTables
+
+static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, StatRecord_t *StatData, int type, int order_proto, int inout,
+                          int64_t maxError) {
     char valstr[64];
     valstr[0] = '\0';
 
@@ -797,23 +1200,30 @@ static void PrintStatLine(stat_record_t *stat, outputParams_t *outputParams, Sta
         snprintf(dStr, 64, "%s", DurationString(duration));
 
     if (Getv6Mode() && (type == IS_IPADDR)) {
-        printf("%s.%03u %9.3f %-5s %s%39s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr, (unsigned)(StatData->msecFirst % 1000), duration,
+        printf("%s.%03u %9.3f %-5s %s%39s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u", datestr, (unsigned)(StatData->msecFirst % 1000), duration,
                protoStr, tag_string, valstr, flows_str, flows_percent, packets_str, packets_percent, byte_str, bytes_percent, pps_str, bps_str, bpp);
     } else {
         if (LoadedGeoDB) {
-            printf("%s.%03u %9s %-5s %s%21s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr, (unsigned)(StatData->msecFirst % 1000), dStr,
+            printf("%s.%03u %9s %-5s %s%21s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u", datestr, (unsigned)(StatData->msecFirst % 1000), dStr,
                    protoStr, tag_string, valstr, flows_str, flows_percent, packets_str, packets_percent, byte_str, bytes_percent, pps_str, bps_str,
                    bpp);
         } else {
-            printf("%s.%03u %9s %-5s %s%17s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u\n", datestr, (unsigned)(StatData->msecFirst % 1000), dStr,
+            printf("%s.%03u %9s %-5s %s%17s %8s(%4.1f) %8s(%4.1f) %8s(%4.1f) %8s %8s %5u", datestr, (unsigned)(StatData->msecFirst % 1000), dStr,
                    protoStr, tag_string, valstr, flows_str, flows_percent, packets_str, packets_percent, byte_str, bytes_percent, pps_str, bps_str,
                    bpp);
         }
     }
+    if (maxError >= 0) {
+        numStr error_str;
+        format_number(maxError, error_str, outputParams->printPlain, FIXED_WIDTH);
+        printf(" %8s", error_str);
+    }
+    printf("\n");
 
 }  // End of PrintStatLine
 
-static void PrintCvsStatLine(stat_record_t *stat, int printPlain, StatRecord_t *StatData, int type, int order_proto, int tag, int inout) {
+static void PrintCvsStatLine(stat_record_t *stat, int printPlain, StatRecord_t *StatData, int type, int order_proto, int tag, int inout,
+                             int64_t maxError) {
     char valstr[40];
 
     switch (type) {
@@ -895,10 +1305,12 @@ static void PrintCvsStatLine(stat_record_t *stat, int printPlain, StatRecord_t *
     char datestr2[64];
     strftime(datestr2, 63, "%Y-%m-%d %H:%M:%S", tbuff);
 
-    printf("%s,%s,%.3f,%s,%s,%llu,%.1f,%llu,%.1f,%llu,%.1f,%llu,%llu,%u\n", datestr1, datestr2, duration,
+    printf("%s,%s,%.3f,%s,%s,%llu,%.1f,%llu,%.1f,%llu,%.1f,%llu,%llu,%u", datestr1, datestr2, duration,
            order_proto ? ProtoString(StatData->hashkey.proto, printPlain) : "any", valstr, (long long unsigned)count_flows, flows_percent,
            (long long unsigned)count_packets, packets_percent, (long long unsigned)count_bytes, bytes_percent, (long long unsigned)pps,
            (long long unsigned)bps, bpp);
+    if (maxError >= 0) printf(",%llu", (long long unsigned)maxError);
+    printf("\n");
 
 }  // End of PrintCvsStatLine
 
@@ -910,6 +1322,7 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
         int stat = StatRequest[hash_num].StatType;
         int order = StatRequest[hash_num].orderBy;
         int type = StatParameters[stat].type;
+        uint32_t approx = StatRequest[hash_num].approx;
         for (int order_index = 0; orderByTable[order_index].string != NULL; order_index++) {
             unsigned int order_bit = (1 << order_index);
             if (order & order_bit) {
@@ -920,39 +1333,45 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
                 // this output formatting is pretty ugly - and needs to be cleaned up - improved
                 if (outputParams->mode == MODE_PLAIN && !outputParams->quiet) {
                     if (outputParams->topN != 0) {
-                        printf("Top %i %s ordered by %s:\n", outputParams->topN, StatParameters[stat].HeaderInfo, orderByTable[order_index].string);
+                        printf("Top %i %s ordered by %s", outputParams->topN, StatParameters[stat].HeaderInfo, orderByTable[order_index].string);
                     } else {
-                        printf("Top %s ordered by %s:\n", StatParameters[stat].HeaderInfo, orderByTable[order_index].string);
+                        printf("Top %s ordered by %s", StatParameters[stat].HeaderInfo, orderByTable[order_index].string);
                     }
+                    if (approx)
+                        printf(", approximate with %u counters:\n", approx);
+                    else
+                        printf(":\n");
                     if (Getv6Mode() && (type == IS_IPADDR)) {
                         printf(
                             "Date first seen                 Duration Proto %39s    Flows(%%)     Packets(%%)       Bytes(%%)         pps      bps   "
-                            "bpp\n",
+                            "bpp",
                             StatParameters[stat].HeaderInfo);
                     } else {
                         if (LoadedGeoDB) {
                             printf(
                                 "Date first seen                 Duration Proto %21s    Flows(%%)     Packets(%%)       Bytes(%%)         pps      "
                                 "bps   "
-                                "bpp\n",
+                                "bpp",
                                 StatParameters[stat].HeaderInfo);
                         } else {
                             printf(
                                 "Date first seen                 Duration Proto %17s    Flows(%%)     Packets(%%)       Bytes(%%)         pps      "
                                 "bps   "
-                                "bpp\n",
+                                "bpp",
                                 StatParameters[stat].HeaderInfo);
                         }
                     }
+                    printf(approx ? " MaxError\n" : "\n");
                 }
 
                 if (outputParams->mode == MODE_CSV) {
                     if (orderByTable[order_index].inout == IN)
-                        printf("ts,te,td,pr,val,fl,flP,ipkt,ipktP,ibyt,ibytP,ipps,ibps,ibpp\n");
+                        printf("ts,te,td,pr,val,fl,flP,ipkt,ipktP,ibyt,ibytP,ipps,ibps,ibpp");
                     else if (orderByTable[order_index].inout == OUT)
-                        printf("ts,te,td,pr,val,fl,flP,opkt,opktP,obyt,obytP,opps,obps,obpp\n");
+                        printf("ts,te,td,pr,val,fl,flP,opkt,opktP,obyt,obytP,opps,obps,obpp");
                     else
-                        printf("ts,te,td,pr,val,fl,flP,pkt,pktP,byt,bytP,pps,bps,bpp\n");
+                        printf("ts,te,td,pr,val,fl,flP,pkt,pktP,byt,bytP,pps,bps,bpp");
+                    printf(approx ? ",err\n" : "\n");
                 }
 
                 int startIndex, endIndex, increment;
@@ -970,14 +1389,16 @@ void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, Rec
                 dbg_printf("Print stat table: start: %d, end: %d, incr: %d\n", startIndex, endIndex, increment);
                 int index = startIndex;
                 while (index != endIndex) {
+                    // true order value is in [value, value + maxError] for approximate stats
+                    int64_t maxError = approx ? ((sketchCounter_t *)topN_element_list[index].record)->error : -1;
                     switch (outputParams->mode) {
                         case MODE_PLAIN:
                             PrintStatLine(sum_stat, outputParams, (StatRecord_t *)topN_element_list[index].record, type,
-                                          StatRequest[hash_num].order_proto, orderByTable[order_index].inout);
+                                          StatRequest[hash_num].order_proto, orderByTable[order_index].inout, maxError);
                             break;
                         case MODE_CSV:
                             PrintCvsStatLine(sum_stat, outputParams->printPlain, (StatRecord_t *)topN_element_list[index].record, type,
-                                             StatRequest[hash_num].order_proto, outputParams->doTag, orderByTable[order_index].inout);
+                                             StatRequest[hash_num].order_proto, outputParams->doTag, orderByTable[order_index].inout, maxError);
                             break;
                         case MODE_JSON:
                             printf("Not yet implemented output format\n");
@@ -995,7 +1416,8 @@ static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int orde
     SortElement_t *topN_list;
     uint32_t c, maxindex;
 
-    maxindex = kh_size(ElementKHash[hash_num]);
+    sketch_t *sketch = StatTable.sketch[hash_num];
+    maxindex = sketch ? sketch->numCounters : kh_size(StatTable.ElementKHash[hash_num]);
     dbg_printf("StatTopN sort %u records\n", maxindex);
     topN_list = (SortElement_t *)calloc(maxindex, sizeof(SortElement_t));
 
@@ -1006,10 +1428,18 @@ static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int orde
 
     // preset topN_list table - still unsorted
     c = 0;
+    if (sketch) {
+        // approximate stat - order by the upper bound of the counter
+        for (int i = 0; i < sketch->numCounters; i++) {
+            topN_list[c].count = sketch->counter[i].count;
+            topN_list[c].record = (void *)&sketch->counter[i];
+            c++;
+        }
+    }
     // Iterate through all buckets
-    for (khiter_t k = kh_begin(ElementKHash[hash_num]); k != kh_end(ElementKHash[hash_num]); ++k) {  // traverse
-        if (kh_exist(ElementKHash[hash_num], k)) {
-            StatRecord_t *r = &kh_value(ElementKHash[hash_num], k);
+    for (khiter_t k = kh_begin(StatTable.ElementKHash[hash_num]); k != kh_end(StatTable.ElementKHash[hash_num]); ++k) {  // traverse
+        if (kh_exist(StatTable.ElementKHash[hash_num], k)) {
+            StatRecord_t *r = &kh_value(StatTable.ElementKHash[hash_num], k);
             topN_list[c].count = orderByTable[order].element_function(r, orderByTable[order].inout);
             topN_list[c].record = (void *)r;
             c++;
@@ -43,6 +43,8 @@
 #define FLAG_JA3 0x2
 #define FLAG_GEO 0x4
 
+typedef struct statTable_s statTable_t;
+
 /* Function prototypes */
 int Init_StatTable(void);
 
@@ -52,6 +54,12 @@ int SetElementStat(char *elementStat, char *orderBy);
 
 void AddElementStat(recordHandle_t *recordHandle);
 
+statTable_t *NewStatTable(void);
+
+void AddLocalElementStat(statTable_t *statTable, recordHandle_t *recordHandle);
+
+void MergeStatTables(int numThreads);
+
 void PrintElementStat(stat_record_t *sum_stat, outputParams_t *outputParams, RecordPrinter_t print_record);
 
 void ListPrintOrder(void);
@@ -149,6 +149,9 @@ static void usage(char *name) {
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=<comp>:delta\tDelta encode flows before compression.\n"
+        "-z=<comp>:column\tColumn encode flows before compression.\n"
+        "-z=<comp>:adapt\tAdapt compression per block to the collector load.\n"
         "-v\t\tverbose logging.\n"
         "-D\t\tdetach from terminal (daemonize)\n",
         name);
@@ -32,7 +32,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,6 +54,7 @@
 #include "nfstatfile.h"
 #include "nfxV3.h"
 #include "profile.h"
+#include "queue.h"
 #include "util.h"
 #include "version.h"
 
@@ -60,6 +63,9 @@
 char influxdb_url[1024] = "";
 #endif
 
+// number of threads to filter and write the channels, 0: number of cores online
+static int processThreads = 0;
+
 /* Function Prototypes */
 static void usage(char *name);
 
@@ -90,13 +96,263 @@ static void usage(char *name) {
         "-z=bz2\t\tBZIP2 compress flows in output file.\n"
         "-z=lz4[:level]\tLZ4 compress flows in output file.\n"
         "-z=zstd[:level]\tZSTD compress flows in output file.\n"
+        "-z=<comp>:delta\tDelta encode flows before compression.\n"
 #ifdef HAVE_INFLUXDB
         "-i <influxurl>\tInfluxdb url for stats (example: http://localhost:8086/write?db=mydb&u=pippo&p=paperino)\n"
 #endif
-        "-t <time>\ttime for RRD update\n",
+        "-t <time>\ttime for RRD update\n"
+        "-W <num>\tFilter and write flows with <num> threads. Default: number of cores online.\n",
         name);
 } /* usage */
 
+/*
+ * A block of the input files passes two stages: the filter workers filter the V3 records of a
+ * block with the filter set of all channel filters and set the bitmask of the matching channels
+ * for each record. The channel writers write the matching records of the block to the files of
+ * their channels. Each channel is owned by one writer, which writes the blocks in file order.
+ * All records of a block, other than V3 records, are processed by the reading thread.
+ */
+typedef struct profileJob_s {
+    dataBlock_t *dataBlock;
+    char *ident;               // ident of the file of this block
+    uint32_t firstFlow;        // number of V3 records before this block
+    uint64_t *channelMatch;    // bitmask of matching channels of each record
+    uint8_t *flush;            // records to be written to all channel files
+    int filtered;              // set by the filter worker, protected by filterLock
+    _Atomic uint32_t pending;  // number of writers, which have not written this block
+} profileJob_t;
+
+// parameters and thread local state of a filter worker
+typedef struct filterWorker_s {
+    pthread_t tid;
+    queue_t *jobQueue;
+    void *filterSet;  // thread local filter set of all channel filters
+    recordHandle_t recordHandle;
+} filterWorker_t;
+
+// parameters and thread local state of a channel writer
+typedef struct channelWriter_s {
+    pthread_t tid;
+    queue_t *jobQueue;
+    profile_channel_info_t *channels;
+    uint64_t *channelMask;  // channels owned by this writer
+    recordHandle_t recordHandle;
+} channelWriter_t;
+
+// number of uint64_t words of a channel bitmask
+static uint32_t numWords = 0;
+
+// writers wait for the filter workers to finish the next block
+static pthread_mutex_t filterLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filterCond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * take the current block of nffile for processing. Process all records other than V3 records
+ * and mark the records to be written to all channel files
+ */
+static profileJob_t *NewProfileJob(nffile_t *nffile, uint32_t size, uint32_t *processed) {
+    dataBlock_t *dataBlock = nffile->block_header;
+    profileJob_t *job = calloc(1, sizeof(profileJob_t));
+    if (job) {
+        job->channelMatch = malloc((dataBlock->NumRecords * numWords + 1) * sizeof(uint64_t));
+        job->flush = calloc(dataBlock->NumRecords + 1, sizeof(uint8_t));
+    }
+    if (!job || !job->channelMatch || !job->flush) {
+        LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+        exit(255);
+    }
+    job->firstFlow = *processed;
+    job->ident = FILE_IDENT(nffile) ? strdup(FILE_IDENT(nffile)) : NULL;
+
+    record_header_t *record_ptr = nffile->buff_ptr;
+    uint32_t sumSize = 0;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if ((sumSize + record_ptr->size) > size || (record_ptr->size < sizeof(record_header_t))) {
+            LogError("Corrupt data file. Inconsistent block size in %s line %d", __FILE__, __LINE__);
+            exit(255);
+        }
+        sumSize += record_ptr->size;
+
+        switch (record_ptr->type) {
+            case V3Record:
+                (*processed)++;
+                break;
+            case ExporterInfoRecordType: {
+                int err = AddExporterInfo((exporter_info_record_t *)record_ptr);
+                if (err != 0) {
+                    // flush new exporter
+                    job->flush[i] = err == 1;
+                } else {
+                    LogError("Failed to add Exporter Record");
+                }
+            } break;
+            case SamplerLegacyRecordType: {
+                if (AddSamplerLegacyRecord((samplerV0_record_t *)record_ptr) == 0) LogError("Failed to add legacy Sampler Record\n");
+            } break;
+            case SamplerRecordType: {
+                int err = AddSamplerRecord((sampler_record_t *)record_ptr);
+                if (err != 0) {
+                    // flush new map
+                    job->flush[i] = err == 1;
+                } else {
+                    LogError("Failed to add Sampler Record");
+                }
+            } break;
+            case NbarRecordType:
+            case IfNameRecordType:
+            case VrfNameRecordType:
+                // flush new map
+                job->flush[i] = 1;
+                break;
+            case LegacyRecordType1:
+            case LegacyRecordType2:
+            case ExporterStatRecordType:
+                // Silently skip exporter records
+                break;
+            default: {
+                LogError("Skip unknown record type %i", record_ptr->type);
+            }
+        }
+        // Advance pointer by number of bytes for netflow record
+        record_ptr = (record_header_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+
+    }  // End of for all umRecords
+
+    job->dataBlock = TakeBlock(nffile);
+    if (!job->dataBlock) exit(255);
+
+    return job;
+
+}  // End of NewProfileJob
+
+static void FreeProfileJob(profileJob_t *job) {
+    ReleaseDataBlock(job->dataBlock);
+    free(job->ident);
+    free(job->channelMatch);
+    free(job->flush);
+    free(job);
+}  // End of FreeProfileJob
+
+// filter all V3 records of the block with all channel filters at once
+static void FilterProfileJob(profileJob_t *job, void *filterSet, recordHandle_t *recordHandle) {
+    dataBlock_t *dataBlock = job->dataBlock;
+    record_header_t *record_ptr = (record_header_t *)((void *)dataBlock + sizeof(dataBlock_t));
+    uint32_t processed = job->firstFlow;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if (record_ptr->type == V3Record) {
+            processed++;
+            MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, processed);
+            FilterRecordSet(filterSet, recordHandle, job->ident, &job->channelMatch[i * numWords]);
+        }
+        record_ptr = (record_header_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+    }
+}  // End of FilterProfileJob
+
+// update the stat records and write the records of the block to the channels in channelMask
+static void WriteProfileJob(profileJob_t *job, profile_channel_info_t *channels, const uint64_t *channelMask, recordHandle_t *recordHandle) {
+    dataBlock_t *dataBlock = job->dataBlock;
+    record_header_t *record_ptr = (record_header_t *)((void *)dataBlock + sizeof(dataBlock_t));
+    uint32_t processed = job->firstFlow;
+    for (int i = 0; i < dataBlock->NumRecords; i++) {
+        if (record_ptr->type == V3Record) {
+            processed++;
+            const uint64_t *channelMatch = &job->channelMatch[i * numWords];
+            int mapped = 0;
+            for (int w = 0; w < numWords; w++) {
+                uint64_t matchBits = channelMatch[w] & channelMask[w];
+                while (matchBits) {
+                    // filter was successful -> continue record processing
+                    int j = (w << 6) + __builtin_ctzll(matchBits);
+                    matchBits &= matchBits - 1;
+
+                    // update statistics
+                    if (!mapped) {
+                        MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, processed);
+                        mapped = 1;
+                    }
+                    UpdateStatRecord(&channels[j].stat_record, recordHandle);
+
+                    // do we need to write data to new file - shadow profiles do not have files.
+                    // check if we need to flush the output buffer
+                    if (channels[j].nffile != NULL) {
+                        // write record to output buffer
+                        AppendToBuffer(channels[j].nffile, (void *)record_ptr, record_ptr->size);
+                    }
+                }
+            }  // End of for all matching channels
+        } else if (job->flush[i]) {
+            for (int w = 0; w < numWords; w++) {
+                uint64_t channelBits = channelMask[w];
+                while (channelBits) {
+                    int j = (w << 6) + __builtin_ctzll(channelBits);
+                    channelBits &= channelBits - 1;
+                    if (channels[j].nffile != NULL) {
+                        AppendToBuffer(channels[j].nffile, (void *)record_ptr, record_ptr->size);
+                    }
+                }
+            }
+        }
+        // Advance pointer by number of bytes for netflow record
+        record_ptr = (record_header_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+    }
+
+}  // End of WriteProfileJob
+
+__attribute__((noreturn)) static void *filterWorker(void *arg) {
+    filterWorker_t *worker = (filterWorker_t *)arg;
+
+    while (1) {
+        profileJob_t *job = queue_pop(worker->jobQueue);
+        if (job == QUEUE_CLOSED) break;
+
+        FilterProfileJob(job, worker->filterSet, &worker->recordHandle);
+
+        // the job may be released by the writers, as soon as the lock is released
+        pthread_mutex_lock(&filterLock);
+        job->filtered = 1;
+        pthread_cond_broadcast(&filterCond);
+        pthread_mutex_unlock(&filterLock);
+    }
+
+    pthread_exit(NULL);
+    /* UNREACHED */
+
+}  // End of filterWorker
+
+__attribute__((noreturn)) static void *channelWriter(void *arg) {
+    channelWriter_t *writer = (channelWriter_t *)arg;
+
+    while (1) {
+        profileJob_t *job = queue_pop(writer->jobQueue);
+        if (job == QUEUE_CLOSED) break;
+
+        // the jobs are queued in file order - wait for the filter worker of this job
+        pthread_mutex_lock(&filterLock);
+        while (!job->filtered) pthread_cond_wait(&filterCond, &filterLock);
+        pthread_mutex_unlock(&filterLock);
+
+        WriteProfileJob(job, writer->channels, writer->channelMask, &writer->recordHandle);
+
+        // the last writer releases the block
+        if (atomic_fetch_sub(&job->pending, 1) == 1) FreeProfileJob(job);
+    }
+
+    pthread_exit(NULL);
+    /* UNREACHED */
+
+}  // End of channelWriter
+
+// returns the number of threads to filter and write the channels
+static int NumProfileThreads(void) {
+    int numThreads = processThreads;
+    if (numThreads == 0) {
+        long CoresOnline = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = CoresOnline > 0 ? CoresOnline : 1;
+    }
+    if (numThreads > MAXWORKERS) numThreads = MAXWORKERS;
+    return numThreads;
+}  // End of NumProfileThreads
+
 static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot) {
     nffile_t *nffile = GetNextFile(NULL);
     if (!nffile) {
@@ -113,6 +369,80 @@ static void process_data(profile_channel_info_t *channels, unsigned int num_chan
         LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
         return;
     }
+
+    // shared predicates of all channel filters are evaluated once per record
+    void **engines = malloc((num_channels + 1) * sizeof(void *));
+    numWords = (num_channels + 63) >> 6;
+    uint64_t *channelMask = calloc(numWords + 1, sizeof(uint64_t));
+    if (!engines || !channelMask) {
+        LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+        goto CLEANUP;
+    }
+    int threadSafe = 1;
+    for (int j = 0; j < num_channels; j++) {
+        engines[j] = channels[j].engine;
+        channelMask[j >> 6] |= 1ULL << (j & 63);
+        if (!FilterThreadSafe(channels[j].engine)) threadSafe = 0;
+    }
+
+    // with more than one thread, blocks are filtered by the filter workers and written by the channel writers
+    // without any channel, there is no writer to release the blocks - process them in this thread
+    int numThreads = num_channels ? NumProfileThreads() : 1;
+    int numFilterWorkers = 0;
+    int numWriters = 0;
+    filterWorker_t *workers = NULL;
+    channelWriter_t *writers = NULL;
+    queue_t *filterQueue = NULL;
+    void *filterSet = NULL;
+    if (numThreads > 1) {
+        if (!threadSafe) LogInfo("Filter with regex can not be processed in parallel. Use 1 filter thread");
+        numFilterWorkers = threadSafe ? numThreads : 1;
+        numWriters = numThreads < num_channels ? numThreads : num_channels;
+
+        size_t queueSize = 1;
+        while (queueSize < (2 * numThreads)) queueSize <<= 1;
+        filterQueue = queue_init(queueSize);
+        workers = calloc(numFilterWorkers, sizeof(filterWorker_t));
+        writers = calloc(numWriters, sizeof(channelWriter_t));
+        if (!filterQueue || !workers || !writers) {
+            LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+            exit(255);
+        }
+        queue_open(filterQueue);
+
+        for (int i = 0; i < numFilterWorkers; i++) {
+            filterWorker_t *worker = &workers[i];
+            worker->jobQueue = filterQueue;
+            worker->filterSet = CompileFilterSet(engines, num_channels);
+            int err = pthread_create(&worker->tid, NULL, filterWorker, (void *)worker);
+            if (err) {
+                LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+                exit(255);
+            }
+        }
+
+        // channels are assigned round robin to the writers
+        for (int i = 0; i < numWriters; i++) {
+            channelWriter_t *writer = &writers[i];
+            writer->jobQueue = queue_init(queueSize);
+            writer->channels = channels;
+            writer->channelMask = calloc(numWords, sizeof(uint64_t));
+            if (!writer->jobQueue || !writer->channelMask) {
+                LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno));
+                exit(255);
+            }
+            for (int j = i; j < num_channels; j += numWriters) writer->channelMask[j >> 6] |= 1ULL << (j & 63);
+            queue_open(writer->jobQueue);
+            int err = pthread_create(&writer->tid, NULL, channelWriter, (void *)writer);
+            if (err) {
+                LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err));
+                exit(255);
+            }
+        }
+    } else {
+        filterSet = CompileFilterSet(engines, num_channels);
+    }
+
     uint32_t processed = 0;
     int done = 0;
     while (!done) {
@@ -149,98 +479,42 @@ static void process_data(profile_channel_info_t *channels, unsigned int num_chan
             continue;
         }
 
-        record_header_t *record_ptr = nffile->buff_ptr;
-        uint32_t sumSize = 0;
-        for (int i = 0; i < nffile->block_header->NumRecords; i++) {
-            if ((sumSize + record_ptr->size) > ret || (record_ptr->size < sizeof(record_header_t))) {
-                LogError("Corrupt data file. Inconsistent block size in %s line %d", __FILE__, __LINE__);
-                exit(255);
-            }
-            sumSize += record_ptr->size;
-
-            switch (record_ptr->type) {
-                case V3Record:
-                    processed++;
-                    MapRecordHandle(recordHandle, (recordHeaderV3_t *)record_ptr, processed);
-
-                    for (int j = 0; j < num_channels; j++) {
-                        int match;
-
-                        // apply profile filter
-                        void *engine = channels[j].engine;
-                        match = FilterRecord(engine, recordHandle, FILE_IDENT(nffile));
-
-                        // if profile filter failed -> next profile
-                        if (!match) continue;
-
-                        // filter was successful -> continue record processing
-
-                        // update statistics
-                        UpdateStatRecord(&channels[j].stat_record, recordHandle);
-
-                        // do we need to write data to new file - shadow profiles do not have files.
-                        // check if we need to flush the output buffer
-                        if (channels[j].nffile != NULL) {
-                            // write record to output buffer
-                            AppendToBuffer(channels[j].nffile, (void *)record_ptr, record_ptr->size);
-                        }
-
-                    }  // End of for all channels
-
-                    break;
-                case ExporterInfoRecordType: {
-                    int err = AddExporterInfo((exporter_info_record_t *)record_ptr);
-                    if (err != 0) {
-                        for (int j = 0; j < num_channels; j++) {
-                            if (channels[j].nffile != NULL && err == 1) {
-                                // flush new exporter
-                                AppendToBuffer(channels[j].nffile, (void *)record_ptr, record_ptr->size);
-                            }
-                        }
-                    } else {
-                        LogError("Failed to add Exporter Record");
-                    }
-                } break;
-                case SamplerLegacyRecordType: {
-                    if (AddSamplerLegacyRecord((samplerV0_record_t *)record_ptr) == 0) LogError("Failed to add legacy Sampler Record\n");
-                } break;
-                case SamplerRecordType: {
-                    int err = AddSamplerRecord((sampler_record_t *)record_ptr);
-                    if (err != 0) {
-                        for (int j = 0; j < num_channels; j++) {
-                            if (channels[j].nffile != NULL && err == 1) {
-                                // flush new map
-                                AppendToBuffer(channels[j].nffile, (void *)record_ptr, record_ptr->size);
-                            }
-                        }
-                    } else {
-                        LogError("Failed to add Sampler Record");
-                    }
-                } break;
-                case NbarRecordType:
-                case IfNameRecordType:
-                case VrfNameRecordType:
-                    for (int j = 0; j < num_channels; j++) {
-                        if (channels[j].nffile != NULL) {
-                            // flush new map
-                            AppendToBuffer(channels[j].nffile, (void *)record_ptr, record_ptr->size);
-                        }
-                    }
-                    break;
-                case LegacyRecordType1:
-                case LegacyRecordType2:
-                case ExporterStatRecordType:
-                    // Silently skip exporter records
-                    break;
-                default: {
-                    LogError("Skip unknown record type %i", record_ptr->type);
-                }
-            }
-            // Advance pointer by number of bytes for netflow record
-            record_ptr = (record_header_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+        profileJob_t *job = NewProfileJob(nffile, ret, &processed);
+        if (numThreads > 1) {
+            job->pending = numWriters;
+            for (int i = 0; i < numWriters; i++) queue_push(writers[i].jobQueue, job);
+            queue_push(filterQueue, job);
+        } else {
+            FilterProfileJob(job, filterSet, recordHandle);
+            WriteProfileJob(job, channels, channelMask, recordHandle);
+            FreeProfileJob(job);
+        }
+    }  // End of while !done
+
+    if (numThreads > 1) {
+        queue_close(filterQueue);
+        for (int i = 0; i < numFilterWorkers; i++) {
+            pthread_join(workers[i].tid, NULL);
+            DisposeFilterSet(workers[i].filterSet);
+        }
+        queue_free(filterQueue);
+        free(workers);
+
+        for (int i = 0; i < numWriters; i++) {
+            queue_close(writers[i].jobQueue);
+            pthread_join(writers[i].tid, NULL);
+            queue_free(writers[i].jobQueue);
+            free(writers[i].channelMask);
+        }
+        free(writers);
+    } else {
+        DisposeFilterSet(filterSet);
+    }
 
-        }  // End of for all umRecords
-    }      // End of while !done
+CLEANUP:
+    free(engines);
+    free(channelMask);
+    free(recordHandle);
 
     // Close input
     CloseFile(nffile);
@@ -452,7 +726,7 @@ int main(int argc, char **argv) {
 
     // default file names
     ffile = "filter.txt";
-    while ((c = getopt(argc, argv, "D:Ip:P:hi:f:jr:L:M:S:t:Vyz::Z")) != EOF) {
+    while ((c = getopt(argc, argv, "D:Ip:P:hi:f:jr:L:M:S:t:VW:yz::Z")) != EOF) {
         switch (c) {
             case 'h':
                 usage(argv[0]);
@@ -499,6 +773,14 @@ int main(int argc, char **argv) {
                 CheckArgLen(optarg, 32);
                 tslot = atoi(optarg);
                 break;
+            case 'W':
+                CheckArgLen(optarg, 16);
+                processThreads = atoi(optarg);
+                if (processThreads < 1 || processThreads > MAXWORKERS) {
+                    LogError("Number of process threads out of range 1..%d", MAXWORKERS);
+                    exit(255);
+                }
+                break;
             case 'M':
                 CheckArgLen(optarg, MAXPATHLEN);
                 flist.multiple_dirs = strdup(optarg);
@@ -224,11 +224,60 @@ static void RemoveExtension(recordHandle_t *recordHandle, int extID) {
 
 }  // end of RemoveExtension
 
+// write numFlows IPv4 flows into fileName. The flows repeat each src address and dst port
+// pair every 3000 * 7 flows, so large files have many flows to aggregate
+static int GenerateFlows(char *fileName, uint32_t numFlows) {
+    nffile_t *nffile = OpenNewFile(fileName, NULL, CREATOR_UNKNOWN, NOT_COMPRESSED, 0);
+    if (!nffile) return 0;
+
+    recordHeaderV3_t *record = (recordHeaderV3_t *)calloc(1, 4096);
+    recordHandle_t *recordHandle = (recordHandle_t *)calloc(1, sizeof(recordHandle_t));
+    if (!record || !recordHandle) {
+        perror("calloc() failed:");
+        exit(255);
+    }
+
+    AddV3Header(record, v3Record);
+    v3Record->nfversion = 10;
+    PushExtension(v3Record, EXgenericFlow, genericFlow);
+    PushExtension(v3Record, EXipv4Flow, ipv4Flow);
+    AssertMapRecordHandle(recordHandle, v3Record, 0);
+
+    genericFlow->proto = IPPROTO_TCP;
+    genericFlow->srcPort = 12345;
+    ipv4Flow->dstAddr = 0xC0A8AA64;  // 192.168.170.100
+    for (uint32_t i = 0; i < numFlows; i++) {
+        genericFlow->msecFirst = 1000LL * when + i;
+        genericFlow->msecLast = genericFlow->msecFirst + 1000LL;
+        genericFlow->inPackets = 1 + (i % 10);
+        genericFlow->inBytes = 100 * genericFlow->inPackets;
+        genericFlow->dstPort = 1000 + (i % 7);
+        ipv4Flow->srcAddr = 0xAC100000 + (i % 3000);  // 172.16.0.0
+        StoreRecord(recordHandle, nffile);
+    }
+
+    if (nffile->block_header->NumRecords) {
+        if (WriteBlock(nffile) <= 0) {
+            fprintf(stderr, "Failed to write output buffer to disk: '%s'", strerror(errno));
+        }
+    }
+    CloseUpdateFile(nffile);
+    free(recordHandle);
+    free(record);
+    return 1;
+
+}  // End of GenerateFlows
+
 int main(int argc, char **argv) {
     when = ISO2UNIX(strdup("201907111030"));
 
     if (!Init_nffile(1, NULL)) exit(254);
 
+    // nfgen -n <num> writes num flows into many_flows.nf
+    if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+        return GenerateFlows("many_flows.nf", (uint32_t)atoi(argv[2])) ? 0 : 255;
+    }
+
     nffile_t *nffile = OpenNewFile("dummy_flows.nf", NULL, CREATOR_UNKNOWN, NOT_COMPRESSED, 0);
     if (!nffile) {
         exit(255);
@@ -96,9 +96,150 @@ static void CheckFilter(char *filter, recordHandle_t *recordHandle, int expect)
         DumpRecord(recordHandle);
         exit(255);
     }
+
+    // the batch evaluation must return the same result for all selected records of a batch
+    recordHandle_t handles[3];
+    for (int i = 0; i < 3; i++) memcpy((void *)&handles[i], (void *)recordHandle, sizeof(recordHandle_t));
+    uint64_t selection[FILTERBATCH / 64] = {0x5};
+    FilterRecordBatch(engine, handles, 3, NULL, selection);
+    uint64_t expectSelection = ret ? 0x5 : 0;
+    if (selection[0] != expectSelection) {
+        printf("*** Batch filter failed for %s\n", filter);
+        printf("*** Expected %llx, result: %llx\n", (unsigned long long)expectSelection, (unsigned long long)selection[0]);
+        DumpEngine(engine);
+        exit(255);
+    }
+
+    // the filter must return the same result, after it is reordered by the sampled records
+    while (FilterSample(engine, recordHandle, 1, NULL) == 0);
+    ret = FilterRecord(engine, recordHandle, NULL);
+    if (ret != expect) {
+        printf("*** Reordered filter failed for %s\n", filter);
+        printf("*** Expected %d, result: %d\n", expect, ret);
+        DumpEngine(engine);
+        exit(255);
+    }
+    DisposeFilter(engine);
+}
+
+static void CheckBlockFilter(char *filter, blockIndex_t *blockIndex, int expect) {
+    void *engine = CompileFilter(filter);
+    if (!engine) {
+        printf("*** Compile %s failed\n", filter);
+        exit(255);
+    }
+    int ret = FilterBlock(engine, blockIndex);
+    if (ret != expect) {
+        printf("*** Block filter failed for %s\n", filter);
+        printf("*** Expected %d, result: %d\n", expect, ret);
+        DumpEngine(engine);
+        exit(255);
+    }
+    printf("Block filter ok: %s\n", filter);
     DisposeFilter(engine);
 }
 
+static void runBlockTest(void) {
+    blockIndex_t blockIndex = {
+        .src4AddrMin = 0x0a000001,  // 10.0.0.1
+        .src4AddrMax = 0x0a0000ff,  // 10.0.0.255
+        .dst4AddrMin = 0xac100001,  // 172.16.0.1
+        .dst4AddrMax = 0xac100001,
+        .srcPortMin = 1024,
+        .srcPortMax = 65535,
+        .dstPortMin = 53,
+        .dstPortMax = 80,
+        .exporterIDMin = 2,
+        .exporterIDMax = 3,
+        .protoMin = IPPROTO_TCP,
+        .protoMax = IPPROTO_UDP,
+    };
+
+    CheckBlockFilter("any", &blockIndex, 1);
+    CheckBlockFilter("dst port 53", &blockIndex, 1);
+    CheckBlockFilter("dst port 443", &blockIndex, 0);
+    CheckBlockFilter("port 443", &blockIndex, 0);
+    CheckBlockFilter("port 2000", &blockIndex, 1);
+    CheckBlockFilter("src port 443", &blockIndex, 0);
+    CheckBlockFilter("not dst port 443", &blockIndex, 1);
+    CheckBlockFilter("dst port > 80", &blockIndex, 0);
+    CheckBlockFilter("dst port >= 80", &blockIndex, 1);
+    CheckBlockFilter("dst port < 53", &blockIndex, 0);
+    CheckBlockFilter("dst port in [ 22 443 ]", &blockIndex, 0);
+    CheckBlockFilter("dst port in [ 22 60 443 ]", &blockIndex, 1);
+    CheckBlockFilter("proto icmp", &blockIndex, 0);
+    CheckBlockFilter("proto tcp", &blockIndex, 1);
+    CheckBlockFilter("host 10.0.0.10", &blockIndex, 1);
+    CheckBlockFilter("host 10.0.1.10", &blockIndex, 0);
+    CheckBlockFilter("src host 172.16.0.1", &blockIndex, 0);
+    CheckBlockFilter("dst host 172.16.0.1", &blockIndex, 1);
+    CheckBlockFilter("host 10.0.0.10 and port 2000", &blockIndex, 1);
+    CheckBlockFilter("host 10.0.0.10 and dst port 443", &blockIndex, 0);
+    CheckBlockFilter("host 10.0.1.10 or dst port 53", &blockIndex, 1);
+    CheckBlockFilter("src net 10.0.0.0/24", &blockIndex, 1);
+    CheckBlockFilter("src net 10.1.0.0/16", &blockIndex, 0);
+    CheckBlockFilter("exporter id 1", &blockIndex, 0);
+    CheckBlockFilter("exporter id 3", &blockIndex, 1);
+    CheckBlockFilter("bytes > 1000", &blockIndex, 1);
+    CheckBlockFilter("host 2001:db8::1", &blockIndex, 1);
+
+    // block without any IPv4 records
+    blockIndex.src4AddrMin = blockIndex.dst4AddrMin = UINT32_MAX;
+    blockIndex.src4AddrMax = blockIndex.dst4AddrMax = 0;
+    CheckBlockFilter("host 10.0.0.10", &blockIndex, 0);
+    CheckBlockFilter("not host 10.0.0.10", &blockIndex, 1);
+
+}  // End of runBlockTest
+
+static void runIndexTest(void) {
+    // more blocks than fit into one index record
+    uint32_t numBlocks = 2 * MAXINDEXENTRIES + 100;
+
+    if (!Init_nffile(1, NULL)) exit(255);
+    nffile_t *nffile = OpenNewFile("test.index.nf", NULL, CREATOR_UNKNOWN, NOT_COMPRESSED, 0);
+    if (!nffile) exit(255);
+
+    void *p = malloc(4192);
+    AddV3Header(p, recordHeaderV3);
+    PushExtension(recordHeaderV3, EXgenericFlow, genericFlow);
+    genericFlow->proto = IPPROTO_TCP;
+
+    // one record per block
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        genericFlow->msecFirst = 1000LL * i;
+        genericFlow->msecLast = genericFlow->msecFirst + 10;
+        memcpy(nffile->buff_ptr, p, recordHeaderV3->size);
+        nffile->block_header->NumRecords++;
+        nffile->block_header->size += recordHeaderV3->size;
+        WriteBlock(nffile);
+    }
+    CloseUpdateFile(nffile);
+    DisposeFile(nffile);
+
+    nffile = OpenFile("test.index.nf", NULL);
+    if (!nffile) exit(255);
+    if (nffile->file_header->NumBlocks != numBlocks || nffile->numIndex != numBlocks) {
+        printf("*** Block index failed: %u blocks, %u index entries, expected %u\n", nffile->file_header->NumBlocks, nffile->numIndex,
+               numBlocks);
+        exit(255);
+    }
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        blockIndex_t *blockIndex = &nffile->blockIndex[i];
+        if (blockIndex->NumRecords != 1 || blockIndex->msecFirstMin != 1000LL * i || blockIndex->msecLastMax != 1000LL * i + 10 ||
+            blockIndex->numTCP != 1) {
+            printf("*** Block index entry %u failed\n", i);
+            exit(255);
+        }
+    }
+    printf("Block index ok: %u entries\n", nffile->numIndex);
+
+    CloseFile(nffile);
+    DisposeFile(nffile);
+    unlink("test.index.nf");
+    free(p);
+
+}  // End of runIndexTest
+
 static void runTest(void) {
     void *p = malloc(4192);
     AddV3Header(p, recordHeaderV3);
@@ -461,6 +602,52 @@ static void runTest(void) {
     CheckFilter("dst ip in [8.8.8.8 2.2.2.2 192.168.169.171 fe80::2110:abcd:1234:5678]", recordHandle, 0);
     CheckFilter("dst ip in [8.8.8.8 2.2.2.2 192.168.169.171 fe80::2110:abcd:1234:5678 2001:620:0:ff::5c]", recordHandle, 1);
 
+    // large IP lists with lookup table
+#define IPLIST16                                                                                                     \
+    "1.1.1.1 2.2.2.2 3.3.3.3 4.4.4.4 5.5.5.5 6.6.6.6 7.7.7.7 8.8.8.8 9.9.9.9 10.0.0.0/8 11.1.0.0/16 12.1.2.0/24 " \
+    "13.13.13.13 14.14.14.14 2001:db8::/32 2001:db8:1::1"
+    CheckFilter("ip in [" IPLIST16 "]", recordHandle, 0);
+    CheckFilter("src ip in [" IPLIST16 " 192.168.169.170]", recordHandle, 1);
+    CheckFilter("dst ip in [" IPLIST16 " 172.16.0.0/12]", recordHandle, 1);
+    CheckFilter("dst ip in [" IPLIST16 " 172.16.17.0/25]", recordHandle, 1);
+    CheckFilter("dst ip in [" IPLIST16 " 172.16.17.128/25]", recordHandle, 0);
+    CheckFilter("dst ip in [" IPLIST16 " 172.16.17.99/24]", recordHandle, 1);
+    CheckFilter("dst ip in [172.16.99.99/16]", recordHandle, 1);
+    CheckFilter("src ip in [" IPLIST16 " fe80::2110:abcd:1234:5678]", recordHandle, 1);
+    CheckFilter("src ip in [" IPLIST16 " fe80::2110:abcd:1234:5679]", recordHandle, 0);
+    CheckFilter("src ip in [" IPLIST16 " fe80::/10]", recordHandle, 1);
+    CheckFilter("dst ip in [" IPLIST16 " 2001:620::/29]", recordHandle, 1);
+    CheckFilter("dst ip in [" IPLIST16 " 2001:628::/29]", recordHandle, 0);
+    CheckFilter("dst ip in [" IPLIST16 " 2001:620:0:ff::5c/127]", recordHandle, 1);
+    CheckFilter("dst ip in [" IPLIST16 " 2001:620:0:ff::5e/127]", recordHandle, 0);
+
+    // IPv4 mapped prefix must not be mistaken for an IPv4 prefix
+    inet_pton(PF_INET6, "::ffff:172.20.1.2", v6);
+    ipv6->srcAddr[0] = ntohll(v6[0]);
+    ipv6->srcAddr[1] = ntohll(v6[1]);
+    CheckFilter("src ip in [" IPLIST16 " ::ffff:172.20.0.0/108]", recordHandle, 1);
+    CheckFilter("src ip in [" IPLIST16 " ::ffff:172.21.0.0/112]", recordHandle, 0);
+    inet_pton(PF_INET6, "::172.20.1.2", v6);
+    ipv6->srcAddr[0] = ntohll(v6[0]);
+    ipv6->srcAddr[1] = ntohll(v6[1]);
+    CheckFilter("src ip in [" IPLIST16 " ::ffff:172.20.0.0/108]", recordHandle, 0);
+    CheckFilter("src ip in [" IPLIST16 " 172.20.0.0/12]", recordHandle, 1);
+    inet_pton(PF_INET6, "fe80::2110:abcd:1234:5678", v6);
+    ipv6->srcAddr[0] = ntohll(v6[0]);
+    ipv6->srcAddr[1] = ntohll(v6[1]);
+
+    // ::/96 and ::/64 cover all IPv4 addresses, as in the RB tree
+#define IP6LIST16                                                                                             \
+    "2001:db8:1::1 2001:db8:2::1 2001:db8:3::1 2001:db8:4::1 2001:db8:5::1 2001:db8:6::1 2001:db8:7::1 " \
+    "2001:db8:8::1 2001:db8:9::1 2001:db8:a::1 2001:db8:b::1 2001:db8:c::1 2001:db8:d::1 2001:db8:e::1 " \
+    "2001:db8:f::1 2001:db8:10::1"
+    CheckFilter("dst ip in [::/96]", recordHandle, 1);
+    CheckFilter("dst ip in [" IP6LIST16 " ::/96]", recordHandle, 1);
+    CheckFilter("dst ip in [::/64]", recordHandle, 1);
+    CheckFilter("dst ip in [" IP6LIST16 " ::/64]", recordHandle, 1);
+    CheckFilter("dst ip in [::1:0:0/96]", recordHandle, 0);
+    CheckFilter("dst ip in [" IP6LIST16 " ::1:0:0/96]", recordHandle, 0);
+
     // port lists
     genericFlow->srcPort = 44331;
     genericFlow->dstPort = 80;
@@ -470,6 +657,9 @@ static void runTest(void) {
     CheckFilter("port in [44331, 443 143 25]", recordHandle, 1);
     CheckFilter("src port in [44331 443 143 25]", recordHandle, 1);
     CheckFilter("dst port in [44331 443 143 25]", recordHandle, 0);
+    CheckFilter("dst port in [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 443]", recordHandle, 0);
+    CheckFilter("dst port in [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 80]", recordHandle, 1);
+    CheckFilter("src port in [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 44331]", recordHandle, 1);
 
     // AS lists
     asRouting->srcAS = 65535;
@@ -480,6 +670,9 @@ static void runTest(void) {
     CheckFilter("as in [65535, 55443 44332]", recordHandle, 1);
     CheckFilter("src as in [65535, 55443 44332]", recordHandle, 1);
     CheckFilter("dst as in [65535, 55443 44332]", recordHandle, 0);
+    CheckFilter("as in [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 100000]", recordHandle, 0);
+    CheckFilter("dst as in [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 100000 330]", recordHandle, 1);
+    CheckFilter("src as in [1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 100000 65535]", recordHandle, 1);
 
     // EXmplsLabelID
     PushExtension(recordHeaderV3, EXmplsLabel, mplsLabel);
@@ -924,7 +1117,82 @@ static void runTest(void) {
     printf("DONE.\n");
 }  // End of runTest
 
+static void runFilterSetTest(void) {
+    char *filters[] = {"src net 10.0.0.0/8 and dst port 80",
+                       "src net 10.0.0.0/8 and dst port 443",
+                       "src net 10.0.0.0/8 or proto udp",
+                       "not src net 10.0.0.0/8",
+                       "dst port in [ 80 443 8080 ]",
+                       "dst port in [ 8080 443 80 ] and proto tcp",
+                       "any",
+                       "src net 10.0.0.0/8 and dst port 80"};
+    int numFilters = sizeof(filters) / sizeof(char *);
+
+    // more than 64 engines, which share the dst port elements
+    uint32_t numEngines = numFilters + 70;
+    void *engines[numEngines];
+    for (int i = 0; i < numEngines; i++) {
+        char portFilter[32];
+        snprintf(portFilter, sizeof(portFilter), "dst port %d", 10 * (i - numFilters));
+        engines[i] = CompileFilter(i < numFilters ? filters[i] : portFilter);
+        if (!engines[i]) {
+            printf("*** Compile filter %d failed\n", i);
+            exit(255);
+        }
+    }
+    void *filterSet = CompileFilterSet(engines, numEngines);
+
+    void *p = malloc(4192);
+    AddV3Header(p, recordHeaderV3);
+    PushExtension(recordHeaderV3, EXgenericFlow, genericFlow);
+    PushExtension(recordHeaderV3, EXipv4Flow, ipv4);
+    recordHandle_t *recordHandle = (recordHandle_t *)calloc(1, sizeof(recordHandle_t));
+    if (!recordHandle) {
+        perror("calloc() failed:");
+        exit(255);
+    }
+    MapRecordHandle(recordHandle, recordHeaderV3, 1);
+
+    uint32_t srcAddr[] = {0x0a000001, 0x0b000001};
+    uint16_t dstPort[] = {80, 443, 8080, 600, 53};
+    uint8_t proto[] = {IPPROTO_TCP, IPPROTO_UDP};
+    for (int a = 0; a < 2; a++) {
+        for (int b = 0; b < 5; b++) {
+            for (int c = 0; c < 2; c++) {
+                ipv4->srcAddr = srcAddr[a];
+                genericFlow->dstPort = dstPort[b];
+                genericFlow->proto = proto[c];
+
+                // the filter set must match the same engines as each engine by itself
+                uint64_t match[(numEngines + 63) / 64];
+                FilterRecordSet(filterSet, recordHandle, NULL, match);
+                for (int i = 0; i < numEngines; i++) {
+                    int expect = FilterRecord(engines[i], recordHandle, NULL);
+                    int ret = (match[i >> 6] >> (i & 63)) & 1;
+                    if (ret != expect) {
+                        printf("*** Filter set failed for engine %d\n", i);
+                        printf("*** Expected %d, result: %d\n", expect, ret);
+                        DumpEngine(engines[i]);
+                        DumpRecord(recordHandle);
+                        exit(255);
+                    }
+                }
+            }
+        }
+    }
+    printf("Filter set ok: %u engines\n", numEngines);
+
+    DisposeFilterSet(filterSet);
+    for (int i = 0; i < numEngines; i++) DisposeFilter(engines[i]);
+    free(recordHandle);
+    free(p);
+
+}  // End of runFilterSetTest
+
 int main(int argc, char **argv) {
     runTest();
+    runBlockTest();
+    runIndexTest();
+    runFilterSetTest();
     return 0;
 }
@@ -41,4 +41,21 @@ $NFDUMP -J 3 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J 1 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J lz4:5 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J lz4:9 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+# only one non empty level is accepted
+if $NFDUMP -J lz4:5:9 -r dummy_flows.nf 2>/dev/null; then exit 1; fi
+if $NFDUMP -J lz4::delta -r dummy_flows.nf 2>/dev/null; then exit 1; fi
+$NFDUMP -J lz4:delta -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+# delta encoded files are marked with layout version 3
+$NFDUMP -v dummy_flows.nf | grep -q '^Version    : 3'
+$NFDUMP -r dummy_flows.nf -q -o raw >test.delta.out
+diff -u test.delta.out nftest.1.out
+rm -f test.delta.out
+# column encoded files read the same records and are marked with layout version 3
+if $NFDUMP -J lz4:delta:column -r dummy_flows.nf 2>/dev/null; then exit 1; fi
+$NFDUMP -J lz4:column -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+$NFDUMP -v dummy_flows.nf | grep -q '^Version    : 3'
+$NFDUMP -r dummy_flows.nf -q -o raw >test.column.out
+diff -u test.column.out nftest.1.out
+rm -f test.column.out
 $NFDUMP -J 0 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+$NFDUMP -v dummy_flows.nf | grep -q '^Version    : 2'
@@ -41,3 +41,9 @@ $NFDUMP -J 0 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J 1 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J 0 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J lzo -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+$NFDUMP -J lzo:adapt -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+# adaptive compressed files are marked with layout version 3
+$NFDUMP -v dummy_flows.nf | grep -q '^Version    : 3'
+$NFDUMP -r dummy_flows.nf -q -o raw >test.adapt.out
+diff -u test.adapt.out nftest.1.out
+rm -f test.adapt.out
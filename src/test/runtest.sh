@@ -151,12 +151,56 @@ export MallocCorruptionAbort=1
 $NFDUMP -r dummy_flows.nf 'host 172.16.2.66'
 $NFDUMP -r dummy_flows.nf -s ip 'host 172.16.2.66'
 $NFDUMP -r dummy_flows.nf -s record 'host 172.16.2.66'
+# parallel statistics and aggregation must match the single threaded results
+$NFDUMP -r dummy_flows.nf -q -n 0 -s srcip/bytes -A srcip,dstport -o csv | sort >test.10.out
+$NFDUMP -r dummy_flows.nf -q -n 0 -s srcip/bytes -A srcip,dstport -o csv -P 2 | sort >test.11.out
+diff test.10.out test.11.out
+# approximate statistic with enough counters must match the exact statistic with max error 0
+$NFDUMP -r dummy_flows.nf -q -n 0 -s dstport/bytes -o csv | sort >test.12.out
+$NFDUMP -r dummy_flows.nf -q -n 0 -s dstport:a/bytes -o csv -P 2 | sed -e 's/,err$//' -e 's/,0$//' | sort >test.13.out
+diff test.12.out test.13.out
+# flow cache spilled to disk must match the results without spilling. The spill directory is removed
+./nfgen -n 30000
+mkdir -p testdir/spill
+printf '[nfdump]\naggrmemory = 1\ntmpdir = "testdir/spill"\n' >test.spill.conf
+$NFDUMP -r many_flows.nf -q -n 0 -A srcip,dstport -o csv | sort >test.14.out
+$NFDUMP -C test.spill.conf -r many_flows.nf -q -n 0 -A srcip,dstport -o csv 2>test.15.log | sort >test.15.out
+grep -q 'spilled to disk' test.15.log
+diff test.14.out test.15.out
+$NFDUMP -C test.spill.conf -r many_flows.nf -q -n 0 -A srcip,dstport -o csv -P 2 2>test.16.log | sort >test.16.out
+grep -q 'spilled to disk' test.16.log
+diff test.14.out test.16.out
+$NFDUMP -r many_flows.nf -q -n 0 -s srcip/bytes -o csv | sort >test.17.out
+$NFDUMP -C test.spill.conf -r many_flows.nf -q -n 0 -s srcip/bytes -o csv | sort >test.18.out
+$NFDUMP -C test.spill.conf -r many_flows.nf -q -n 0 -s srcip/bytes -o csv -P 2 | sort >test.19.out
+diff test.17.out test.18.out
+diff test.17.out test.19.out
+# a budget just below the memory of a grown flow table must not spill the cache for each new flow
+printf '[nfdump]\naggrmemory = 3\ntmpdir = "testdir/spill"\n' >test.spill.conf
+$NFDUMP -r many_flows.nf -q -n 0 -a -o csv | sort >test.20.out
+$NFDUMP -C test.spill.conf -r many_flows.nf -q -n 0 -a -o csv 2>test.21.log | sort >test.21.out
+diff test.20.out test.21.out
+[ "$(sed -n 's/.*spilled to disk: \([0-9]*\) times/\1/p' test.21.log | tail -1)" -le 10 ]
+# bidir aggregation ignores the memory limit and aggregates in memory
+$NFDUMP -r many_flows.nf -q -n 0 -b -o csv | sort >test.22.out
+$NFDUMP -C test.spill.conf -r many_flows.nf -q -n 0 -b -o csv -P 2 2>test.23.log | sort >test.23.out
+grep -q 'aggrmemory is ignored' test.23.log
+diff test.22.out test.23.out
+[ -z "$(ls -A testdir/spill)" ]
+rmdir testdir/spill
+# blocks read while the filter is sampled must not be filtered by the workers, until the filter is reordered
+mkdir -p testdir/sample
+for i in $(seq 1 40); do cp dummy_flows.nf testdir/sample/nfcapd.2024010100$(printf %02d $i); done
+$NFDUMP -R testdir/sample -q -n 0 -A srcip,dstport -o csv 'proto udp or (proto tcp and bytes > 100)' | sort >test.24.out
+$NFDUMP -R testdir/sample -q -n 0 -A srcip,dstport -o csv -P 2 'proto udp or (proto tcp and bytes > 100)' | sort >test.25.out
+diff test.24.out test.25.out
+rm -rf testdir/sample
 $NFDUMP -r dummy_flows.nf -w test.7.flows.nf 'host 172.16.2.66'
 $NFDUMP -r dummy_flows.nf -O tstart -w test.8.flows.nf 'host 172.16.2.66'
 ../nfanon/nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r dummy_flows.nf -w test.9.flows.nf
 $NFDUMP -q -r test.9.flows.nf -o raw >test.9.out
 $NFDUMP -r testdir/nfcapd.* -i NewIdent
-rm -f testdir/nfcapd.* test*.out test*.flows.nf dummy_flows.nf
+rm -f testdir/nfcapd.* test*.out test*.log test.spill.conf test*.flows.nf dummy_flows.nf many_flows.nf
 [ -d testdir ] && rmdir testdir
 [ -d memck.$$ ] && rm -rf memck.$$
 
@@ -42,5 +42,23 @@ $NFDUMP -J 1 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J zstd -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J zstd:5 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J zstd:9 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+$NFDUMP -J zstd:column -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J 0 -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
 $NFDUMP -J lzo -r dummy_flows.nf && $NFDUMP -v dummy_flows.nf >/dev/null
+
+# zstd dictionary tests
+rm -rf testdict && mkdir testdict
+i=0
+while [ $i -lt 100 ]; do
+	cp dummy_flows.nf testdict/nfcapd.2024010100$i
+	i=$((i + 1))
+done
+../nfdict/nfdict -q -r testdict -s 4K -w test.dict
+printf '[nfdump]\nzstddict = "test.dict"\n' >test.conf
+$NFDUMP -C test.conf -r dummy_flows.nf -z=zstd -w test.zstd.nf
+$NFDUMP -v test.zstd.nf | grep Dictionary
+# dictionary compressed files are marked with layout version 3
+$NFDUMP -v test.zstd.nf | grep -q '^Version    : 3'
+$NFDUMP -r test.zstd.nf -q -o raw >test.dict.out
+diff -u test.dict.out nftest.1.out
+rm -rf testdict test.dict test.conf test.zstd.nf test.dict.out